@@ -0,0 +1,154 @@
+#ifndef ACCUMULATION_BUFFER_H
+#define ACCUMULATION_BUFFER_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "memory_stats.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+class accumulation_buffer {
+    // Per-pixel running sums of radiance samples and their counts, for rendering in passes.
+    // The buffer can be saved to and restored from a checkpoint file, so that an interrupted
+    // render can be resumed. The samplers derive every sample from the seed, the pixel and the
+    // sample index alone, so a resumed pass draws the values it would have drawn uninterrupted.
+    // The header holds a key of the scene and of every setting the radiance depends on (see
+    // camera::checkpoint_key), and a checkpoint with another key is rejected.
+
+public:
+    accumulation_buffer(int width, int height) :
+        width(width), height(height), sums(size_t(width) * height * 3), counts(size_t(width) * height),
+        storage(memory_category::FRAMEBUFFERS, sums.size() * sizeof(float) + counts.size() * sizeof(uint32_t)) {
+    }
+
+    void add(int i, int j, const color &c) {
+        auto p = index(i, j);
+        sums[3 * p + 0] += float(c.x());
+        sums[3 * p + 1] += float(c.y());
+        sums[3 * p + 2] += float(c.z());
+        counts[p]++;
+    }
+
+    int count(int i, int j) const {
+        return int(counts[index(i, j)]);
+    }
+
+    int min_count() const {
+        uint32_t result = counts.empty() ? 0 : counts[0];
+        for (auto n : counts)
+            result = std::min(result, n);
+        return int(result);
+    }
+
+    color average(int i, int j) const {
+        auto p = index(i, j);
+        if (counts[p] == 0)
+            return color(0, 0, 0);
+        return color(sums[3 * p + 0], sums[3 * p + 1], sums[3 * p + 2]) / counts[p];
+    }
+
+    template <typename T>
+    static uint64_t add_to_key(uint64_t key, const T &value) {
+        // Adds the bytes of a value to a checkpoint key, with 64-bit FNV-1a.
+        auto bytes = reinterpret_cast<const unsigned char *>(&value);
+        for (size_t n = 0; n < sizeof(T); n++)
+            key = (key ^ bytes[n]) * 0x100000001b3ull;
+        return key;
+    }
+
+    static uint64_t empty_key() {
+        return 0xcbf29ce484222325ull;
+    }
+
+    bool save(const std::string &filename, uint64_t key) const {
+        // Writes the buffer to a temporary file that then replaces the checkpoint, so a job
+        // stopped while saving keeps its previous checkpoint.
+        auto temp_filename = filename + ".tmp";
+        auto file = std::fopen(temp_filename.c_str(), "wb");
+        if (!file)
+            return false;
+
+        header h = make_header(key);
+        bool ok = std::fwrite(&h, sizeof(h), 1, file) == 1
+                  && std::fwrite(sums.data(), sizeof(float), sums.size(), file) == sums.size()
+                  && std::fwrite(counts.data(), sizeof(uint32_t), counts.size(), file) == counts.size();
+        ok = (std::fclose(file) == 0) && ok;
+
+        if (!ok || std::rename(temp_filename.c_str(), filename.c_str()) != 0) {
+            std::remove(temp_filename.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool load(const std::string &filename, uint64_t key, std::string &error) {
+        // Restores the buffer from a checkpoint of the same resolution and key. Leaves the
+        // buffer unchanged and returns false if there is no checkpoint, with an empty error,
+        // or if the checkpoint is unreadable or was made for another scene or settings.
+        error.clear();
+        auto file = std::fopen(filename.c_str(), "rb");
+        if (!file)
+            return false;
+
+        header expected = make_header(key);
+        header h;
+        std::vector<float> new_sums(sums.size());
+        std::vector<uint32_t> new_counts(counts.size());
+
+        bool matches = std::fread(&h, sizeof(h), 1, file) == 1
+                       && std::memcmp(&h, &expected, sizeof(h)) == 0;
+        bool ok = matches
+                  && std::fread(new_sums.data(), sizeof(float), new_sums.size(), file) == new_sums.size()
+                  && std::fread(new_counts.data(), sizeof(uint32_t), new_counts.size(), file) == new_counts.size();
+        std::fclose(file);
+
+        if (!ok) {
+            error = matches ? "checkpoint is truncated"
+                            : "checkpoint was made for another scene, resolution or settings";
+            return false;
+        }
+
+        sums.swap(new_sums);
+        counts.swap(new_counts);
+        return true;
+    }
+
+private:
+    struct header {
+        char magic[8];
+        uint32_t width;
+        uint32_t height;
+        uint64_t key; // Scene and render settings
+    };
+
+    int width, height;
+    std::vector<float> sums;      // Red, green and blue sums per pixel, row-major
+    std::vector<uint32_t> counts; // Samples taken per pixel
+    memory_account storage;       // Bytes of the sums and counts
+
+    size_t index(int i, int j) const {
+        return size_t(j) * width + i;
+    }
+
+    header make_header(uint64_t key) const {
+        header h;
+        std::memcpy(h.magic, "RTWACC02", 8);
+        h.width = uint32_t(width);
+        h.height = uint32_t(height);
+        h.key = key;
+        return h;
+    }
+};
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef ALIAS_TABLE_H
+#define ALIAS_TABLE_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include <vector>
+
+class alias_table {
+    // Walker's alias method: samples an index in proportion to a set of non-negative weights in
+    // constant time, after linear-time construction (Vose's variant).
+
+public:
+    alias_table() {
+    }
+
+    alias_table(const std::vector<double> &weights) {
+        auto n = weights.size();
+        bins.resize(n);
+        if (n == 0)
+            return;
+
+        double sum = 0;
+        for (auto w : weights)
+            sum += w;
+
+        // Fall back to uniform weights if nothing has positive weight.
+        for (size_t i = 0; i < n; i++)
+            bins[i].p = (sum > 0) ? weights[i] / sum : 1.0 / n;
+
+        // Split bins into those under and over the average probability 1/n.
+        std::vector<size_t> under, over;
+        for (size_t i = 0; i < n; i++) {
+            bins[i].q = bins[i].p * n;
+            bins[i].alias = i;
+            if (bins[i].q < 1)
+                under.push_back(i);
+            else
+                over.push_back(i);
+        }
+
+        // Top up each underfull bin with probability from an overfull one.
+        while (!under.empty() && !over.empty()) {
+            auto u = under.back();
+            auto o = over.back();
+            under.pop_back();
+            over.pop_back();
+
+            bins[u].alias = o;
+            bins[o].q -= 1 - bins[u].q;
+
+            if (bins[o].q < 1)
+                under.push_back(o);
+            else
+                over.push_back(o);
+        }
+
+        // Any leftovers are full up to rounding error.
+        for (auto i : under)
+            bins[i].q = 1;
+        for (auto i : over)
+            bins[i].q = 1;
+    }
+
+    size_t size() const {
+        return bins.size();
+    }
+
+    size_t storage_bytes() const {
+        return bins.capacity() * sizeof(bin);
+    }
+
+    double pmf(size_t index) const {
+        return bins[index].p;
+    }
+
+    size_t sample(double u) const {
+        // Maps a uniform value u in [0,1) to an index.
+        auto n = bins.size();
+        auto scaled = u * n;
+        auto index = size_t(scaled);
+        if (index >= n)
+            index = n - 1;
+
+        auto up = scaled - index;
+        return (up < bins[index].q) ? index : bins[index].alias;
+    }
+
+    size_t sample() const {
+        return sample(random_double());
+    }
+
+private:
+    struct bin {
+        double q;     // Probability of keeping this bin's own index
+        double p;     // Normalized weight of this index
+        size_t alias; // Index returned otherwise
+    };
+
+    std::vector<bin> bins;
+};
+
+#endif
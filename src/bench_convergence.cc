@@ -0,0 +1,334 @@
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Convergence benchmark of the render modes on the canonical scenes (see scenes.h):
+//
+//     bench_convergence [--scenes cornell,glass,many_lights,volume] [--modes bsdf,mixture,nee,mis]
+//                       [--width 128] [--max-spp 64] [--reference-spp 4096]
+//                       [--reference-dir .] [--output results.json]
+//
+// Every mode renders every scene at 1, 2, 4, ... up to max-spp samples per pixel, and the
+// error of each render against a stored reference is recorded with its wall-clock time. The
+// efficiency 1 / (MSE * seconds) is independent of the sample count for an unbiased
+// estimator, so it compares modes whose samples cost differently. References are rendered
+// with MIS at reference-spp the first time they are needed, as
+// <reference-dir>/reference_<scene>_<width>_<spp>spp_<key>.pfm, and reused afterwards. The key
+// covers the camera settings and a small probe render of the scene, so a reference made
+// before a change to the scene or the renderer is not reused.
+//
+// The results are written as JSON; progress goes to standard error.
+
+#include "rtweekend.h"
+
+#include "image_metrics.h"
+#include "scenes.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+struct mode_entry {
+    const char *name;
+    camera::RenderMode mode;
+};
+
+static const mode_entry modes[] = {
+    {"bsdf", camera::RenderMode::BSDF_SAMPLING},
+    {"mixture", camera::RenderMode::MIXTURE_SAMPLING},
+    {"nee", camera::RenderMode::NEE},
+    {"mis", camera::RenderMode::MIS},
+};
+
+struct convergence_point {
+    int spp;
+    double seconds;
+    image_metrics error;
+};
+
+static std::vector<std::string> split(const std::string &list) {
+    std::vector<std::string> items;
+    std::stringstream in(list);
+    std::string item;
+    while (std::getline(in, item, ','))
+        if (!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+static bool render_to_file(scene &s, const std::string &filename, double &seconds) {
+    // Renders the scene quietly into a PFM file and returns the wall-clock time taken.
+    s.cam.output_file = filename;
+
+    auto log = std::clog.rdbuf(nullptr);
+    auto start = std::chrono::steady_clock::now();
+    bool written = s.cam.render(s.world);
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::clog.rdbuf(log);
+    return written;
+}
+
+static bool reference_key(const std::string &scene_name, const std::string &directory, uint64_t &key) {
+    // Key of the reference settings and of the scene. Built-in scenes have no source to hash,
+    // so a tiny render at a fixed seed stands in for the scene's content.
+    scene s;
+    make_scene(scene_name, s);
+    s.cam.image_width = 16;
+    s.cam.samples_per_pixel = 4;
+    s.cam.render_mode = camera::RenderMode::MIS;
+    s.cam.seed = 0x5eed;
+
+    auto probe_file = directory + "/bench_probe.pfm";
+    float_image probe;
+    std::string error;
+    double seconds;
+    bool rendered = render_to_file(s, probe_file, seconds) && image_reader::read(probe_file, probe, error);
+    std::remove(probe_file.c_str());
+    if (!rendered)
+        return false;
+
+    s.cam.scene_hash = accumulation_buffer::empty_key();
+    for (auto value : probe.pixels)
+        s.cam.scene_hash = accumulation_buffer::add_to_key(s.cam.scene_hash, value);
+    key = s.cam.checkpoint_key();
+    return true;
+}
+
+static bool load_reference(
+    const std::string &scene_name, int width, int reference_spp, const std::string &directory,
+    std::string &filename, float_image &reference
+) {
+    uint64_t key;
+    if (!reference_key(scene_name, directory, key)) {
+        std::cerr << "ERROR: Could not render a probe of " << scene_name << ".\n";
+        return false;
+    }
+    char key_text[17];
+    std::snprintf(key_text, sizeof key_text, "%016llx", (unsigned long long)key);
+    filename = directory + "/reference_" + scene_name + "_" + std::to_string(width) + "_"
+             + std::to_string(reference_spp) + "spp_" + key_text + ".pfm";
+
+    std::string error;
+    if (image_reader::read(filename, reference, error))
+        return true;
+
+    std::cerr << "Rendering reference " << filename << " (" << reference_spp << " spp)\n";
+    scene s;
+    make_scene(scene_name, s);
+    s.cam.image_width = width;
+    s.cam.samples_per_pixel = reference_spp;
+    s.cam.render_mode = camera::RenderMode::MIS;
+    s.cam.seed = 0x5eed;
+
+    double seconds;
+    if (!render_to_file(s, filename, seconds) || !image_reader::read(filename, reference, error)) {
+        std::cerr << "ERROR: Could not create the reference " << filename << ".\n";
+        return false;
+    }
+    return true;
+}
+
+static void write_json(
+    std::ostream &out, const std::vector<std::string> &scene_list,
+    const std::vector<std::string> &reference_files, const std::vector<const mode_entry *> &mode_list,
+    const std::vector<std::vector<std::vector<convergence_point>>> &curves,
+    int width, int max_spp, int reference_spp, int threads
+) {
+    char number[64];
+    auto fmt = [&](double x) {
+        // JSON has no infinity, which a perfect match would give.
+        if (!std::isfinite(x)) return std::string("null");
+        std::snprintf(number, sizeof number, "%.9g", x);
+        return std::string(number);
+    };
+    auto quoted = [](const std::string &text) {
+        std::string result = "\"";
+        for (auto c : text) {
+            if (c == '"' || c == '\\') result += '\\';
+            result += c;
+        }
+        return result + "\"";
+    };
+
+    out << "{\n"
+        << "  \"width\": " << width << ",\n"
+        << "  \"max_spp\": " << max_spp << ",\n"
+        << "  \"reference_spp\": " << reference_spp << ",\n"
+        << "  \"threads\": " << threads << ",\n"
+        << "  \"scenes\": [\n";
+
+    for (size_t s = 0; s < scene_list.size(); s++) {
+        out << "    {\n"
+            << "      \"name\": " << quoted(scene_list[s]) << ",\n"
+            << "      \"reference\": " << quoted(reference_files[s]) << ",\n"
+            << "      \"modes\": [\n";
+
+        for (size_t m = 0; m < mode_list.size(); m++) {
+            const auto &curve = curves[s][m];
+            const auto &last = curve.back();
+            out << "        {\n"
+                << "          \"mode\": \"" << mode_list[m]->name << "\",\n"
+                << "          \"efficiency\": " << fmt(1 / (last.error.mse * last.seconds)) << ",\n"
+                << "          \"curve\": [\n";
+
+            for (size_t p = 0; p < curve.size(); p++) {
+                const auto &point = curve[p];
+                out << "            {\"spp\": " << point.spp
+                    << ", \"seconds\": " << fmt(point.seconds)
+                    << ", \"mse\": " << fmt(point.error.mse)
+                    << ", \"rel_mse\": " << fmt(point.error.rel_mse)
+                    << ", \"efficiency\": " << fmt(1 / (point.error.mse * point.seconds))
+                    << "}" << (p + 1 < curve.size() ? "," : "") << "\n";
+            }
+
+            out << "          ]\n"
+                << "        }" << (m + 1 < mode_list.size() ? "," : "") << "\n";
+        }
+
+        out << "      ]\n"
+            << "    }" << (s + 1 < scene_list.size() ? "," : "") << "\n";
+    }
+
+    out << "  ]\n"
+        << "}\n";
+}
+
+static int usage() {
+    std::cerr << "Usage: bench_convergence [--scenes a,b,...] [--modes bsdf,mixture,nee,mis] [--width N]\n"
+                 "                         [--max-spp N] [--reference-spp N] [--reference-dir DIR]\n"
+                 "                         [--output FILE]\n";
+    return 2;
+}
+
+int main(int argc, char *argv[]) {
+    auto scene_list = scene_names();
+    std::vector<const mode_entry *> mode_list;
+    for (const auto &m : modes)
+        mode_list.push_back(&m);
+
+    int width = 128;
+    int max_spp = 64;
+    int reference_spp = 4096;
+    std::string reference_dir = ".";
+    std::string output;
+
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (a + 1 >= argc)
+            return usage();
+        std::string value = argv[++a];
+
+        if (arg == "--scenes") {
+            scene_list = split(value);
+        } else if (arg == "--modes") {
+            mode_list.clear();
+            for (const auto &name : split(value)) {
+                const mode_entry *found = nullptr;
+                for (const auto &m : modes)
+                    if (name == m.name) found = &m;
+                if (!found) {
+                    std::cerr << "ERROR: Unknown render mode '" << name << "'.\n";
+                    return usage();
+                }
+                mode_list.push_back(found);
+            }
+        } else if (arg == "--width") {
+            width = std::atoi(value.c_str());
+        } else if (arg == "--max-spp") {
+            max_spp = std::atoi(value.c_str());
+        } else if (arg == "--reference-spp") {
+            reference_spp = std::atoi(value.c_str());
+        } else if (arg == "--reference-dir") {
+            reference_dir = value;
+        } else if (arg == "--output") {
+            output = value;
+        } else {
+            return usage();
+        }
+    }
+
+    if (width <= 0 || max_spp <= 0 || reference_spp <= 0 || scene_list.empty() || mode_list.empty())
+        return usage();
+
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+
+    auto render_file = reference_dir + "/bench_render.pfm";
+    std::vector<std::string> reference_files;
+    std::vector<std::vector<std::vector<convergence_point>>> curves;
+
+    for (const auto &scene_name : scene_list) {
+        scene s;
+        if (!make_scene(scene_name, s)) {
+            std::cerr << "ERROR: Unknown scene '" << scene_name << "'.\n";
+            return 2;
+        }
+
+        std::string reference_file;
+        float_image reference;
+        if (!load_reference(scene_name, width, reference_spp, reference_dir, reference_file, reference))
+            return 1;
+        reference_files.push_back(reference_file);
+        curves.emplace_back();
+
+        for (auto m : mode_list) {
+            std::vector<convergence_point> curve;
+            for (int spp = 1; spp <= max_spp; spp *= 2) {
+                s.cam.image_width = width;
+                s.cam.samples_per_pixel = spp;
+                s.cam.render_mode = m->mode;
+
+                convergence_point point;
+                point.spp = spp;
+                float_image image;
+                std::string error;
+                if (!render_to_file(s, render_file, point.seconds)
+                    || !image_reader::read(render_file, image, error)) {
+                    std::cerr << "ERROR: Could not render " << scene_name << " with " << m->name << ".\n";
+                    return 1;
+                }
+                if (image.width != reference.width || image.height != reference.height) {
+                    std::cerr << "ERROR: The reference " << reference_file << " is " << reference.width
+                              << 'x' << reference.height << ", the render " << image.width << 'x'
+                              << image.height << ".\n";
+                    return 1;
+                }
+                point.error = image_comparison::radiance_errors(image, reference);
+                curve.push_back(point);
+
+                std::cerr << scene_name << ' ' << m->name << ' ' << spp << " spp: "
+                          << point.seconds << " s, MSE " << point.error.mse << '\n';
+            }
+            curves.back().push_back(curve);
+        }
+    }
+    std::remove(render_file.c_str());
+
+    if (output.empty()) {
+        write_json(std::cout, scene_list, reference_files, mode_list, curves,
+                   width, max_spp, reference_spp, threads);
+    } else {
+        std::ofstream out(output);
+        write_json(out, scene_list, reference_files, mode_list, curves,
+                   width, max_spp, reference_spp, threads);
+        if (!out) {
+            std::cerr << "ERROR: Could not write '" << output << "'.\n";
+            return 1;
+        }
+    }
+    return 0;
+}
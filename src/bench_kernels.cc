@@ -0,0 +1,249 @@
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Micro-benchmarks of the hot kernels, on one thread:
+//
+//     bench_kernels [--filter <substring>] [--min-time <seconds>]
+//
+// Inputs are generated up front from a fixed seed, so every run times the same work and the
+// generator is not part of the measurement (except for pdf::generate, which draws its own
+// random numbers). Every kernel runs over its inputs until min-time has passed. One line is
+// printed per kernel: nanoseconds per call and millions of calls per second, which for the
+// hit kernels is millions of rays per second.
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+#include "bvh.h"
+#include "hittable_list.h"
+#include "image_encoder.h"
+#include "material.h"
+#include "pdf.h"
+#include "perlin.h"
+#include "quad.h"
+#include "sphere.h"
+#include "texture.h"
+
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static std::string filter;
+static double min_time = 0.25;
+static volatile double checksum_sink;
+
+template <typename Kernel>
+static void run(const std::string &name, size_t inputs, const Kernel &kernel) {
+    // Calls kernel(n) for n cycling through [0,inputs) until min_time has passed, and reports
+    // the time per call. The kernel returns a value derived from its result, which is summed
+    // into a checksum so the calls cannot be optimized away. The kernel is a template
+    // parameter, so it is inlined into the timed loop instead of called indirectly.
+    if (!filter.empty() && name.find(filter) == std::string::npos)
+        return;
+
+    using clock = std::chrono::steady_clock;
+    double checksum = 0;
+    size_t calls = 0;
+    auto start = clock::now();
+    double seconds = 0;
+
+    // Warm up once, then time whole passes over the inputs.
+    for (size_t n = 0; n < inputs; n++)
+        checksum += kernel(n);
+
+    start = clock::now();
+    do {
+        for (size_t n = 0; n < inputs; n++)
+            checksum += kernel(n);
+        calls += inputs;
+        seconds = std::chrono::duration<double>(clock::now() - start).count();
+    } while (seconds < min_time);
+
+    checksum_sink = checksum;
+    auto ns = 1e9 * seconds / calls;
+    std::printf("%-32s\t%10.2f ns/op\t%10.3f M/s\n", name.c_str(), ns, 1e3 / ns);
+    std::fflush(stdout);
+}
+
+static std::vector<ray> random_rays(size_t count, double extent, double target_extent) {
+    // Rays from random points on a sphere of radius extent around the origin toward random
+    // points in the cube [-target_extent, target_extent]^3.
+    std::vector<ray> rays;
+    rays.reserve(count);
+    for (size_t n = 0; n < count; n++) {
+        auto origin = extent * random_unit_vector();
+        auto target = vec3::random(-target_extent, target_extent);
+        rays.emplace_back(origin, unit_vector(target - origin));
+    }
+    return rays;
+}
+
+static void bench_primitives() {
+    const size_t count = 4096;
+    auto rays = random_rays(count, 4, 1.5);
+    auto mat = make_shared<lambertian>(color(.5, .5, .5));
+
+    std::vector<aabb> boxes;
+    for (size_t n = 0; n < count; n++) {
+        auto a = vec3::random(-1, 1), b = vec3::random(-1, 1);
+        boxes.push_back(aabb(a, b));
+    }
+    run("aabb::hit", count, [&](size_t n) {
+        return boxes[n].hit(rays[n], interval(0.001, infinity)) ? 1.0 : 0.0;
+    });
+
+    sphere ball(point3(0, 0, 0), 1, mat);
+    run("sphere::hit", count, [&](size_t n) {
+        hit_record rec;
+        return ball.hit(rays[n], interval(0.001, infinity), rec) ? rec.t : 0.0;
+    });
+
+    quad square(point3(-1, -1, 0), vec3(2, 0, 0), vec3(0, 2, 0), mat);
+    run("quad::hit", count, [&](size_t n) {
+        hit_record rec;
+        return square.hit(rays[n], interval(0.001, infinity), rec) ? rec.t : 0.0;
+    });
+}
+
+static hittable_list random_spheres(size_t count) {
+    // count spheres in the cube [-1,1]^3, sized so that they fill about a tenth of it.
+    hittable_list list;
+    auto mat = make_shared<lambertian>(color(.5, .5, .5));
+    auto radius = 0.6 / std::cbrt(double(count));
+    for (size_t n = 0; n < count; n++)
+        list.add(make_shared<sphere>(vec3::random(-1, 1), radius, mat));
+    return list;
+}
+
+static void bench_aggregates() {
+    const size_t count = 4096;
+    auto rays = random_rays(count, 4, 1);
+
+    for (size_t size : {1, 4, 16, 64, 256}) {
+        auto list = random_spheres(size);
+        run("hittable_list::hit/" + std::to_string(size), count, [&](size_t n) {
+            hit_record rec;
+            return list.hit(rays[n], interval(0.001, infinity), rec) ? rec.t : 0.0;
+        });
+    }
+
+    for (size_t size : {16, 256, 4096, 65536}) {
+        auto list = random_spheres(size);
+        bvh_node tree(list);
+        run("bvh_node::hit/" + std::to_string(size), count, [&](size_t n) {
+            hit_record rec;
+            return tree.hit(rays[n], interval(0.001, infinity), rec) ? rec.t : 0.0;
+        });
+    }
+}
+
+static void bench_pdfs() {
+    const size_t count = 4096;
+    std::vector<vec3> directions, normals;
+    for (size_t n = 0; n < count; n++) {
+        directions.push_back(random_unit_vector());
+        normals.push_back(random_unit_vector());
+    }
+
+    auto light_material = make_shared<diffuse_light>(color(15, 15, 15));
+    hittable_list lights(make_shared<quad>(point3(-1, 4, -1), vec3(2, 0, 0), vec3(0, 0, 2), light_material));
+
+    std::vector<shared_ptr<pdf>> cosines, phongs, to_lights, mixtures;
+    for (size_t n = 0; n < count; n++) {
+        cosines.push_back(make_shared<cosine_pdf>(normals[n]));
+        phongs.push_back(make_shared<phong_pdf>(normals[n], 30, normals[n]));
+        to_lights.push_back(make_shared<hittable_pdf>(lights, point3(0, 0, 0) + 0.5 * normals[n]));
+        mixtures.push_back(make_shared<mixture_pdf>(to_lights.back(), cosines.back()));
+    }
+
+    sphere_pdf uniform;
+    run("sphere_pdf::generate", count, [&](size_t n) { return uniform.generate().x(); });
+    run("sphere_pdf::value", count, [&](size_t n) { return uniform.value(directions[n]); });
+
+    const std::vector<shared_ptr<pdf>> *kinds[] = {&cosines, &phongs, &to_lights, &mixtures};
+    const char *names[] = {"cosine_pdf", "phong_pdf", "hittable_pdf", "mixture_pdf"};
+    for (int k = 0; k < 4; k++) {
+        const auto &pdfs = *kinds[k];
+        run(std::string(names[k]) + "::generate", count, [&](size_t n) { return pdfs[n]->generate().x(); });
+        run(std::string(names[k]) + "::value", count, [&](size_t n) { return pdfs[n]->value(directions[n]); });
+    }
+}
+
+static void bench_textures() {
+    const size_t count = 4096;
+    std::vector<point3> points;
+    std::vector<double> us, vs;
+    for (size_t n = 0; n < count; n++) {
+        points.push_back(vec3::random(-10, 10));
+        us.push_back(random_double());
+        vs.push_back(random_double());
+    }
+
+    perlin noise;
+    run("perlin::turb", count, [&](size_t n) { return noise.turb(points[n], 7); });
+
+    // A 512 x 512 texture, written to a temporary file for the loader.
+    const int size = 512;
+    std::vector<unsigned char> pixels(size * size * 3);
+    for (auto &p : pixels)
+        p = (unsigned char)random_int(0, 255);
+    const char *texture_file = "bench_kernels_texture.png";
+    if (!stbi_write_png(texture_file, size, size, 3, pixels.data(), size * 3)) {
+        std::cerr << "ERROR: Could not write the benchmark texture.\n";
+        return;
+    }
+
+    image_texture tex(texture_file);
+    std::remove(texture_file);
+    run("image_texture::value", count, [&](size_t n) { return tex.value(us[n], vs[n], points[n]).x(); });
+}
+
+static void bench_output() {
+    const size_t count = 4096;
+    std::vector<color> colors;
+    for (size_t n = 0; n < count; n++)
+        colors.push_back(vec3::random(0, 1.2));
+
+    std::ostringstream out;
+    run("write_color", count, [&](size_t n) {
+        // Restart the stream now and then, so it stays small.
+        if (n == 0) out.str(std::string());
+        write_color(out, colors[n]);
+        return double(out.tellp());
+    });
+
+    unsigned char rgb[3];
+    run("color_to_bytes", count, [&](size_t n) {
+        color_to_bytes(colors[n], rgb);
+        return double(rgb[0] + rgb[1] + rgb[2]);
+    });
+}
+
+int main(int argc, char *argv[]) {
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--filter" && a + 1 < argc) {
+            filter = argv[++a];
+        } else if (arg == "--min-time" && a + 1 < argc) {
+            min_time = std::atof(argv[++a]);
+        } else {
+            std::cerr << "Usage: bench_kernels [--filter <substring>] [--min-time <seconds>]\n";
+            return 2;
+        }
+    }
+
+    std::srand(1);
+    bench_primitives();
+    bench_aggregates();
+    bench_pdfs();
+    bench_textures();
+    bench_output();
+}
@@ -0,0 +1,310 @@
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Thread-scaling benchmark:
+//
+//     bench_scaling [--scene cornell] [--width 200] [--spp 16] [--max-threads N]
+//                   [--output results.json]
+//
+// Renders one scene with a fixed sample count and seed at 1, 2, 4, ... up to max-threads
+// threads (by default the processor count), and prints the wall time, speedup, parallel
+// efficiency and rays per second per thread of each.
+//
+// Alongside, contention probes time the shared state that the render touches, one thread
+// count at a time: the C library generator (whose state sits behind a lock), copies of one
+// shared_ptr (one reference count for all threads), and framebuffer writes by tile and by
+// interleaved pixels (cache lines shared between threads). A thread-local generator is the
+// baseline: it scales as well as the machine does. A probe that scales clearly worse than the
+// baseline is flagged, and is a likely cause of any sub-linear scaling of the render at that
+// thread count. The results can also be written as JSON.
+
+#include "rtweekend.h"
+
+#include "scenes.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+static const double flag_ratio = 0.75; // Efficiency below this fraction of the baseline is flagged
+
+struct probe_kernel {
+    const char *name;
+    std::function<double(int thread, int threads, size_t ops)> run; // Returns a checksum
+};
+
+struct scaling_point {
+    int threads;
+    double seconds;
+    double rays;
+    std::vector<double> probe_rates; // Operations per second, all threads together
+};
+
+static volatile double checksum_sink;
+
+static double parallel_rate(int threads, size_t ops, const probe_kernel &kernel) {
+    // Runs the kernel on every thread at once, ops operations each, and returns the operations
+    // per second of all threads together.
+    double checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+#pragma omp parallel num_threads(threads) reduction(+ : checksum)
+    {
+        int thread = 0;
+#ifdef _OPENMP
+        thread = omp_get_thread_num();
+#endif
+        checksum += kernel.run(thread, threads, ops);
+    }
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    checksum_sink = checksum;
+    return threads * double(ops) / seconds;
+}
+
+static std::vector<probe_kernel> make_probes(framebuffer &fb) {
+    // The baseline comes first.
+    auto shared_material = make_shared<lambertian>(color(.5, .5, .5));
+    std::vector<probe_kernel> probes;
+
+    probes.push_back({"thread-local generator", [](int thread, int, size_t ops) {
+        uint64_t x = 0x9e3779b97f4a7c15ull * (thread + 1);
+        double sum = 0;
+        for (size_t n = 0; n < ops; n++) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            sum += double(x >> 11);
+        }
+        return sum;
+    }});
+
+    probes.push_back({"std::rand", [](int, int, size_t ops) {
+        double sum = 0;
+        for (size_t n = 0; n < ops; n++)
+            sum += std::rand();
+        return sum;
+    }});
+
+    probes.push_back({"shared_ptr copy", [shared_material](int, int, size_t ops) {
+        double sum = 0;
+        for (size_t n = 0; n < ops; n++) {
+            shared_ptr<material> copy = shared_material;
+            sum += (copy != nullptr);
+        }
+        return sum;
+    }});
+
+    probes.push_back({"framebuffer tiles", [&fb](int thread, int threads, size_t ops) {
+        // Each thread writes whole 32 x 32 tiles, as the renderer does.
+        const int size = 32;
+        int tiles_x = fb.width() / size;
+        int tiles = tiles_x * (fb.height() / size);
+        size_t written = 0;
+        while (written < ops) {
+            for (int t = thread; t < tiles && written < ops; t += threads) {
+                int x = (t % tiles_x) * size, y = (t / tiles_x) * size;
+                for (int j = y; j < y + size; j++)
+                    for (int i = x; i < x + size; i++)
+                        fb.set_color(framebuffer::RADIANCE, i, j, color(written, 0, 0));
+                written += size * size;
+            }
+        }
+        return double(written);
+    }});
+
+    probes.push_back({"framebuffer interleaved", [&fb](int thread, int threads, size_t ops) {
+        // Neighboring pixels go to different threads, so every cache line is shared.
+        size_t written = 0;
+        while (written < ops) {
+            for (int j = 0; j < fb.height() && written < ops; j++) {
+                for (int i = thread; i < fb.width(); i += threads)
+                    fb.set_color(framebuffer::RADIANCE, i, j, color(written, 0, 0));
+                written += fb.width() / threads;
+            }
+        }
+        return double(written);
+    }});
+
+    return probes;
+}
+
+static bool render(scene &s, const std::string &filename, double &seconds, double &rays) {
+    // Renders the scene quietly and returns the wall-clock time and the rays traced.
+    s.cam.output_file = filename;
+
+    auto log = std::clog.rdbuf(nullptr);
+    auto start = std::chrono::steady_clock::now();
+    bool written = s.cam.render(s.world);
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::clog.rdbuf(log);
+
+    rays = double(stats_registry::instance().collect()[stat_counter::RAYS]);
+    std::remove(filename.c_str());
+    return written;
+}
+
+static void write_json(
+    std::ostream &out, const std::string &scene_name, int width, int spp,
+    const std::vector<probe_kernel> &probes, const std::vector<scaling_point> &points
+) {
+    char number[64];
+    auto fmt = [&](double x) {
+        if (!std::isfinite(x)) return std::string("null");
+        std::snprintf(number, sizeof number, "%.6g", x);
+        return std::string(number);
+    };
+
+    const auto &base = points.front();
+    out << "{\n"
+        << "  \"scene\": \"" << scene_name << "\",\n"
+        << "  \"width\": " << width << ",\n"
+        << "  \"spp\": " << spp << ",\n"
+        << "  \"points\": [\n";
+    for (size_t p = 0; p < points.size(); p++) {
+        const auto &point = points[p];
+        auto speedup = base.seconds / point.seconds;
+        out << "    {\"threads\": " << point.threads
+            << ", \"seconds\": " << fmt(point.seconds)
+            << ", \"speedup\": " << fmt(speedup)
+            << ", \"efficiency\": " << fmt(speedup / point.threads)
+            << ", \"rays_per_second_per_thread\": "
+            << (point.rays > 0 ? fmt(point.rays / point.seconds / point.threads) : "null")
+            << ", \"probes\": {";
+        for (size_t k = 0; k < probes.size(); k++) {
+            auto efficiency = point.probe_rates[k] / (point.threads * base.probe_rates[k]);
+            out << (k ? ", " : "") << '"' << probes[k].name << "\": " << fmt(efficiency);
+        }
+        out << "}}" << (p + 1 < points.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+static int usage() {
+    std::cerr << "Usage: bench_scaling [--scene NAME] [--width N] [--spp N] [--max-threads N]\n"
+                 "                     [--output FILE]\n";
+    return 2;
+}
+
+int main(int argc, char *argv[]) {
+    std::string scene_name = "cornell";
+    int width = 200;
+    int spp = 16;
+    int max_threads = 1;
+#ifdef _OPENMP
+    max_threads = omp_get_num_procs();
+#endif
+    std::string output;
+
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (a + 1 >= argc)
+            return usage();
+        std::string value = argv[++a];
+
+        if (arg == "--scene")
+            scene_name = value;
+        else if (arg == "--width")
+            width = std::atoi(value.c_str());
+        else if (arg == "--spp")
+            spp = std::atoi(value.c_str());
+        else if (arg == "--max-threads")
+            max_threads = std::atoi(value.c_str());
+        else if (arg == "--output")
+            output = value;
+        else
+            return usage();
+    }
+
+    if (width <= 0 || spp <= 0 || max_threads <= 0)
+        return usage();
+
+#ifndef _OPENMP
+    if (max_threads > 1) {
+        std::cerr << "Built without OpenMP: only one thread can be measured.\n";
+        max_threads = 1;
+    }
+#endif
+
+    scene s;
+    if (!make_scene(scene_name, s)) {
+        std::cerr << "ERROR: Unknown scene '" << scene_name << "'.\n";
+        return 2;
+    }
+    s.cam.image_width = width;
+    s.cam.samples_per_pixel = spp;
+    s.cam.seed = 0x5eed;
+
+    framebuffer probe_buffer(512, 512);
+    auto probes = make_probes(probe_buffer);
+    const size_t probe_ops = 1 << 23;
+
+    std::vector<int> thread_counts;
+    for (int t = 1; t < max_threads; t *= 2)
+        thread_counts.push_back(t);
+    thread_counts.push_back(max_threads);
+
+#ifdef _OPENMP
+    if (max_threads > omp_get_num_procs())
+        std::printf("More threads than the %d processors: the baseline shows the limit.\n", omp_get_num_procs());
+#endif
+
+    std::printf("%-8s %10s %8s %10s %14s\n", "threads", "seconds", "speedup", "efficiency", "Mrays/s/thread");
+    std::vector<scaling_point> points;
+    for (auto threads : thread_counts) {
+#ifdef _OPENMP
+        omp_set_num_threads(threads);
+#endif
+        scaling_point point;
+        point.threads = threads;
+        std::srand(1);
+        if (!render(s, "bench_scaling.pfm", point.seconds, point.rays)) {
+            std::cerr << "ERROR: Could not render " << scene_name << ".\n";
+            return 1;
+        }
+        for (const auto &probe : probes)
+            point.probe_rates.push_back(parallel_rate(threads, probe_ops, probe));
+        points.push_back(point);
+
+        const auto &base = points.front();
+        auto speedup = base.seconds / point.seconds;
+        auto efficiency = speedup / threads;
+        std::printf("%-8d %10.3f %8.2f %10.2f %14.3f\n", threads, point.seconds, speedup, efficiency,
+                    point.rays / point.seconds / threads * 1e-6);
+
+        // The render and the probes are flagged when they scale clearly worse than the baseline.
+        auto baseline = point.probe_rates[0] / (threads * base.probe_rates[0]);
+        bool sub_linear = threads > 1 && efficiency < flag_ratio * baseline;
+        if (sub_linear)
+            std::printf("    render scales sub-linearly (baseline %.2f)\n", baseline);
+        for (size_t k = 1; k < probes.size(); k++) {
+            auto probe_efficiency = point.probe_rates[k] / (threads * base.probe_rates[k]);
+            if (threads > 1 && probe_efficiency < flag_ratio * baseline) {
+                std::printf("    %s scales to %.2f efficiency%s\n", probes[k].name, probe_efficiency,
+                            sub_linear ? ", a likely cause" : "");
+            }
+        }
+        std::fflush(stdout);
+    }
+
+    if (!output.empty()) {
+        std::ofstream out(output);
+        write_json(out, scene_name, width, spp, probes, points);
+        if (!out) {
+            std::cerr << "ERROR: Could not write '" << output << "'.\n";
+            return 1;
+        }
+    }
+    return 0;
+}
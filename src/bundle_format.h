@@ -0,0 +1,624 @@
+#ifndef BUNDLE_FORMAT_H
+#define BUNDLE_FORMAT_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "camera.h"
+#include "material.h"
+#include "quad.h"
+#include "texture.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <sys/stat.h>
+
+// A scene bundle is a scene compiled to flat records: camera settings, texture and material
+// tables, decoded image pixels, world-space spheres and quads (transforms applied, boxes split
+// into their sides), media, and a BVH over all of them laid out depth first. Every reference
+// is an index or a byte offset from the start of the file, so the file is used in place where
+// it is mapped (see scene_bundle.h) without parsing, copying or building a BVH.
+//
+// The file starts with a bundle_header, which holds the byte range of each section. Sections
+// are arrays of the packed records below, 8-byte aligned, in the byte order of the machine
+// that wrote them. The header also holds a content hash of the source scene file and the
+// images it names, with their sizes and modification times, so a stale bundle is detected.
+
+static const char bundle_magic[8] = {'R', 'T', 'W', 'B', 'N', 'D', 'L', '\0'};
+static const uint32_t bundle_version = 1;
+static const uint32_t bundle_byte_order = 0x01020304;
+
+static_assert(std::is_trivially_copyable<perlin>::value, "Perlin tables are stored as bytes");
+
+enum class bundle_section : uint32_t {
+    TEXTURES,   // packed_texture
+    MATERIALS,  // packed_material
+    SPHERES,    // packed_sphere
+    QUADS,      // packed_quad
+    MEDIA,      // packed_medium
+    NODES,      // packed_node, the root first
+    PRIMITIVES, // Primitive references of the BVH leaves, see bundle_primitive
+    BOUNDARIES, // Primitive references of the media boundaries
+    EMITTERS,   // Primitive references of the emissive primitives
+    PIXELS,     // Image floats and bytes
+    SOURCES,    // packed_source
+    STRINGS,    // Source file paths
+    COUNT
+};
+
+enum class bundle_primitive : uint32_t { SPHERE, QUAD, MEDIUM };
+
+// A primitive reference keeps the kind in its top two bits and the index in the rest.
+inline uint32_t bundle_reference(bundle_primitive kind, size_t index) {
+    return (uint32_t(kind) << 30) | uint32_t(index);
+}
+inline bundle_primitive bundle_reference_kind(uint32_t ref) { return bundle_primitive(ref >> 30); }
+inline uint32_t bundle_reference_index(uint32_t ref) { return ref & 0x3fffffff; }
+
+enum class bundle_texture : int32_t { SOLID, CHECKER, NOISE, IMAGE };
+enum class bundle_material : int32_t { LAMBERTIAN, PHONG, METAL, DIELECTRIC, DIFFUSE_LIGHT, ISOTROPIC };
+
+struct bundle_range {
+    uint64_t offset; // Bytes from the start of the file
+    uint64_t bytes;
+};
+
+struct packed_image {
+    uint64_t pixels; // Offset in the pixel section of width * height * 3 floats, then as many bytes
+    int32_t width, height;
+};
+
+struct packed_camera {
+    double aspect_ratio, vfov, defocus_angle, focus_dist;
+    double background[3], lookfrom[3], lookat[3], vup[3];
+    int32_t image_width, samples_per_pixel, max_depth, light_samples;
+    int32_t bsdf_samples, render_mode, light_sampling, sampler_type;
+    uint32_t seed;
+    int32_t has_environment;
+    double environment_scale;
+    packed_image environment;
+};
+
+struct bundle_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;  // bundle_byte_order as the writer stored it
+    uint64_t source_hash; // Hash of the source scene and images (see bundle_hash_file)
+    uint64_t file_size;
+    uint64_t name, name_length; // Scene name in the string section
+    bundle_range sections[int(bundle_section::COUNT)];
+    packed_camera camera;
+};
+
+struct packed_texture {
+    int32_t type;
+    int32_t even, odd; // Checker texture indices
+    int32_t pad;
+    double scale;      // Checker and noise scale
+    double color[3];   // Solid color
+    packed_image image; // Image pixels, or the Perlin tables of a noise texture at image.pixels
+};
+
+struct packed_material {
+    int32_t type;
+    int32_t texture;  // Albedo or emission texture, -1 for metal and dielectric
+    double albedo[3]; // Metal albedo
+    double parameter; // Phong exponent, metal fuzz or refraction index
+};
+
+struct packed_sphere {
+    double center[3], motion[3]; // Center at time 0 and its change by time 1
+    double radius;
+    double cos_theta, sin_theta; // Rotation about Y of the texture coordinates
+    int32_t material, pad;
+};
+
+struct packed_quad {
+    double Q[3], u[3], v[3];
+    double normal[3], w[3], D; // Plane terms, as quad derives them
+    int32_t material;
+    int32_t solid_angle;       // Sample as a light by solid angle
+};
+
+struct packed_medium {
+    uint32_t first, count; // Boundary primitives in the boundary section
+    int32_t texture, pad;
+    double density;
+};
+
+struct packed_node {
+    double bounds[6];      // x, y and z intervals
+    uint32_t offset;       // Leaf: first primitive reference; interior: index of the right child
+    uint32_t count;        // Leaf: number of primitives; interior: 0, the left child follows
+    uint32_t axis, pad;    // Split axis of an interior node
+};
+
+struct packed_source {
+    uint64_t size;
+    int64_t mtime; // Nanoseconds where the platform has them
+    uint64_t path; // Offset in the string section
+    uint64_t path_length;
+};
+
+inline uint64_t bundle_hash(const void *data, size_t size, uint64_t hash = 0xcbf29ce484222325ull) {
+    // 64-bit FNV-1a.
+    auto bytes = static_cast<const unsigned char *>(data);
+    for (size_t n = 0; n < size; n++)
+        hash = (hash ^ bytes[n]) * 0x100000001b3ull;
+    return hash;
+}
+
+inline bool bundle_hash_file(const std::string &path, uint64_t &hash) {
+    // Adds the bytes of a file to the hash.
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+    std::vector<char> buffer(1 << 20);
+    while (in) {
+        in.read(buffer.data(), std::streamsize(buffer.size()));
+        hash = bundle_hash(buffer.data(), size_t(in.gcount()), hash);
+    }
+    return true;
+}
+
+inline bool bundle_stat(const std::string &path, uint64_t &size, int64_t &mtime) {
+    struct stat info;
+    if (::stat(path.c_str(), &info) != 0)
+        return false;
+    size = uint64_t(info.st_size);
+#if defined(__APPLE__)
+    mtime = int64_t(info.st_mtimespec.tv_sec) * 1000000000 + info.st_mtimespec.tv_nsec;
+#elif defined(__unix__)
+    mtime = int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+#else
+    mtime = int64_t(info.st_mtime) * 1000000000;
+#endif
+    return true;
+}
+
+class bundle_builder {
+    // Collects the packed records of a scene as the scene loader builds it, then writes them
+    // out with a BVH. Textures and materials are recorded against the objects the loader
+    // made, so that later references to the same object find the same record.
+
+public:
+    struct mark {
+        // The primitives added so far; later transforms apply to the ones added since.
+        size_t spheres, quads, references;
+    };
+
+    void add_solid(const shared_ptr<texture> &t, const color &c) {
+        packed_texture record = texture_record(bundle_texture::SOLID);
+        store(record.color, c);
+        add_texture(t, record);
+    }
+
+    void add_checker(const shared_ptr<texture> &t, double scale,
+                     const shared_ptr<texture> &even, const shared_ptr<texture> &odd) {
+        packed_texture record = texture_record(bundle_texture::CHECKER);
+        record.scale = scale;
+        record.even = texture_index(even);
+        record.odd = texture_index(odd);
+        add_texture(t, record);
+    }
+
+    void add_noise(const shared_ptr<noise_texture> &t, double scale) {
+        // Keeps the Perlin tables, which are drawn at random when the texture is made.
+        packed_texture record = texture_record(bundle_texture::NOISE);
+        record.scale = scale;
+        record.image.pixels = pixels.size();
+        auto tables = reinterpret_cast<const unsigned char *>(&t->generator());
+        pixels.insert(pixels.end(), tables, tables + sizeof(perlin));
+        pixels.resize(aligned(pixels.size()));
+        add_texture(t, record);
+    }
+
+    void add_image(const shared_ptr<image_texture> &t) {
+        if (texture_indices.count(t.get()))
+            return;
+        packed_texture record = texture_record(bundle_texture::IMAGE);
+        record.image = add_pixels(t->image_data());
+        add_texture(t, record);
+    }
+
+    void add_material(const shared_ptr<material> &m, bundle_material type, const shared_ptr<texture> &tex,
+                      const color &albedo = color(), double parameter = 0) {
+        packed_material record;
+        std::memset(&record, 0, sizeof record);
+        record.type = int32_t(type);
+        record.texture = tex ? texture_index(tex) : -1;
+        store(record.albedo, albedo);
+        record.parameter = parameter;
+        material_indices[m.get()] = int32_t(materials.size());
+        materials.push_back(record);
+        keep.push_back(m);
+    }
+
+    void add_sphere(const point3 &center1, const point3 &center2, double radius, const shared_ptr<material> &m) {
+        packed_sphere record;
+        std::memset(&record, 0, sizeof record);
+        store(record.center, center1);
+        store(record.motion, center2 - center1);
+        record.radius = std::fmax(0, radius);
+        record.cos_theta = 1;
+        record.material = material_index(m);
+        references.push_back(bundle_reference(bundle_primitive::SPHERE, spheres.size()));
+        spheres.push_back(record);
+    }
+
+    void add_quad(const point3 &Q, const vec3 &u, const vec3 &v, const shared_ptr<material> &m, bool solid_angle) {
+        packed_quad record;
+        std::memset(&record, 0, sizeof record);
+        store(record.Q, Q);
+        store(record.u, u);
+        store(record.v, v);
+        record.material = material_index(m);
+        record.solid_angle = solid_angle;
+        references.push_back(bundle_reference(bundle_primitive::QUAD, quads.size()));
+        quads.push_back(record);
+    }
+
+    void add_box(const point3 &a, const point3 &b, const shared_ptr<material> &m) {
+        point3 Q[6];
+        vec3 u[6], v[6];
+        box_sides(a, b, Q, u, v);
+        for (int side = 0; side < 6; side++)
+            add_quad(Q[side], u[side], v[side], m, false);
+    }
+
+    void add_medium(const mark &boundary, double density, const shared_ptr<texture> &albedo) {
+        // Turns the primitives added since the mark into the boundary of a medium.
+        packed_medium record;
+        std::memset(&record, 0, sizeof record);
+        record.first = uint32_t(boundaries.size());
+        record.count = uint32_t(references.size() - boundary.references);
+        record.texture = texture_index(albedo);
+        record.density = density;
+        boundaries.insert(boundaries.end(), references.begin() + boundary.references, references.end());
+        references.resize(boundary.references);
+        references.push_back(bundle_reference(bundle_primitive::MEDIUM, media.size()));
+        media.push_back(record);
+    }
+
+    mark current() const {
+        return {spheres.size(), quads.size(), references.size()};
+    }
+
+    void rotate(const mark &since, double angle) {
+        // Rotates the primitives added since the mark about Y, as rotate_y does.
+        auto radians = degrees_to_radians(angle);
+        auto sin_theta = std::sin(radians);
+        auto cos_theta = std::cos(radians);
+        auto to_world = [&](const double *p) {
+            return vec3((cos_theta * p[0]) + (sin_theta * p[2]), p[1], (-sin_theta * p[0]) + (cos_theta * p[2]));
+        };
+
+        for (auto s = since.spheres; s < spheres.size(); s++) {
+            auto &record = spheres[s];
+            store(record.center, to_world(record.center));
+            store(record.motion, to_world(record.motion));
+            auto c = record.cos_theta, n = record.sin_theta;
+            record.cos_theta = c * cos_theta - n * sin_theta;
+            record.sin_theta = n * cos_theta + c * sin_theta;
+        }
+        for (auto q = since.quads; q < quads.size(); q++) {
+            auto &record = quads[q];
+            store(record.Q, to_world(record.Q));
+            store(record.u, to_world(record.u));
+            store(record.v, to_world(record.v));
+        }
+    }
+
+    void translate(const mark &since, const vec3 &offset) {
+        for (auto s = since.spheres; s < spheres.size(); s++)
+            store(spheres[s].center, load(spheres[s].center) + offset);
+        for (auto q = since.quads; q < quads.size(); q++)
+            store(quads[q].Q, load(quads[q].Q) + offset);
+    }
+
+    void add_source(const std::string &path) {
+        // Records a file the bundle depends on. Images that failed to load have no path.
+        if (!path.empty() && std::find(sources.begin(), sources.end(), path) == sources.end())
+            sources.push_back(path);
+    }
+
+    const std::vector<std::string> &source_files() const { return sources; }
+
+    bool write(const std::string &filename, const std::string &name, const camera &cam, uint64_t source_hash,
+               std::string &error) {
+        // Builds the BVH and writes the bundle.
+        trace_span span("write bundle");
+        finish_quads();
+
+        bundle_header header;
+        std::memset(&header, 0, sizeof header);
+        std::memcpy(header.magic, bundle_magic, sizeof bundle_magic);
+        header.version = bundle_version;
+        header.byte_order = bundle_byte_order;
+        header.source_hash = source_hash;
+        if (!pack_camera(cam, header.camera)) {
+            error = "the environment image did not load";
+            return false;
+        }
+
+        std::vector<packed_node> nodes;
+        std::vector<uint32_t> leaves;
+        build_bvh(nodes, leaves);
+
+        std::vector<packed_source> source_records;
+        std::string strings = name;
+        header.name_length = name.size();
+        for (const auto &path : sources) {
+            packed_source record;
+            std::memset(&record, 0, sizeof record);
+            if (!bundle_stat(path, record.size, record.mtime)) {
+                error = "could not read '" + path + "'";
+                return false;
+            }
+            record.path = strings.size();
+            record.path_length = path.size();
+            strings += path;
+            source_records.push_back(record);
+        }
+
+        std::vector<std::pair<const void *, size_t>> data(size_t(bundle_section::COUNT));
+        auto section = [&](bundle_section s, const void *bytes, size_t size) { data[size_t(s)] = {bytes, size}; };
+        section(bundle_section::TEXTURES, textures.data(), textures.size() * sizeof(packed_texture));
+        section(bundle_section::MATERIALS, materials.data(), materials.size() * sizeof(packed_material));
+        section(bundle_section::SPHERES, spheres.data(), spheres.size() * sizeof(packed_sphere));
+        section(bundle_section::QUADS, quads.data(), quads.size() * sizeof(packed_quad));
+        section(bundle_section::MEDIA, media.data(), media.size() * sizeof(packed_medium));
+        section(bundle_section::NODES, nodes.data(), nodes.size() * sizeof(packed_node));
+        section(bundle_section::PRIMITIVES, leaves.data(), leaves.size() * sizeof(uint32_t));
+        section(bundle_section::BOUNDARIES, boundaries.data(), boundaries.size() * sizeof(uint32_t));
+        section(bundle_section::EMITTERS, emitters.data(), emitters.size() * sizeof(uint32_t));
+        section(bundle_section::PIXELS, pixels.data(), pixels.size());
+        section(bundle_section::SOURCES, source_records.data(), source_records.size() * sizeof(packed_source));
+        section(bundle_section::STRINGS, strings.data(), strings.size());
+
+        uint64_t offset = aligned(sizeof header);
+        for (size_t s = 0; s < data.size(); s++) {
+            header.sections[s] = {offset, data[s].second};
+            offset = aligned(offset + data[s].second);
+        }
+        header.file_size = offset;
+
+        // Write to a temporary file and rename it, so that readers never map a partial bundle.
+        auto temporary = filename + ".tmp";
+        std::ofstream out(temporary, std::ios::binary);
+        const char zeros[8] = {};
+        out.write(reinterpret_cast<const char *>(&header), sizeof header);
+        out.write(zeros, std::streamsize(aligned(sizeof header) - sizeof header));
+        for (size_t s = 0; s < data.size(); s++) {
+            out.write(static_cast<const char *>(data[s].first), std::streamsize(data[s].second));
+            out.write(zeros, std::streamsize(aligned(data[s].second) - data[s].second));
+        }
+        out.close();
+        if (!out || std::rename(temporary.c_str(), filename.c_str()) != 0) {
+            std::remove(temporary.c_str());
+            error = "could not write '" + filename + "'";
+            return false;
+        }
+        return true;
+    }
+
+private:
+    std::vector<packed_texture> textures;
+    std::vector<packed_material> materials;
+    std::vector<packed_sphere> spheres;
+    std::vector<packed_quad> quads;
+    std::vector<packed_medium> media;
+    std::vector<uint32_t> references; // Top-level primitives, the BVH leaves
+    std::vector<uint32_t> boundaries;
+    std::vector<uint32_t> emitters;
+    std::vector<unsigned char> pixels;
+    std::vector<std::string> sources;
+    std::map<const texture *, int32_t> texture_indices;
+    std::map<const material *, int32_t> material_indices;
+    std::vector<shared_ptr<void>> keep; // Keeps recorded objects alive, so addresses stay unique
+
+    static const uint32_t leaf_size = 4; // Most primitives in a BVH leaf
+
+    static uint64_t aligned(uint64_t offset) { return (offset + 7) & ~uint64_t(7); }
+
+    static void store(double *out, const vec3 &v) {
+        out[0] = v.x();
+        out[1] = v.y();
+        out[2] = v.z();
+    }
+
+    static vec3 load(const double *p) { return vec3(p[0], p[1], p[2]); }
+
+    static packed_texture texture_record(bundle_texture type) {
+        packed_texture record;
+        std::memset(&record, 0, sizeof record);
+        record.type = int32_t(type);
+        record.even = record.odd = -1;
+        return record;
+    }
+
+    void add_texture(const shared_ptr<texture> &t, const packed_texture &record) {
+        texture_indices[t.get()] = int32_t(textures.size());
+        textures.push_back(record);
+        keep.push_back(t);
+    }
+
+    int32_t texture_index(const shared_ptr<texture> &t) const {
+        auto found = texture_indices.find(t.get());
+        return found == texture_indices.end() ? -1 : found->second;
+    }
+
+    int32_t material_index(const shared_ptr<material> &m) const {
+        auto found = material_indices.find(m.get());
+        return found == material_indices.end() ? -1 : found->second;
+    }
+
+    packed_image add_pixels(const rtw_image &image) {
+        // Appends the floats and then the bytes of the image to the pixel section.
+        packed_image record;
+        std::memset(&record, 0, sizeof record);
+        record.width = image.width();
+        record.height = image.height();
+        add_source(image.path());
+        if (record.width <= 0 || record.height <= 0)
+            return record;
+
+        auto count = size_t(record.width) * record.height * 3;
+        record.pixels = pixels.size();
+        auto floats = reinterpret_cast<const unsigned char *>(image.float_pixel_data(0, 0));
+        pixels.insert(pixels.end(), floats, floats + count * sizeof(float));
+        pixels.insert(pixels.end(), image.pixel_data(0, 0), image.pixel_data(0, 0) + count);
+        pixels.resize(aligned(pixels.size()));
+        return record;
+    }
+
+    bool pack_camera(const camera &cam, packed_camera &out) {
+        out.aspect_ratio = cam.aspect_ratio;
+        out.vfov = cam.vfov;
+        out.defocus_angle = cam.defocus_angle;
+        out.focus_dist = cam.focus_dist;
+        store(out.background, cam.background);
+        store(out.lookfrom, cam.lookfrom);
+        store(out.lookat, cam.lookat);
+        store(out.vup, cam.vup);
+        out.image_width = cam.image_width;
+        out.samples_per_pixel = cam.samples_per_pixel;
+        out.max_depth = cam.max_depth;
+        out.light_samples = cam.light_samples;
+        out.bsdf_samples = cam.bsdf_samples;
+        out.render_mode = int32_t(cam.render_mode);
+        out.light_sampling = int32_t(cam.light_sampling);
+        out.sampler_type = int32_t(cam.sampler_type);
+        out.seed = cam.seed;
+        if (!cam.environment)
+            return true;
+        out.has_environment = 1;
+        out.environment_scale = cam.environment->radiance_scale();
+        out.environment = add_pixels(cam.environment->image_data());
+        return out.environment.width > 0;
+    }
+
+    void finish_quads() {
+        // Derives the plane terms of the quads, as the quad constructor does, and lists the
+        // emitters.
+        for (auto &record : quads) {
+            auto n = cross(load(record.u), load(record.v));
+            auto normal = unit_vector(n);
+            store(record.normal, normal);
+            record.D = dot(normal, load(record.Q));
+            store(record.w, n / dot(n, n));
+        }
+
+        emitters.clear();
+        for (auto ref : references) {
+            auto index = bundle_reference_index(ref);
+            int32_t m = -1;
+            if (bundle_reference_kind(ref) == bundle_primitive::SPHERE) m = spheres[index].material;
+            if (bundle_reference_kind(ref) == bundle_primitive::QUAD) m = quads[index].material;
+            if (m >= 0 && materials[m].type == int32_t(bundle_material::DIFFUSE_LIGHT))
+                emitters.push_back(ref);
+        }
+    }
+
+    aabb bounds(uint32_t ref) const {
+        auto index = bundle_reference_index(ref);
+        switch (bundle_reference_kind(ref)) {
+            case bundle_primitive::SPHERE: {
+                const auto &s = spheres[index];
+                auto rvec = vec3(s.radius, s.radius, s.radius);
+                auto c1 = load(s.center), c2 = c1 + load(s.motion);
+                return aabb(aabb(c1 - rvec, c1 + rvec), aabb(c2 - rvec, c2 + rvec));
+            }
+            case bundle_primitive::QUAD: {
+                const auto &q = quads[index];
+                auto Q = load(q.Q), u = load(q.u), v = load(q.v);
+                return aabb(aabb(Q, Q + u + v), aabb(Q + u, Q + v));
+            }
+            default: {
+                const auto &m = media[index];
+                auto box = aabb::empty;
+                for (uint32_t b = 0; b < m.count; b++)
+                    box = aabb(box, bounds(boundaries[m.first + b]));
+                return box;
+            }
+        }
+    }
+
+    struct build_item {
+        uint32_t ref;
+        aabb box;
+        point3 centroid;
+    };
+
+    void build_bvh(std::vector<packed_node> &nodes, std::vector<uint32_t> &leaves) const {
+        // Splits at the median centroid along the longest axis of the centroid bounds, down
+        // to leaves of leaf_size primitives, and lays the nodes out depth first.
+        std::vector<build_item> items;
+        items.reserve(references.size());
+        for (auto ref : references) {
+            auto box = bounds(ref);
+            auto centroid = point3(box.x.min + box.x.max, box.y.min + box.y.max, box.z.min + box.z.max) / 2;
+            items.push_back({ref, box, centroid});
+        }
+        nodes.reserve(items.empty() ? 1 : 2 * (items.size() / leaf_size) + 1);
+        build_node(items, 0, items.size(), nodes, leaves);
+    }
+
+    static void build_node(std::vector<build_item> &items, size_t start, size_t end,
+                           std::vector<packed_node> &nodes, std::vector<uint32_t> &leaves) {
+        auto index = nodes.size();
+        nodes.emplace_back();
+
+        auto box = aabb::empty;
+        auto centroids = aabb::empty;
+        for (auto i = start; i < end; i++) {
+            box = aabb(box, items[i].box);
+            centroids = aabb(centroids, aabb(items[i].centroid, items[i].centroid));
+        }
+
+        packed_node node;
+        std::memset(&node, 0, sizeof node);
+        for (int a = 0; a < 3; a++) {
+            node.bounds[2 * a] = box.axis_interval(a).min;
+            node.bounds[2 * a + 1] = box.axis_interval(a).max;
+        }
+
+        if (end - start <= leaf_size) {
+            node.offset = uint32_t(leaves.size());
+            node.count = uint32_t(end - start);
+            for (auto i = start; i < end; i++)
+                leaves.push_back(items[i].ref);
+            nodes[index] = node;
+            return;
+        }
+
+        int axis = centroids.longest_axis();
+        auto mid = start + (end - start) / 2;
+        std::nth_element(items.begin() + start, items.begin() + mid, items.begin() + end,
+                         [axis](const build_item &a, const build_item &b) {
+                             return a.centroid[axis] < b.centroid[axis];
+                         });
+
+        node.axis = uint32_t(axis);
+        build_node(items, start, mid, nodes, leaves);
+        node.offset = uint32_t(nodes.size());
+        build_node(items, mid, end, nodes, leaves);
+        nodes[index] = node;
+    }
+};
+
+#endif
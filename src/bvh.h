@@ -14,20 +14,53 @@
 #include "aabb.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "trace.h"
 
 #include <algorithm>
 
-class bvh_node : public hittable {
+class bvh_node : public hittable, private memory_tracked<bvh_node, memory_category::BVH> {
 public:
-    bvh_node(hittable_list list) :
-        bvh_node(list.objects, 0, list.objects.size()) {
+    bvh_node(hittable_list list) {
         // There's a C++ subtlety here. This constructor (without span indices) creates an
         // implicit copy of the hittable list, which we will modify. The lifetime of the copied
         // list only extends until this constructor exits. That's OK, because we only need to
         // persist the resulting bounding volume hierarchy.
+        trace_span span("build BVH", int64_t(list.objects.size()));
+        perf_phase_scope phase(perf_phase::BUILD);
+        build(list.objects, 0, list.objects.size());
     }
 
     bvh_node(std::vector<shared_ptr<hittable>> &objects, size_t start, size_t end) {
+        build(objects, start, end);
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+        count_stat(stat_counter::BVH_NODES);
+        if (!bbox.hit(r, ray_t))
+            return false;
+
+        bool hit_left = left->hit(r, ray_t, rec);
+        bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+
+        return hit_left || hit_right;
+    }
+
+    aabb bounding_box() const override {
+        return bbox;
+    }
+
+    void collect_emitters(std::vector<shared_ptr<hittable>> &emitters) const override {
+        gather_emitters(left, emitters);
+        if (right != left)
+            gather_emitters(right, emitters);
+    }
+
+private:
+    shared_ptr<hittable> left;
+    shared_ptr<hittable> right;
+    aabb bbox;
+
+    void build(std::vector<shared_ptr<hittable>> &objects, size_t start, size_t end) {
         // Build the bounding box of the span of source objects.
         bbox = aabb::empty;
         for (size_t object_index = start; object_index < end; object_index++)
@@ -54,25 +87,6 @@ public:
         }
     }
 
-    bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
-        if (!bbox.hit(r, ray_t))
-            return false;
-
-        bool hit_left = left->hit(r, ray_t, rec);
-        bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
-
-        return hit_left || hit_right;
-    }
-
-    aabb bounding_box() const override {
-        return bbox;
-    }
-
-private:
-    shared_ptr<hittable> left;
-    shared_ptr<hittable> right;
-    aabb bbox;
-
     static bool box_compare(
         const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis_index) {
         auto a_axis_interval = a->bounding_box().axis_interval(axis_index);
@@ -11,14 +11,30 @@
 // along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==============================================================================================
 
+#include <atomic>
 #include <chrono>
+#include <fstream>
+#include <string>
 #include <vector>
-#include <omp.h>
 #include <iomanip>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "accumulation_buffer.h"
+#include "colormap.h"
+#include "denoiser.h"
+#include "environment.h"
+#include "framebuffer.h"
 #include "hittable.h"
+#include "light_list.h"
+#include "light_tree.h"
 #include "pdf.h"
 #include "material.h"
+#include "output_sink.h"
+#include "sampler.h"
+#include "trace.h"
 
 class camera {
 public:
@@ -27,6 +43,7 @@ public:
     int samples_per_pixel = 10; // Count of random samples for each pixel
     int max_depth = 10;         // Maximum number of ray bounces into scene
     color background;           // Scene background color
+    shared_ptr<environment_light> environment; // Optional HDR environment, replaces background
 
     double vfov = 90;                  // Vertical view angle (field of view)
     point3 lookfrom = point3(0, 0, 0); // Point camera is looking from
@@ -36,86 +53,701 @@ public:
     double defocus_angle = 0; // Variation angle of rays through each pixel
     double focus_dist = 10;   // Distance from camera lookfrom point to plane of perfect focus
 
+    int light_samples = 1;           // Light samples per path vertex (NEE and MIS)
+    int bsdf_samples = 1;            // BSDF samples at the first bounce (NEE and MIS)
+    bool split_first_bounce = false; // Take the extra light samples at the first bounce only
+
     enum class RenderMode {
         BSDF_SAMPLING,
         MIXTURE_SAMPLING,
         NEE,
-        MIS
+        MIS,
+        COST  // Per-pixel cost of cost_integrator instead of radiance, as a heatmap
     } render_mode = RenderMode::MIS;
 
-    void render(const hittable &world, const hittable &lights) {
+    // The cost render mode traces every sample with cost_integrator and records what it cost.
+    // The output image maps the mean cost per sample to false color, with the 99th percentile
+    // of the image at the top of the scale; the raw means are the cost AOV channel.
+    enum class CostMetric {
+        BVH_NODES,       // BVH nodes visited
+        PRIMITIVE_TESTS, // Ray-primitive intersection tests
+        PATH_VERTICES,   // Path vertices, counting light sample paths
+        TIME             // Nanoseconds, the only metric without RTW_STATS
+    } cost_metric = CostMetric::PRIMITIVE_TESTS;
+    RenderMode cost_integrator = RenderMode::MIS;
+
+    enum class LightSampling {
+        POWER, // Alias table over emitted power, for up to a few hundred lights
+        TREE   // Light tree weighted by power, distance and orientation
+    } light_sampling = LightSampling::TREE;
+
+    enum class SamplerType {
+        INDEPENDENT, // Uniform random values
+        STRATIFIED,  // Jittered sqrt(spp) x sqrt(spp) pixel grid, random elsewhere
+        SOBOL,       // Owen-scrambled Sobol
+        HALTON,      // Owen-scrambled Halton
+        PMJ02        // Progressive multi-jittered (0,2)
+    } sampler_type = SamplerType::SOBOL;
+
+    unsigned seed = 0; // Scrambling seed of the sample pattern
+
+    // Adaptive sampling renders in rounds, each doubling the samples of the pixels whose
+    // relative standard error is still above the threshold, up to samples_per_pixel.
+    bool adaptive_sampling = false; // Send further samples only to noisy pixels
+    double adaptive_threshold = 0.02; // Target relative standard error of pixel luminance
+    int adaptive_min_samples = 16;  // Samples every pixel takes in the first round
+    std::string sample_count_file;  // If set, write a PGM map of samples taken per pixel
+
+    // Progressive rendering takes one sample per pixel per pass, up to samples_per_pixel, and
+    // stops early at the time budget or when the cancel flag is raised. With a checkpoint
+    // file, the accumulated samples are saved periodically and a later render resumes them,
+    // provided it has the same scene_hash and render settings.
+    bool progressive = false;
+    double time_budget = 0;                          // Seconds to render for, 0 for no limit
+    const std::atomic<bool> *cancel_flag = nullptr;  // Stops the render when set
+    std::string checkpoint_file;                     // Accumulation checkpoint to resume and save
+    double checkpoint_interval = 60;                 // Seconds between checkpoint saves
+    uint64_t scene_hash = 0;                         // Identity of the scene, set by its loader
+
+    int tile_size = 32;         // Width and height of the image tiles rendered in parallel
+    std::string output_file;    // Image file (.ppm, .png, .pfm or .hdr), or ASCII PPM on stdout
+    std::string preview_stream; // If set, file or named pipe that receives finished tiles
+    std::string aov_prefix;     // If set, write the AOV channels to <aov_prefix><name>.pfm
+
+    bool denoise = false;       // Filter the radiance with the AOV-guided denoiser before output
+    denoiser denoise_filter;    // Denoiser settings
+
+    std::string stats_file;     // If set, write render statistics as JSON (see stats.h)
+    std::string trace_file;     // If set, write a Chrome trace of the render at exit (see trace.h)
+    // Profile with hardware counters (see perf_counters.h). This turns profiling on when the
+    // render starts, after the scene and its BVH were built; set RTW_PERF to count those too.
+    bool hardware_counters = false;
+
+    bool render(const hittable &world) {
+        // Renders using the emitters found in the world. Returns whether the image was written.
+        start_trace();
+        auto build_start = std::chrono::steady_clock::now();
+        shared_ptr<hittable> lights;
+        size_t light_count;
+        {
+            trace_span span("build lights");
+            perf_phase_scope phase(perf_phase::BUILD);
+            if (light_sampling == LightSampling::POWER) {
+                auto list = make_shared<light_list>(world);
+                light_count = list->size();
+                lights = list;
+            } else {
+                auto tree = make_shared<light_tree>(world);
+                light_count = tree->size();
+                lights = tree;
+            }
+        }
+        std::clog << "Lights: " << light_count << '\n';
+        light_build_seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - build_start).count();
+
+        // With no emitters in the scene, the environment is the only light.
+        if (light_count == 0 && environment)
+            return render(world, *environment, false);
+        return render(world, *lights);
+    }
+
+    bool render(const hittable &world, const hittable &lights) {
+        // The environment, if any, is sampled alongside the given lights.
+        start_trace();
+        return render(world, lights, environment != nullptr);
+    }
+
+    uint64_t checkpoint_key() const {
+        // Key of the scene and of every setting that changes the radiance of a sample. The
+        // sample count is left out, so a resumed render can take more samples. It keys
+        // checkpoints, and bench_convergence's cached references.
+        auto key = accumulation_buffer::empty_key();
+        auto add = [&](double value) { key = accumulation_buffer::add_to_key(key, value); };
+        auto add_vector = [&](const vec3 &v) { add(v.x()); add(v.y()); add(v.z()); };
+        key = accumulation_buffer::add_to_key(key, scene_hash);
+        add(aspect_ratio);
+        add(max_depth);
+        add_vector(background);
+        add(environment ? environment->radiance_scale() : 0.0);
+        add(vfov);
+        add_vector(lookfrom);
+        add_vector(lookat);
+        add_vector(vup);
+        add(defocus_angle);
+        add(focus_dist);
+        add(light_samples);
+        add(bsdf_samples);
+        add(split_first_bounce);
+        add(int(render_mode));
+        add(int(cost_metric));
+        add(int(cost_integrator));
+        add(int(light_sampling));
+        add(int(sampler_type));
+        add(seed);
+        return key;
+    }
+
+private:
+    int image_height;           // Rendered image height
+    double pixel_samples_scale; // Color scale factor for a sum of pixel samples
+    point3 center;              // Camera center
+    point3 pixel00_loc;         // Location of pixel 0, 0
+    vec3 pixel_delta_u;         // Offset to pixel to the right
+    vec3 pixel_delta_v;         // Offset to pixel below
+    vec3 u, v, w;               // Camera frame basis vectors
+    vec3 defocus_disk_u;        // Defocus disk horizontal radius
+    vec3 defocus_disk_v;        // Defocus disk vertical radius
+    bool mix_environment;       // Whether light samples also draw from the environment
+    double light_build_seconds = 0; // Time taken to build the light structures for this render
+    CostMetric active_cost_metric;  // The cost metric that can be measured in this build
+
+    struct pixel_stats {
+        // Running sums of the samples of a pixel and of their AOVs, and Welford estimates of
+        // the mean and variance of their luminance.
+        color sum;
+        int count = 0;
+        double mean = 0;
+        double m2 = 0;
+        color albedo_sum;
+        vec3 normal_sum;
+        double depth_sum = 0;
+        int primitive_id = -1;
+
+        void add(const color &c, const aov_record &aov) {
+            sum += c;
+            count++;
+            auto l = luminance(c);
+            auto delta = l - mean;
+            mean += delta / count;
+            m2 += delta * (l - mean);
+
+            albedo_sum += aov.albedo;
+            normal_sum += aov.normal;
+            depth_sum += aov.depth;
+            if (count == 1)
+                primitive_id = aov.primitive_id;
+        }
+
+        double variance() const {
+            return (count < 2) ? 0 : m2 / (count - 1);
+        }
+
+        double relative_error() const {
+            // Standard error of the mean luminance relative to the mean, which is floored so
+            // that near-black pixels are not refined forever.
+            if (count < 2)
+                return infinity;
+            return std::sqrt(variance() / count) / std::fmax(mean, 0.01);
+        }
+
+        void store(framebuffer &fb, int i, int j) const {
+            // Writes the AOVs, sample count and variance. The radiance is left to the caller.
+            if (count == 0)
+                return;
+            auto normal = (normal_sum.length_squared() > 0) ? unit_vector(normal_sum) : vec3(0, 0, 0);
+            fb.set_color(framebuffer::ALBEDO, i, j, albedo_sum / count);
+            fb.set_color(framebuffer::NORMAL, i, j, normal);
+            fb.set_value(framebuffer::DEPTH, i, j, depth_sum / count);
+            fb.set_value(framebuffer::PRIMITIVE_ID, i, j, primitive_id);
+            fb.set_value(framebuffer::SAMPLE_COUNT, i, j, count);
+            fb.set_value(framebuffer::VARIANCE, i, j, variance());
+        }
+    };
+
+    bool render(const hittable &world, const hittable &lights, bool sample_environment) {
         auto start = std::chrono::steady_clock::now();
+        stats_registry::instance().reset();
 
         initialize();
+        mix_environment = sample_environment;
+
+        // An output file that cannot be written, or of an unknown format, fails before the
+        // render rather than after it.
+        auto encoder = make_image_encoder(output_file, image_width, image_height);
+        if (!encoder)
+            return false;
+
+        framebuffer fb(image_width, image_height);
+
+        // The image goes out while rendering, written by the sink's own thread.
+        output_sink sink(encoder, image_width, image_height, preview_stream);
+        auto pixel_sampler = make_sampler();
+        auto render_start = std::chrono::steady_clock::now();
+
+        // Tiles are streamed out as they finish, unless the image is post-processed first.
+        bool cost_map = (render_mode == RenderMode::COST);
+        bool post_process = denoise || cost_map;
+        if (progressive)
+            render_progressive(world, lights, *pixel_sampler, fb);
+        else if (adaptive_sampling)
+            render_adaptive(world, lights, *pixel_sampler, fb);
+        else
+            render_tiles(world, lights, *pixel_sampler, fb, post_process ? nullptr : &sink);
+
+        if (cost_map) {
+            map_cost(fb);
+        } else if (denoise) {
+            trace_span span("denoise");
+            auto denoise_start = std::chrono::steady_clock::now();
+            denoise_filter.apply(fb);
+            auto denoise_secs =
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - denoise_start).count();
+            std::clog << "Denoise time: " << std::fixed << std::setprecision(3) << denoise_secs
+                      << " (s)\n" << std::defaultfloat;
+        }
 
-        std::vector<std::vector<color>> img(image_height, std::vector<color>(image_width));
+        auto output_start = std::chrono::steady_clock::now();
+        if (progressive || adaptive_sampling || post_process)
+            sink.submit_image(fb);
 
-//#pragma omp parallel for schedule(dynamic)
-        for (int j = 0; j < image_height; j++) {
-            for (int i = 0; i < image_width; i++) {
-                double x = 0, y = 0, z = 0;
-                for (int s_j = 0; s_j < sqrt_spp; s_j++) {
-                    for (int s_i = 0; s_i < sqrt_spp; s_i++) {
-                        ray r = get_ray(i, j, s_i, s_j);
-                        color c;
-                        switch (render_mode) {
-                            case RenderMode::BSDF_SAMPLING:
-                                c = ray_color_1(r, max_depth, world, lights);
-                                break;
-                            case RenderMode::MIXTURE_SAMPLING:
-                                c = ray_color_2(r, max_depth, world, lights);
-                                break;
-                            case RenderMode::NEE:
-                                c = ray_color_3(r, max_depth, world, lights, true);
-                                break;
-                            case RenderMode::MIS:
-                                c = ray_color_4(r, max_depth, world, lights, 1.0);
-                                break;
-                        }
+        {
+            trace_span span("wait for output");
+            sink.finish();
+        }
+        if (!sink.succeeded())
+            std::cerr << "ERROR: Could not write the image.\n";
+
+        double total_samples = 0;
+        for (int j = 0; j < image_height; j++)
+            for (int i = 0; i < image_width; i++)
+                total_samples += fb.value(framebuffer::SAMPLE_COUNT, i, j);
+        std::clog << "Samples: " << std::setprecision(15) << total_samples << std::setprecision(6)
+                  << " (" << total_samples / (image_width * image_height) << " per pixel)\n";
+        report_memory();
+
+        if (!sample_count_file.empty())
+            write_sample_counts(fb);
+        if (!aov_prefix.empty()) {
+            trace_span span("write AOVs");
+            write_aovs(fb);
+        }
+
+        auto end = std::chrono::steady_clock::now();
+        double secs = std::chrono::duration<double>(end - start).count();
+
+        // The hardware counter report covers the builds since the last report, such as that
+        // of a BVH made before this render if profiling was on by then (see start_trace).
+        auto &profiler = perf_profiler::instance();
+        auto hardware = profiler.collect();
+        if (hardware.enabled) {
+            report_hardware_counters(hardware);
+            profiler.reset();
+        }
+
+        if (!stats_file.empty()) {
+            stage_times times;
+            times.build = light_build_seconds + std::chrono::duration<double>(render_start - start).count();
+            times.render = std::chrono::duration<double>(output_start - render_start).count();
+            times.output = std::chrono::duration<double>(end - output_start).count();
+            write_stats(times, &hardware);
+        }
+        light_build_seconds = 0;
+
+        std::clog << "Time: " << std::fixed << std::setprecision(3) << secs << " (s)\n";
+        std::clog << "Time to first row: " << sink.time_to_first_row() << " (s)\n";
+        return sink.succeeded();
+    }
+
+    void start_trace() const {
+        // Profiling turned on here misses builds made before the render; RTW_PERF has it on
+        // from the start.
+        if (!trace_file.empty())
+            trace_recorder::instance().enable(trace_file);
+        if (hardware_counters)
+            perf_profiler::instance().enable();
+    }
+
+    template <typename Body>
+    void parallel_for(const char *span_name, int count, const sampler &prototype, Body body) const {
+        // Calls body(n, sampler) for every n in [0,count), spread over threads with dynamic
+        // scheduling. Each thread binds its own copy of the sampler. The span of each thread's
+        // share of the loop ends when it runs out of work, so its end shows load imbalance.
+#pragma omp parallel
+        {
+            auto thread_sampler = prototype.clone();
+            thread_sampler->bind();
+
+            {
+                trace_span span(span_name);
+                perf_phase_scope phase(perf_phase::RENDER);
+#pragma omp for schedule(dynamic) nowait
+                for (int n = 0; n < count; n++)
+                    body(n, *thread_sampler);
+            }
+
+            sampler::unbind();
+        }
+    }
+
+    void render_tiles(
+        const hittable &world, const hittable &lights, const sampler &pixel_sampler,
+        framebuffer &fb, output_sink *sink
+    ) const {
+        // Renders the image in square tiles, in row-major order so that the top rows finish
+        // first. Each tile is rendered into its own buffer, merged into the framebuffer, and
+        // handed to the sink, if any.
+        auto size = std::max(1, tile_size);
+        int tiles_x = (image_width + size - 1) / size;
+        int tiles_y = (image_height + size - 1) / size;
+
+        auto tile_count = tiles_x * tiles_y;
+        parallel_for("render tiles", tile_count, pixel_sampler, [&](int t, sampler &thread_sampler) {
+            trace_span span("render tile", t);
+            image_tile tile;
+            tile.x = (t % tiles_x) * size;
+            tile.y = (t / tiles_x) * size;
+            tile.width = std::min(size, image_width - tile.x);
+            tile.height = std::min(size, image_height - tile.y);
+            tile.pixels.reserve(size_t(tile.width) * tile.height);
+
+            framebuffer tile_buffer(tile.width, tile.height, memory_category::SCRATCH);
+            for (int tj = 0; tj < tile.height; tj++) {
+                for (int ti = 0; ti < tile.width; ti++) {
+                    int i = tile.x + ti;
+                    int j = tile.y + tj;
+
+                    pixel_stats ps;
+                    double x = 0, y = 0, z = 0;
+                    for (int s = 0; s < samples_per_pixel; s++) {
+                        aov_record aov;
+                        color c = sample_pixel(i, j, s, world, lights, thread_sampler, &aov);
                         x += c.x();
                         y += c.y();
                         z += c.z();
-                    }                  
+                        ps.add(c, aov);
+                    }
+
+                    auto pixel_color = color(x, y, z) * pixel_samples_scale;
+                    tile_buffer.set_color(framebuffer::RADIANCE, ti, tj, pixel_color);
+                    ps.store(tile_buffer, ti, tj);
+                    tile.pixels.push_back(pixel_color);
                 }
-                img[j][i] = color(x, y, z) * pixel_samples_scale;              
             }
+
+            {
+                trace_span span("merge tile", t);
+                fb.copy_tile(tile_buffer, tile.x, tile.y, tile.width, tile.height);
+            }
+            if (sink)
+                sink->submit(std::move(tile));
+        });
+    }
+
+    void render_adaptive(
+        const hittable &world, const hittable &lights, const sampler &pixel_sampler,
+        framebuffer &fb
+    ) const {
+        // Renders in rounds. The first gives every pixel adaptive_min_samples; each later one
+        // doubles the count of the pixels that are still noisy, keeping the sample counts at
+        // powers of two times the first round, where low-discrepancy patterns are best
+        // stratified.
+        std::vector<pixel_stats> stats(size_t(image_width) * image_height);
+        std::vector<int> active(stats.size());
+        memory_account scratch(memory_category::SCRATCH, stats.size() * (sizeof(pixel_stats) + sizeof(int)));
+        for (size_t p = 0; p < active.size(); p++)
+            active[p] = int(p);
+
+        auto first_round = std::max(1, std::min(adaptive_min_samples, samples_per_pixel));
+        int round = 0;
+
+        while (!active.empty()) {
+            auto count = int(active.size());
+            parallel_for("adaptive round", count, pixel_sampler, [&](int a, sampler &thread_sampler) {
+                auto p = active[a];
+                auto &ps = stats[p];
+                int i = p % image_width;
+                int j = p / image_width;
+
+                auto target = std::min(samples_per_pixel, (round == 0) ? first_round : 2 * ps.count);
+                for (int s = ps.count; s < target; s++) {
+                    aov_record aov;
+                    color c = sample_pixel(i, j, s, world, lights, thread_sampler, &aov);
+                    ps.add(c, aov);
+                }
+            });
+
+            // Keep the pixels that can take more samples and are above the error threshold.
+            std::vector<int> still_active;
+            for (auto p : active) {
+                if (stats[p].count < samples_per_pixel && stats[p].relative_error() > adaptive_threshold)
+                    still_active.push_back(p);
+            }
+            active.swap(still_active);
+            round++;
         }
 
-        auto end = std::chrono::steady_clock::now();
-        double secs = std::chrono::duration<double>(end - start).count();
+        for (int j = 0; j < image_height; j++) {
+            for (int i = 0; i < image_width; i++) {
+                const auto &ps = stats[size_t(j) * image_width + i];
+                fb.set_color(framebuffer::RADIANCE, i, j, ps.sum / ps.count);
+                ps.store(fb, i, j);
+            }
+        }
+    }
 
-        std::clog << "Time: " << std::fixed << std::setprecision(3) << secs << " (s)\n";
+    void render_progressive(
+        const hittable &world, const hittable &lights, const sampler &pixel_sampler,
+        framebuffer &fb
+    ) const {
+        // The accumulation buffer holds the radiance of every pass, including resumed ones.
+        // The AOVs and variance cover the samples taken in this run.
+        using clock = std::chrono::steady_clock;
+        auto start = clock::now();
+        auto last_checkpoint = start;
+
+        // A checkpoint of another scene or settings is kept, and this render does not save one.
+        accumulation_buffer accumulation(image_width, image_height);
+        bool save_checkpoints = !checkpoint_file.empty();
+        std::string checkpoint_error;
+        if (save_checkpoints && accumulation.load(checkpoint_file, checkpoint_key(), checkpoint_error)) {
+            std::clog << "Resumed " << checkpoint_file << " at " << accumulation.min_count()
+                      << " samples per pixel\n";
+        } else if (!checkpoint_error.empty()) {
+            std::cerr << "ERROR: Not resuming '" << checkpoint_file << "': " << checkpoint_error << ".\n";
+            save_checkpoints = false;
+        }
+
+        std::vector<pixel_stats> stats(size_t(image_width) * image_height);
+        memory_account scratch(memory_category::SCRATCH, stats.size() * sizeof(pixel_stats));
+
+        auto stop_requested = [&] {
+            if (cancel_flag && cancel_flag->load())
+                return true;
+            return time_budget > 0
+                && std::chrono::duration<double>(clock::now() - start).count() >= time_budget;
+        };
+
+        // A pass interrupted part way leaves its remaining rows one sample behind, and the
+        // next pass (in this run or a resumed one) only samples those rows.
+        std::atomic<bool> stopped(false);
+        for (int pass = accumulation.min_count(); pass < samples_per_pixel && !stopped; pass++) {
+            auto rows = image_height;
+            parallel_for("progressive pass", rows, pixel_sampler, [&](int j, sampler &thread_sampler) {
+                if (stopped || (stopped = stop_requested()))
+                    return;
+
+                for (int i = 0; i < image_width; i++) {
+                    if (accumulation.count(i, j) != pass)
+                        continue;
+                    aov_record aov;
+                    color c = sample_pixel(i, j, pass, world, lights, thread_sampler, &aov);
+                    accumulation.add(i, j, c);
+                    stats[size_t(j) * image_width + i].add(c, aov);
+                }
+            });
+
+            auto now = clock::now();
+            if (save_checkpoints
+                && std::chrono::duration<double>(now - last_checkpoint).count() >= checkpoint_interval) {
+                save_checkpoint(accumulation);
+                last_checkpoint = now;
+            }
+        }
+
+        if (stopped)
+            std::clog << "Stopped at " << accumulation.min_count() << " samples per pixel\n";
+        if (save_checkpoints)
+            save_checkpoint(accumulation);
 
-        // Output the image
-        std::cout << "P3\n"
-                  << image_width << ' ' << image_height << "\n255\n";
         for (int j = 0; j < image_height; j++) {
             for (int i = 0; i < image_width; i++) {
-                write_color(std::cout, img[j][i]);
+                fb.set_color(framebuffer::RADIANCE, i, j, accumulation.average(i, j));
+                stats[size_t(j) * image_width + i].store(fb, i, j);
+                fb.set_value(framebuffer::SAMPLE_COUNT, i, j, accumulation.count(i, j));
             }
         }
     }
 
-private:
-    int image_height;           // Rendered image height
-    double pixel_samples_scale; // Color scale factor for a sum of pixel samples
-    int sqrt_spp;               // Square root of number of samples per pixel
-    double recip_sqrt_spp;      // 1 / sqrt_spp
-    point3 center;              // Camera center
-    point3 pixel00_loc;         // Location of pixel 0, 0
-    vec3 pixel_delta_u;         // Offset to pixel to the right
-    vec3 pixel_delta_v;         // Offset to pixel below
-    vec3 u, v, w;               // Camera frame basis vectors
-    vec3 defocus_disk_u;        // Defocus disk horizontal radius
-    vec3 defocus_disk_v;        // Defocus disk vertical radius
+    void save_checkpoint(const accumulation_buffer &accumulation) const {
+        trace_span span("save checkpoint");
+        if (!accumulation.save(checkpoint_file, checkpoint_key()))
+            std::cerr << "ERROR: Could not write checkpoint '" << checkpoint_file << "'.\n";
+    }
+
+    color sample_pixel(
+        int i, int j, int s, const hittable &world, const hittable &lights, sampler &pixel_sampler,
+        aov_record *aov = nullptr
+    ) const {
+        // Traces sample s of pixel i, j with the selected integrator.
+        perf_path_scope path;
+        pixel_sampler.start_pixel_sample(i, j, s);
+        ray r = get_ray(i, j, pixel_sampler);
+        count_stat(stat_counter::CAMERA_RAYS);
+        if (render_mode == RenderMode::COST)
+            return sample_cost(r, world, lights, aov);
+        return trace(render_mode, r, world, lights, aov);
+    }
+
+    color trace(
+        RenderMode mode, const ray &r, const hittable &world, const hittable &lights, aov_record *aov
+    ) const {
+        switch (mode) {
+            case RenderMode::BSDF_SAMPLING:
+                return ray_color_1(r, max_depth, world, lights, aov);
+            case RenderMode::MIXTURE_SAMPLING:
+                return ray_color_2(r, max_depth, world, lights, aov);
+            case RenderMode::NEE:
+                return ray_color_3(r, max_depth, world, lights, true, aov);
+            case RenderMode::MIS:
+            default:
+                return ray_color_4(r, max_depth, world, lights, nullptr, aov);
+        }
+    }
+
+    color sample_cost(const ray &r, const hittable &world, const hittable &lights, aov_record *aov) const {
+        // Traces the ray with the cost integrator and returns the cost in all three components,
+        // so that it is averaged like radiance. The counters are the thread's own, so the
+        // difference is this sample's alone.
+        double cost;
+        if (active_cost_metric == CostMetric::TIME) {
+            auto start = std::chrono::steady_clock::now();
+            trace(cost_integrator, r, world, lights, aov);
+            cost = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        } else {
+            auto counter = (active_cost_metric == CostMetric::BVH_NODES) ? stat_counter::BVH_NODES
+                         : (active_cost_metric == CostMetric::PRIMITIVE_TESTS) ? stat_counter::PRIMITIVE_TESTS
+                         : stat_counter::PATH_VERTICES;
+            const auto &stats = stats_registry::local();
+            auto before = stats[counter];
+            trace(cost_integrator, r, world, lights, aov);
+            cost = double(stats[counter] - before);
+        }
+        return color(cost, cost, cost);
+    }
+
+    void map_cost(framebuffer &fb) const {
+        // Moves the mean cost from the radiance to the cost channel, and replaces the radiance
+        // with its false-color map.
+        std::vector<float> costs;
+        costs.reserve(size_t(image_width) * image_height);
+        for (int j = 0; j < image_height; j++) {
+            for (int i = 0; i < image_width; i++) {
+                auto cost = fb.get_color(framebuffer::RADIANCE, i, j).x();
+                fb.set_value(framebuffer::COST, i, j, cost);
+                costs.push_back(float(cost));
+            }
+        }
+
+        double sum = 0;
+        for (auto c : costs)
+            sum += c;
+        auto top = costs.begin() + (costs.size() - 1) * 99 / 100;
+        std::nth_element(costs.begin(), top, costs.end());
+        double scale = *top;
+        double highest = *std::max_element(top, costs.end());
+
+        static const char *units[] = {"BVH nodes", "primitive tests", "path vertices", "ns"};
+        std::clog << "Cost (" << units[int(active_cost_metric)] << " per sample): mean "
+                  << sum / costs.size() << ", 99th percentile " << scale << ", max " << highest << '\n';
+
+        for (int j = 0; j < image_height; j++)
+            for (int i = 0; i < image_width; i++)
+                fb.set_color(framebuffer::RADIANCE, i, j,
+                             magma(scale > 0 ? fb.value(framebuffer::COST, i, j) / scale : 0.0));
+    }
+
+    static bool hit_world(const hittable &world, const ray &r, hit_record &rec) {
+        // Intersects a path ray with the world, counting it, and profiling it if the path is
+        // sampled by the hardware counter profiler.
+        count_stat(stat_counter::RAYS);
+        perf_traversal_scope traversal;
+        return world.hit(r, interval(0.001, infinity), rec);
+    }
+
+    static void report_memory() {
+        // Logs the peak of the tracked bytes with the peak of each category, in kilobytes.
+        const auto &memory = memory_tracker::instance();
+        auto kilobytes = [](int64_t bytes) { return bytes / 1024.0; };
+        std::clog << "Memory: " << std::fixed << std::setprecision(1)
+                  << kilobytes(memory.total_peak_bytes()) << " KB peak (";
+        for (int c = 0; c < int(memory_category::COUNT); c++) {
+            auto category = memory_category(c);
+            std::clog << (c ? ", " : "") << memory_category_name(category) << ' '
+                      << kilobytes(memory.peak_bytes(category));
+        }
+        std::clog << "), " << kilobytes(peak_resident_bytes()) << " KB resident\n" << std::defaultfloat;
+    }
+
+    void report_hardware_counters(const perf_report &report) const {
+        // Logs the IPC of the render phases, or why it is unknown.
+        if (!report.hardware) {
+            std::clog << "Hardware counters unavailable"
+                      << (report.error.empty() ? "" : ": " + report.error) << '\n';
+            return;
+        }
+        std::clog << "IPC: render " << report.phases[int(perf_phase::RENDER)].ipc()
+                  << ", traversal " << report.phases[int(perf_phase::TRAVERSAL)].ipc()
+                  << ", shading " << report.shading().ipc() << '\n';
+    }
+
+    void write_stats(const stage_times &times, const perf_report *hardware) const {
+        std::ofstream out(stats_file);
+        write_stats_json(out, stats_registry::instance().collect(), times, hardware);
+        if (!out)
+            std::cerr << "ERROR: Could not write render statistics '" << stats_file << "'.\n";
+    }
+
+    void write_sample_counts(const framebuffer &fb) const {
+        // Writes the samples taken per pixel as an ASCII PGM, scaled so that
+        // samples_per_pixel is white.
+        std::ofstream out(sample_count_file);
+        if (!out) {
+            std::cerr << "ERROR: Could not write sample count map '" << sample_count_file << "'.\n";
+            return;
+        }
+
+        out << "P2\n" << image_width << ' ' << image_height << "\n255\n";
+        for (int j = 0; j < image_height; j++) {
+            for (int i = 0; i < image_width; i++) {
+                auto n = fb.value(framebuffer::SAMPLE_COUNT, i, j);
+                out << int(255.0 * n / samples_per_pixel + 0.5) << '\n';
+            }
+        }
+    }
+
+    void write_aovs(const framebuffer &fb) const {
+        // Writes every channel except the radiance to <aov_prefix><name>.pfm, with single
+        // component channels repeated in all three. The cost channel is only written in the
+        // cost render mode.
+        std::vector<color> row(image_width);
+        for (int c = framebuffer::ALBEDO; c < framebuffer::CHANNEL_COUNT; c++) {
+            auto ch = framebuffer::channel(c);
+            if (ch == framebuffer::COST && render_mode != RenderMode::COST)
+                continue;
+            auto filename = aov_prefix + framebuffer::name(ch) + ".pfm";
+            auto encoder = make_image_encoder(filename, image_width, image_height);
+            if (!encoder)
+                continue;
+
+            for (int j = 0; j < image_height; j++) {
+                for (int i = 0; i < image_width; i++) {
+                    if (framebuffer::components(ch) == 3) {
+                        row[i] = fb.get_color(ch, i, j);
+                    } else {
+                        auto x = fb.value(ch, i, j);
+                        row[i] = color(x, x, x);
+                    }
+                }
+                encoder->write_row(j, row.data());
+            }
+
+            if (!encoder->finish())
+                std::cerr << "ERROR: Could not write AOV file '" << filename << "'.\n";
+        }
+    }
 
     void initialize() {
         image_height = int(image_width / aspect_ratio);
         image_height = (image_height < 1) ? 1 : image_height;
 
-        sqrt_spp = int(std::sqrt(samples_per_pixel));
-        pixel_samples_scale = 1.0 / (sqrt_spp * sqrt_spp);
-        recip_sqrt_spp = 1.0 / sqrt_spp;
+        // Without RTW_STATS nothing is counted, so time is the only cost that can be measured.
+        active_cost_metric = stats_enabled ? cost_metric : CostMetric::TIME;
+        if (render_mode == RenderMode::COST && active_cost_metric != cost_metric)
+            std::clog << "Render statistics are disabled; measuring the cost in time instead\n";
+
+        samples_per_pixel = (samples_per_pixel < 1) ? 1 : samples_per_pixel;
+        pixel_samples_scale = 1.0 / samples_per_pixel;
 
         center = lookfrom;
 
@@ -148,32 +780,40 @@ private:
         defocus_disk_v = v * defocus_radius;
     }
 
-    ray get_ray(int i, int j, int s_i, int s_j) const {
-        // Construct a camera ray originating from the defocus disk and directed at a randomly
-        // sampled point around the pixel location i, j for stratified sample square s_i, s_j.
+    shared_ptr<sampler> make_sampler() const {
+        switch (sampler_type) {
+            case SamplerType::INDEPENDENT:
+                return make_shared<independent_sampler>(seed);
+            case SamplerType::STRATIFIED:
+                return make_shared<stratified_sampler>(seed, samples_per_pixel);
+            case SamplerType::HALTON:
+                return make_shared<halton_sampler>(seed);
+            case SamplerType::PMJ02:
+                return make_shared<pmj02_sampler>(seed);
+            case SamplerType::SOBOL:
+            default:
+                return make_shared<sobol_sampler>(seed);
+        }
+    }
 
-        auto offset = sample_square_stratified(s_i, s_j);
+    ray get_ray(int i, int j, sampler &s) const {
+        // Construct a camera ray originating from the defocus disk and directed at a sampled
+        // point around the pixel location i, j. The pixel position, time and lens position
+        // take the first dimensions of the sample.
+
+        auto offset = s.get_2d() - vec3(0.5, 0.5, 0);
         auto pixel_sample = pixel00_loc
                             + ((i + offset.x()) * pixel_delta_u)
                             + ((j + offset.y()) * pixel_delta_v);
 
-        auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
+        auto ray_time = s.get_1d();
+        auto lens = s.get_2d();
+        auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample(lens);
         auto ray_direction = pixel_sample - ray_origin;
-        auto ray_time = random_double();
 
         return ray(ray_origin, ray_direction, ray_time);
     }
 
-    vec3 sample_square_stratified(int s_i, int s_j) const {
-        // Returns the vector to a random point in the square sub-pixel specified by grid
-        // indices s_i and s_j, for an idealized unit square pixel [-.5,-.5] to [+.5,+.5].
-
-        auto px = ((s_i + random_double()) * recip_sqrt_spp) - 0.5;
-        auto py = ((s_j + random_double()) * recip_sqrt_spp) - 0.5;
-
-        return vec3(px, py, 0);
-    }
-
     vec3 sample_square() const {
         // Returns the vector to a random point in the [-.5,-.5]-[+.5,+.5] unit square.
         return vec3(random_double() - 0.5, random_double() - 0.5, 0);
@@ -184,15 +824,101 @@ private:
         return radius * random_in_unit_disk();
     }
 
-    point3 defocus_disk_sample() const {
-        // Returns a random point in the camera defocus disk.
-        auto p = random_in_unit_disk();
+    point3 defocus_disk_sample(const vec3 &lens) const {
+        // Returns the point in the camera defocus disk for a sample in the unit square.
+        auto p = concentric_disk(lens);
         return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
     }
 
+    static vec3 concentric_disk(const vec3 &sample) {
+        // Maps the unit square onto the unit disk while keeping strata compact (Shirley and
+        // Chiu), unlike rejection sampling, which would consume an unbounded number of values.
+        auto a = 2 * sample.x() - 1;
+        auto b = 2 * sample.y() - 1;
+        if (a == 0 && b == 0)
+            return vec3(0, 0, 0);
+
+        double r, theta;
+        if (std::fabs(a) > std::fabs(b)) {
+            r = a;
+            theta = (pi / 4) * (b / a);
+        } else {
+            r = b;
+            theta = (pi / 2) - (pi / 4) * (a / b);
+        }
+        return vec3(r * std::cos(theta), r * std::sin(theta), 0);
+    }
+
+    static void start_bounce(int bounce, int split = 0) {
+        // Moves the sample pattern, if any, to the dimensions of the given bounce.
+        if (split == 0) count_bounce(bounce);
+        if (auto s = sampler::current())
+            s->start_bounce(bounce, split);
+    }
+
+    void split_counts(int depth, int &n_light, int &n_bsdf) const {
+        // Returns the number of light and BSDF samples to take at a vertex at the given depth.
+        // Every BSDF sample continues the path, so splitting it at every vertex would grow
+        // the path tree exponentially; it is only done at the first bounce.
+        bool first_bounce = depth == max_depth;
+        n_light = (first_bounce || !split_first_bounce) ? std::max(1, light_samples) : 1;
+        n_bsdf = first_bounce ? std::max(1, bsdf_samples) : 1;
+    }
+
+    static double power_heuristic(int nf, double f_pdf, int ng, double g_pdf) {
+        // MIS weight of a sample from strategy f, given nf samples of f and ng samples of g.
+        auto f = nf * f_pdf;
+        auto g = ng * g_pdf;
+        return (f * f) / (f * f + g * g);
+    }
+
+    color sky(const ray &r) const {
+        // Returns the radiance carried by a ray that escapes the scene.
+        return environment ? environment->value(r.direction()) : background;
+    }
+
+    shared_ptr<pdf> light_pdf(const hittable &lights, const point3 &origin) const {
+        // Returns the light sampling density at the origin, including the environment if it
+        // is sampled as a light.
+        auto scene_lights = make_shared<hittable_pdf>(lights, origin);
+        if (!mix_environment)
+            return scene_lights;
+        return make_shared<mixture_pdf>(scene_lights, make_shared<hittable_pdf>(*environment, origin));
+    }
+
+    double light_density(const hittable &lights, const ray &r, const hit_record *rec) const {
+        // Density of the light samples of light_pdf for a ray that first hits rec, or escapes
+        // if rec is null (see hittable::hit_pdf_value).
+        auto density = lights.hit_pdf_value(r.origin(), r.direction(), rec);
+        if (!mix_environment)
+            return density;
+        return 0.5 * density + 0.5 * environment->pdf_value(r.origin(), r.direction());
+    }
+
+    bool trace_light_sample(
+        const hittable &world, const hittable &lights, const ray &light_ray, int emitter, color &Le,
+        double &pdf_light
+    ) const {
+        // Traces a light sample, returning whether it hit a surface, the radiance it reaches
+        // and its density. A sample drawn towards one emitter reaches nothing if something
+        // else is in the way, even another emitter.
+        hit_record rec;
+        bool hit = hit_world(world, light_ray, rec);
+        pdf_light = light_density(lights, light_ray, hit ? &rec : nullptr);
+        if (!hit)
+            Le = (emitter < 0) ? sky(light_ray) : color(0, 0, 0);
+        else if (emitter >= 0 && rec.primitive_id != emitter)
+            Le = color(0, 0, 0);
+        else
+            Le = rec.mat->emitted(light_ray, rec, rec.u, rec.v, rec.p);
+        return hit;
+    }
+
     // bsdf sampling
-    color ray_color_1(const ray &r, int depth, const hittable &world, const hittable &lights)
-        const {
+    color ray_color_1(
+        const ray &r, int depth, const hittable &world, const hittable &lights,
+        aov_record *aov = nullptr
+    ) const {
         // If we've exceeded the ray bounce limit, no more light is gathered.
         if (depth <= 0)
             return color(0, 0, 0);
@@ -200,19 +926,27 @@ private:
         hit_record rec;
 
         // If the ray hits nothing, return the background color.
-        if (!world.hit(r, interval(0.001, infinity), rec))
-            return background;
+        if (!hit_world(world, r, rec)) {
+            if (aov) aov->record_miss(sky(r));
+            return sky(r);
+        }
 
         scatter_record srec;
         color color_from_emission = rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
 
-        if (!rec.mat->scatter(r, rec, srec))
+        start_bounce(max_depth - depth);
+        if (!rec.mat->scatter(r, rec, srec)) {
+            if (aov) aov->record_emitter_hit(r, rec);
             return color_from_emission;
+        }
 
         if (srec.skip_pdf) {
-            return srec.attenuation * ray_color_1(srec.skip_pdf_ray, depth - 1, world, lights);
+            if (aov) aov->follow_specular(r, rec);
+            return srec.attenuation * ray_color_1(srec.skip_pdf_ray, depth - 1, world, lights, aov);
         }
 
+        if (aov) aov->record_hit(r, rec, srec.attenuation);
+
         vec3 dir = srec.pdf_ptr->generate();
         if (dir.length_squared() < 0.0001) {
             return color_from_emission; // Avoid invalid direction
@@ -230,8 +964,10 @@ private:
     }
 
     // path tracing with mixture sampling
-    color ray_color_2(const ray &r, int depth, const hittable &world, const hittable &lights)
-        const {
+    color ray_color_2(
+        const ray &r, int depth, const hittable &world, const hittable &lights,
+        aov_record *aov = nullptr
+    ) const {
         // If we've exceeded the ray bounce limit, no more light is gathered.
         if (depth <= 0)
             return color(0, 0, 0);
@@ -239,20 +975,28 @@ private:
         hit_record rec;
 
         // If the ray hits nothing, return the background color.
-        if (!world.hit(r, interval(0.001, infinity), rec))
-            return background;
+        if (!hit_world(world, r, rec)) {
+            if (aov) aov->record_miss(sky(r));
+            return sky(r);
+        }
 
         scatter_record srec;
         color color_from_emission = rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
 
-        if (!rec.mat->scatter(r, rec, srec))
+        start_bounce(max_depth - depth);
+        if (!rec.mat->scatter(r, rec, srec)) {
+            if (aov) aov->record_emitter_hit(r, rec);
             return color_from_emission;
+        }
 
         if (srec.skip_pdf) {
-            return srec.attenuation * ray_color_2(srec.skip_pdf_ray, depth - 1, world, lights);
+            if (aov) aov->follow_specular(r, rec);
+            return srec.attenuation * ray_color_2(srec.skip_pdf_ray, depth - 1, world, lights, aov);
         }
 
-        auto light_ptr = make_shared<hittable_pdf>(lights, rec.p);
+        if (aov) aov->record_hit(r, rec, srec.attenuation);
+
+        auto light_ptr = light_pdf(lights, rec.p);
         mixture_pdf p(light_ptr, srec.pdf_ptr);
 
         ray scattered = ray(rec.p, p.generate(), r.time());
@@ -268,13 +1012,18 @@ private:
     }
 
     // path tracing with NEE
-    color ray_color_3(const ray &r, int depth, const hittable &world, const hittable &lights, bool includeLe)
-        const {
+    color ray_color_3(
+        const ray &r, int depth, const hittable &world, const hittable &lights, bool includeLe,
+        aov_record *aov = nullptr
+    ) const {
         hit_record rec;
 
-        // If the ray hits nothing, return the background color.
-        if (!world.hit(r, interval(0.001, infinity), rec))
-            return background;
+        // If the ray hits nothing, return the background color. An environment is already
+        // accounted for by NEE, unless this is a camera, specular or light ray.
+        if (!hit_world(world, r, rec)) {
+            if (aov) aov->record_miss(sky(r));
+            return (includeLe || !environment) ? sky(r) : color(0, 0, 0);
+        }
 
         color Le = includeLe ? rec.mat->emitted(r, rec, rec.u, rec.v, rec.p) : color(0, 0, 0);
 
@@ -284,39 +1033,87 @@ private:
 
         scatter_record srec;
 
-        if (!rec.mat->scatter(r, rec, srec))
+        start_bounce(max_depth - depth);
+        if (!rec.mat->scatter(r, rec, srec)) {
+            if (aov) aov->record_emitter_hit(r, rec);
             return Le;
+        }
 
         if (srec.skip_pdf) {
-            return srec.attenuation * ray_color_3(srec.skip_pdf_ray, depth - 1, world, lights, true);
+            if (aov) aov->follow_specular(r, rec);
+            return srec.attenuation * ray_color_3(srec.skip_pdf_ray, depth - 1, world, lights, true, aov);
         }
 
+        if (aov) aov->record_hit(r, rec, srec.attenuation);
+
+        int n_light, n_bsdf;
+        split_counts(depth, n_light, n_bsdf);
+
         // NEE
-        auto light_ptr = make_shared<hittable_pdf>(lights, rec.p);
-        ray light_ray = ray(rec.p, light_ptr->generate(), r.time());
-        color brdf = srec.attenuation * rec.mat->scattering_pdf(r, rec, light_ray);
-        double pdf_light = light_ptr->value(light_ray.direction());
-        color Ldir = brdf * ray_color_3(light_ray, 0, world, lights, true) / pdf_light;
+        auto light_ptr = light_pdf(lights, rec.p);
+        color Ldir(0, 0, 0);
+        for (int k = 0; k < n_light; k++) {
+            if (k > 0) start_bounce(max_depth - depth, k);
+            int emitter;
+            ray light_ray = ray(rec.p, light_ptr->generate_emitter(emitter), r.time());
+            color brdf = srec.attenuation * rec.mat->scattering_pdf(r, rec, light_ray);
+            count_stat(stat_counter::NEE_SAMPLES);
+            count_stat(stat_counter::SHADOW_RAYS);
+            color Li;
+            double pdf_light;
+            trace_light_sample(world, lights, light_ray, emitter, Li, pdf_light);
+            if (pdf_light <= 0)
+                continue;
+            if (Li.length_squared() > 0) count_stat(stat_counter::NEE_UNOCCLUDED);
+            Ldir += brdf * Li / (n_light * pdf_light);
+        }
 
         // BSDF
-        ray bsdf_ray = ray(rec.p, srec.pdf_ptr->generate(), r.time());
-        color bsdf = srec.attenuation * rec.mat->scattering_pdf(r, rec, bsdf_ray);
-        double pdf_bsdf = srec.pdf_ptr->value(bsdf_ray.direction());
-        color Lind = bsdf * ray_color_3(bsdf_ray, depth - 1, world, lights, false) / pdf_bsdf;
+        color Lind(0, 0, 0);
+        for (int k = 0; k < n_bsdf; k++) {
+            if (k > 0) start_bounce(max_depth - depth, n_light + k);
+            ray bsdf_ray = ray(rec.p, srec.pdf_ptr->generate(), r.time());
+            color bsdf = srec.attenuation * rec.mat->scattering_pdf(r, rec, bsdf_ray);
+            double pdf_bsdf = srec.pdf_ptr->value(bsdf_ray.direction());
+            Lind += bsdf * ray_color_3(bsdf_ray, depth - 1, world, lights, false) / (n_bsdf * pdf_bsdf);
+        }
 
         return Le + Ldir + Lind;
     }
 
+    struct bsdf_sample {
+        // How a ray of the MIS integrator was drawn from the BSDF, to weight what it reaches.
+        double pdf;      // Density of the direction
+        int count;       // BSDF samples taken at the vertex
+        int light_count; // Light samples taken at the vertex
+    };
+
+    double bsdf_weight(
+        const hittable &lights, const ray &r, const hit_record *rec, const bsdf_sample *from
+    ) const {
+        // MIS weight of the radiance a BSDF sampled ray reaches; 1 for camera and specular rays.
+        if (!from)
+            return 1.0;
+        return power_heuristic(from->count, from->pdf, from->light_count, light_density(lights, r, rec));
+    }
+
     // path tracing with MIS
-    color ray_color_4(const ray &r, int depth, const hittable &world, const hittable &lights, double Leweight)
-        const {
+    color ray_color_4(
+        const ray &r, int depth, const hittable &world, const hittable &lights, const bsdf_sample *from,
+        aov_record *aov = nullptr
+    ) const {
         hit_record rec;
 
-        // If the ray hits nothing, return the background color.
-        if (!world.hit(r, interval(0.001, infinity), rec))
-            return background;
+        // If the ray hits nothing, return the background color. An environment is sampled as a
+        // light, so its radiance is MIS weighted like any other emitter.
+        if (!hit_world(world, r, rec)) {
+            if (aov) aov->record_miss(sky(r));
+            return environment ? bsdf_weight(lights, r, nullptr, from) * sky(r) : background;
+        }
 
-        color Le = Leweight * rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
+        color Le = rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
+        if (Le.length_squared() > 0)
+            Le = bsdf_weight(lights, r, &rec, from) * Le;
 
         // end one light path (too many vertices or NEE)
         if (depth <= 0)
@@ -324,32 +1121,57 @@ private:
 
         scatter_record srec;
 
-        if (!rec.mat->scatter(r, rec, srec))
+        start_bounce(max_depth - depth);
+        if (!rec.mat->scatter(r, rec, srec)) {
+            if (aov) aov->record_emitter_hit(r, rec);
             return Le;
+        }
 
         if (srec.skip_pdf) {
-            return srec.attenuation * ray_color_4(srec.skip_pdf_ray, depth - 1, world, lights, true);
+            if (aov) aov->follow_specular(r, rec);
+            return srec.attenuation * ray_color_4(srec.skip_pdf_ray, depth - 1, world, lights, nullptr, aov);
         }
 
-        // NEE
-        auto light_ptr = make_shared<hittable_pdf>(lights, rec.p);
-        ray light_ray = ray(rec.p, light_ptr->generate(), r.time());
-        color brdf = srec.attenuation * rec.mat->scattering_pdf(r, rec, light_ray);
-        double pdf_light = light_ptr->value(light_ray.direction());
-        double pdf_light_bsdf = srec.pdf_ptr->value(light_ray.direction());
-        //double weight_light = pdf_light / (pdf_light + pdf_light_bsdf);
-        double weight_light = pow(pdf_light, 2) / (pow(pdf_light, 2) + pow(pdf_light_bsdf, 2));
-        color Ldir = brdf * ray_color_4(light_ray, 0, world, lights, weight_light) / pdf_light;
+        if (aov) aov->record_hit(r, rec, srec.attenuation);
+
+        int n_light, n_bsdf;
+        split_counts(depth, n_light, n_bsdf);
+
+        // NEE, weighted with the power heuristic over n_light light and n_bsdf BSDF samples
+        auto light_ptr = light_pdf(lights, rec.p);
+        color Ldir(0, 0, 0);
+        for (int k = 0; k < n_light; k++) {
+            if (k > 0) start_bounce(max_depth - depth, k);
+            int emitter;
+            ray light_ray = ray(rec.p, light_ptr->generate_emitter(emitter), r.time());
+            color brdf = srec.attenuation * rec.mat->scattering_pdf(r, rec, light_ray);
+            double pdf_light_bsdf = srec.pdf_ptr->value(light_ray.direction());
+            count_stat(stat_counter::NEE_SAMPLES);
+            count_stat(stat_counter::SHADOW_RAYS);
+            color Li;
+            double pdf_light;
+            bool hit = trace_light_sample(world, lights, light_ray, emitter, Li, pdf_light);
+            if (pdf_light <= 0)
+                continue;
+            if (hit || environment)
+                Li = power_heuristic(n_light, pdf_light, n_bsdf, pdf_light_bsdf) * Li;
+            if (Li.length_squared() > 0) count_stat(stat_counter::NEE_UNOCCLUDED);
+            Ldir += brdf * Li / (n_light * pdf_light);
+        }
 
         // BSDF
-        vec3 dir = srec.pdf_ptr->generate();
-        ray bsdf_ray = ray(rec.p, dir, r.time());
-        color bsdf = srec.attenuation * rec.mat->scattering_pdf(r, rec, bsdf_ray);
-        double pdf_bsdf = srec.pdf_ptr->value(bsdf_ray.direction());
-        double pdf_bsdf_light = light_ptr->value(bsdf_ray.direction());
-        //double weight_bsdf = pdf_bsdf / (pdf_bsdf + pdf_bsdf_light);
-        double weight_bsdf = pow(pdf_bsdf, 2) / (pow(pdf_bsdf, 2) + pow(pdf_bsdf_light, 2));
-        color Lind = bsdf * ray_color_4(bsdf_ray, depth - 1, world, lights, weight_bsdf) / pdf_bsdf;
+        color Lind(0, 0, 0);
+        for (int k = 0; k < n_bsdf; k++) {
+            if (k > 0) start_bounce(max_depth - depth, n_light + k);
+            vec3 dir = srec.pdf_ptr->generate();
+            ray bsdf_ray = ray(rec.p, dir, r.time());
+            color bsdf = srec.attenuation * rec.mat->scattering_pdf(r, rec, bsdf_ray);
+            double pdf_bsdf = srec.pdf_ptr->value(bsdf_ray.direction());
+            if (pdf_bsdf <= 0)
+                continue;
+            bsdf_sample from = {pdf_bsdf, n_bsdf, n_light};
+            Lind += bsdf * ray_color_4(bsdf_ray, depth - 1, world, lights, &from) / (n_bsdf * pdf_bsdf);
+        }
 
         return Le + Ldir + Lind;
     }
@@ -16,6 +16,11 @@
 
 using color = vec3;
 
+inline double luminance(const color &c) {
+    // Relative luminance of a linear Rec. 709 color.
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
 inline double linear_to_gamma(double linear_component) {
     if (linear_component > 0)
         return std::sqrt(linear_component);
@@ -23,7 +28,8 @@ inline double linear_to_gamma(double linear_component) {
     return 0;
 }
 
-void write_color(std::ostream &out, const color &pixel_color) {
+inline void color_to_bytes(const color &pixel_color, unsigned char *rgb) {
+    // Converts a linear color to three gamma-encoded bytes.
     auto r = pixel_color.x();
     auto g = pixel_color.y();
     auto b = pixel_color.z();
@@ -40,12 +46,17 @@ void write_color(std::ostream &out, const color &pixel_color) {
 
     // Translate the [0,1] component values to the byte range [0,255].
     static const interval intensity(0.000, 0.999);
-    int rbyte = int(256 * intensity.clamp(r));
-    int gbyte = int(256 * intensity.clamp(g));
-    int bbyte = int(256 * intensity.clamp(b));
+    rgb[0] = (unsigned char)(256 * intensity.clamp(r));
+    rgb[1] = (unsigned char)(256 * intensity.clamp(g));
+    rgb[2] = (unsigned char)(256 * intensity.clamp(b));
+}
+
+void write_color(std::ostream &out, const color &pixel_color) {
+    unsigned char rgb[3];
+    color_to_bytes(pixel_color, rgb);
 
     // Write out the pixel color components.
-    out << rbyte << ' ' << gbyte << ' ' << bbyte << '\n';
+    out << int(rgb[0]) << ' ' << int(rgb[1]) << ' ' << int(rgb[2]) << '\n';
 }
 
 #endif
@@ -0,0 +1,46 @@
+#ifndef COLORMAP_H
+#define COLORMAP_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "color.h"
+
+#include <algorithm>
+
+inline color magma(double t) {
+    // The magma color map for false-color images, from black through purple and orange to
+    // pale yellow as t goes from 0 to 1. Returns the linear color that the image encoders
+    // turn into the map's display values.
+    static const double stops[10][4] = {
+        {0.000, 0.001462, 0.000466, 0.013866},
+        {0.125, 0.078815, 0.054184, 0.211667},
+        {0.250, 0.232077, 0.059889, 0.437695},
+        {0.375, 0.390384, 0.100379, 0.501864},
+        {0.500, 0.550287, 0.161158, 0.505719},
+        {0.625, 0.716387, 0.214982, 0.475290},
+        {0.750, 0.868793, 0.287728, 0.409303},
+        {0.875, 0.967671, 0.439703, 0.359810},
+        {0.940, 0.994738, 0.624350, 0.427397},
+        {1.000, 0.987053, 0.991438, 0.749504},
+    };
+
+    t = (t == t) ? std::min(1.0, std::max(0.0, t)) : 0.0;
+    int k = 0;
+    while (k < 8 && t > stops[k + 1][0]) k++;
+    auto s = (t - stops[k][0]) / (stops[k + 1][0] - stops[k][0]);
+
+    double rgb[3];
+    for (int c = 0; c < 3; c++) {
+        auto display = stops[k][c + 1] + s * (stops[k + 1][c + 1] - stops[k][c + 1]);
+        rgb[c] = display * display;
+    }
+    return color(rgb[0], rgb[1], rgb[2]);
+}
+
+#endif
@@ -0,0 +1,105 @@
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Compares rendered images against a reference:
+//
+//     compare [--ppd <pixels per degree>] [--error <image>] <reference> <image>...
+//
+// Images can be ASCII or binary PPM, or PFM. One tab-separated line of metrics is printed per
+// image (see image_metrics.h). With --error, the per-pixel FLIP error of the single test image
+// is written as a false-color image in any format the renderer writes.
+
+#include "rtweekend.h"
+
+#include "image_encoder.h"
+#include "image_metrics.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+static int usage() {
+    std::cerr << "Usage: compare [--ppd <pixels per degree>] [--error <image>] <reference> <image>...\n";
+    return 2;
+}
+
+static bool write_error_image(const std::string &filename, const std::vector<float> &map, int width, int height) {
+    auto encoder = make_image_encoder(filename, width, height);
+    if (!encoder)
+        return false;
+
+    std::vector<color> row(width);
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++)
+            row[i] = magma(map[size_t(j) * width + i]);
+        encoder->write_row(j, row.data());
+    }
+    return encoder->finish();
+}
+
+int main(int argc, char *argv[]) {
+    image_comparison comparison;
+    std::string error_image;
+    std::vector<std::string> files;
+
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--ppd" && a + 1 < argc) {
+            comparison.pixels_per_degree = std::atof(argv[++a]);
+            if (comparison.pixels_per_degree <= 0)
+                return usage();
+        } else if (arg == "--error" && a + 1 < argc) {
+            error_image = argv[++a];
+        } else if (!arg.empty() && arg[0] == '-') {
+            return usage();
+        } else {
+            files.push_back(arg);
+        }
+    }
+
+    if (files.size() < 2 || (!error_image.empty() && files.size() != 2))
+        return usage();
+
+    std::string error;
+    float_image reference;
+    if (!image_reader::read(files[0], reference, error)) {
+        std::cerr << "ERROR: " << error << ".\n";
+        return 1;
+    }
+
+    std::printf("image\tMSE\trelMSE\tPSNR\tSSIM\tFLIP\n");
+
+    int status = 0;
+    for (size_t f = 1; f < files.size(); f++) {
+        float_image test;
+        if (!image_reader::read(files[f], test, error)) {
+            std::cerr << "ERROR: " << error << ".\n";
+            status = 1;
+            continue;
+        }
+        if (test.width != reference.width || test.height != reference.height) {
+            std::cerr << "ERROR: '" << files[f] << "' is " << test.width << 'x' << test.height
+                      << ", the reference is " << reference.width << 'x' << reference.height << ".\n";
+            status = 1;
+            continue;
+        }
+
+        std::vector<float> flip_map;
+        auto m = comparison.compare(test, reference, error_image.empty() ? nullptr : &flip_map);
+        std::printf("%s\t%.6g\t%.6g\t%.4f\t%.6f\t%.6f\n",
+                    files[f].c_str(), m.mse, m.rel_mse, m.psnr, m.ssim, m.flip);
+
+        if (!error_image.empty() && !write_error_image(error_image, flip_map, test.width, test.height)) {
+            std::cerr << "ERROR: Could not write the error image.\n";
+            status = 1;
+        }
+    }
+
+    return status;
+}
@@ -15,7 +15,7 @@
 #include "material.h"
 #include "texture.h"
 
-class constant_medium : public hittable {
+class constant_medium : public hittable, private memory_tracked<constant_medium, memory_category::GEOMETRY> {
 public:
     constant_medium(shared_ptr<hittable> boundary, double density, shared_ptr<texture> tex) :
         boundary(boundary), neg_inv_density(-1 / density),
@@ -58,6 +58,7 @@ public:
         rec.normal = vec3(1, 0, 0); // arbitrary
         rec.front_face = true;      // also arbitrary
         rec.mat = phase_function;
+        rec.primitive_id = id();
 
         return true;
     }
@@ -0,0 +1,321 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+class denoiser {
+    // Edge-avoiding a-trous wavelet filter guided by the AOVs, after SVGF (Schied et al. 2017).
+    // The radiance is divided by the albedo, so that texture detail is kept out of the filter,
+    // and then blurred with a 5x5 B3-spline kernel whose taps spread twice as far every
+    // iteration. Taps are weighted down across changes in normal, depth and albedo, and
+    // across luminance differences that are large compared to the estimated noise.
+    //
+    // Every channel is a plane of floats, and a row is filtered in chunks that run through the
+    // 25 taps, each tap a loop over contiguous pixels of every plane with no branches and a
+    // polynomial exp, which the compiler vectorizes. The chunk's own planes and sums stay in
+    // the L1 cache across the taps. Rows are filtered in parallel.
+
+public:
+    int iterations = 5;         // Filter passes; the footprint grows to 4 * 2^iterations pixels
+    double sigma_luminance = 4; // Luminance difference tolerated, in standard deviations
+    double normal_power = 128;  // Exponent on the cosine between normals
+    double sigma_depth = 1;     // Relative depth difference tolerated per pixel of distance
+    double sigma_albedo = 0.1;  // Albedo difference tolerated
+
+    void apply(framebuffer &fb) const {
+        // Replaces the radiance channel of the framebuffer with its filtered version.
+        int width = fb.width();
+        int height = fb.height();
+        auto n = size_t(width) * height;
+
+        guide_planes guides(n);
+        color_planes current(n), next(n);
+        memory_account scratch(memory_category::SCRATCH,
+                               (guide_planes::count + 2 * color_planes::count) * n * sizeof(float));
+
+        // Demodulate and gather the guides.
+#pragma omp parallel for schedule(static)
+        for (int j = 0; j < height; j++) {
+            for (int i = 0; i < width; i++) {
+                auto p = size_t(j) * width + i;
+                auto a = fb.get_color(framebuffer::ALBEDO, i, j);
+                auto l = fb.get_color(framebuffer::RADIANCE, i, j);
+                auto nrm = fb.get_color(framebuffer::NORMAL, i, j);
+                auto divisor = demodulation_divisor(a);
+
+                for (int c = 0; c < 3; c++) {
+                    current.rgb[c][p] = float(l[c] / divisor[c]);
+                    guides.albedo[c][p] = float(a[c]);
+                    guides.normal[c][p] = float(nrm[c]);
+                }
+                auto depth = fb.value(framebuffer::DEPTH, i, j);
+                guides.depth[p] = depth;
+                guides.inv_depth_scale[p] = 1 / (float(sigma_depth) * 0.01f * depth + 1e-6f);
+
+                // Variance of the pixel mean, carried over to the demodulated illumination.
+                auto count = std::fmax(1.0f, fb.value(framebuffer::SAMPLE_COUNT, i, j));
+                auto scale = luminance(divisor);
+                current.variance[p] = float(fb.value(framebuffer::VARIANCE, i, j) / count / (scale * scale));
+            }
+        }
+
+        for (int k = 0; k < iterations; k++) {
+            filter_pass(width, height, 1 << k, guides, current, next);
+            std::swap(current, next);
+        }
+
+        // Remodulate.
+#pragma omp parallel for schedule(static)
+        for (int j = 0; j < height; j++) {
+            for (int i = 0; i < width; i++) {
+                auto p = size_t(j) * width + i;
+                auto divisor = demodulation_divisor(fb.get_color(framebuffer::ALBEDO, i, j));
+                auto c = color(current.rgb[0][p], current.rgb[1][p], current.rgb[2][p]);
+                fb.set_color(framebuffer::RADIANCE, i, j, c * divisor);
+            }
+        }
+    }
+
+private:
+    static const int chunk = 256; // Pixels of a row filtered together
+
+    struct color_planes {
+        // The demodulated illumination being filtered, and the variance of its luminance.
+        static const int count = 4;
+        std::vector<float> rgb[3];
+        std::vector<float> variance;
+
+        explicit color_planes(size_t n) : rgb{std::vector<float>(n), std::vector<float>(n),
+                                              std::vector<float>(n)}, variance(n) {}
+    };
+
+    struct guide_planes {
+        // The guides, and the per-pixel terms of the edge-stopping functions; the luminance
+        // and its tolerance are those of the current pass.
+        static const int count = 10;
+        std::vector<float> normal[3];
+        std::vector<float> albedo[3];
+        std::vector<float> depth;
+        std::vector<float> inv_depth_scale;
+        std::vector<float> luminance;
+        std::vector<float> inv_sigma_luminance;
+
+        explicit guide_planes(size_t n) :
+            normal{std::vector<float>(n), std::vector<float>(n), std::vector<float>(n)},
+            albedo{std::vector<float>(n), std::vector<float>(n), std::vector<float>(n)},
+            depth(n), inv_depth_scale(n), luminance(n), inv_sigma_luminance(n) {}
+    };
+
+    struct tap_sums {
+        float rgb[3][chunk];
+        float weight[chunk];
+        float variance[chunk];
+    };
+
+    static color demodulation_divisor(const color &albedo) {
+        // Components with (near) zero albedo, such as the background, are left as they are.
+        return color(
+            albedo.x() > 0.001 ? albedo.x() : 1,
+            albedo.y() > 0.001 ? albedo.y() : 1,
+            albedo.z() > 0.001 ? albedo.z() : 1);
+    }
+
+    static float keep_if(bool keep, float x) {
+        // x if keep, else 0. A select between floats would be compiled to a branch (as the
+        // arithmetic may trap), which keeps the tap loop from being vectorized; this masks
+        // the bits instead.
+        int32_t bits;
+        std::memcpy(&bits, &x, sizeof bits);
+        bits &= -int32_t(keep);
+        std::memcpy(&x, &bits, sizeof x);
+        return x;
+    }
+
+    static float exp_negative(float x) {
+        // e^-x for x >= 0 within 3e-7 relative, cut to 0 from x = 20 on: 2^t for t = -x log2(e),
+        // split into an integer power of two, made in the exponent bits, and a polynomial.
+        bool cut = !(x < 20);
+        x -= keep_if(cut, x - 20);
+        float t = x * -1.44269504f;
+        int n = int(t);
+        float f = t - float(n); // In (-1, 0]
+        float p = 0.000946877f;
+        p = p * f + 0.00920918025f;
+        p = p * f + 0.0552981198f;
+        p = p * f + 0.240178958f;
+        p = p * f + 0.693143129f;
+        p = p * f + 0.99999994f;
+        int32_t bits = ((n + 127) << 23) & -int32_t(!cut);
+        float scale;
+        std::memcpy(&scale, &bits, sizeof scale);
+        return p * scale;
+    }
+
+    void filter_pass(
+        int width, int height, int step, guide_planes &g, const color_planes &in, color_planes &out
+    ) const {
+        // Luminance and its tolerance, which uses the 3x3 blurred variance as it is less noisy.
+#pragma omp parallel for schedule(static)
+        for (int j = 0; j < height; j++) {
+            for (int i = 0; i < width; i++) {
+                auto p = size_t(j) * width + i;
+                g.luminance[p] = 0.2126f * in.rgb[0][p] + 0.7152f * in.rgb[1][p] + 0.0722f * in.rgb[2][p];
+                auto blurred = blurred_variance(in.variance, width, height, i, j);
+                g.inv_sigma_luminance[p] = 1 / (float(sigma_luminance) * std::sqrt(blurred) + 1e-6f);
+            }
+        }
+
+        static const float kernel[3] = {3.0f / 8, 1.0f / 4, 1.0f / 16};
+#pragma omp parallel for schedule(dynamic, 4)
+        for (int j = 0; j < height; j++) {
+            tap_sums sums;
+            for (int i0 = 0; i0 < width; i0 += chunk) {
+                int i1 = std::min(width, i0 + chunk);
+                std::memset(&sums, 0, sizeof sums);
+
+                for (int dy = -2; dy <= 2; dy++) {
+                    int y = j + dy * step;
+                    if (y < 0 || y >= height) continue;
+
+                    for (int dx = -2; dx <= 2; dx++) {
+                        // Pixels of the chunk whose tap lies inside the image.
+                        int begin = std::max(i0, -dx * step);
+                        int end = std::min(i1, width - dx * step);
+                        if (begin >= end) continue;
+
+                        auto h = kernel[std::abs(dx)] * kernel[std::abs(dy)];
+                        auto inv_distance = 1 / (step * std::sqrt(float(dx * dx + dy * dy)) + 1e-6f);
+                        auto center = size_t(j) * width + begin;
+                        auto tap = size_t(y) * width + begin + dx * step;
+                        if (normal_power == 128)
+                            add_taps<7>(g, in, center, tap, end - begin, h, inv_distance, sums, begin - i0);
+                        else
+                            add_taps<-1>(g, in, center, tap, end - begin, h, inv_distance, sums, begin - i0);
+                    }
+                }
+
+                for (int i = i0; i < i1; i++) {
+                    auto p = size_t(j) * width + i;
+                    auto s = i - i0;
+                    auto weight = sums.weight[s];
+
+                    // The center tap has full weight unless the normal is missing, as on a miss.
+                    if (weight <= 0) {
+                        for (int c = 0; c < 3; c++)
+                            out.rgb[c][p] = in.rgb[c][p];
+                        out.variance[p] = in.variance[p];
+                        continue;
+                    }
+
+                    for (int c = 0; c < 3; c++)
+                        out.rgb[c][p] = sums.rgb[c][s] / weight;
+                    out.variance[p] = sums.variance[s] / (weight * weight);
+                }
+            }
+        }
+    }
+
+    template <int Squarings>
+    void add_taps(
+        const guide_planes &g, const color_planes &in, size_t center, size_t tap, int count, float h,
+        float inv_distance, tap_sums &sums, int offset
+    ) const {
+        // Adds one tap to count pixels starting at center, whose taps start at tap. The cosine
+        // between normals is raised to the power by squaring it Squarings times, or by pow if
+        // Squarings is negative; below the cutoff the normal weight is cut to zero, so the
+        // squares never turn into slow denormals.
+        auto inv_sigma_albedo2 = float(1 / (sigma_albedo * sigma_albedo));
+        auto normal_cutoff = float(std::pow(1e-6, 1 / normal_power));
+
+        const float *__restrict p_luminance = &g.luminance[center];
+        const float *__restrict p_inv_sigma = &g.inv_sigma_luminance[center];
+        const float *__restrict p_depth = &g.depth[center];
+        const float *__restrict p_inv_depth_scale = &g.inv_depth_scale[center];
+        const float *__restrict p_n0 = &g.normal[0][center];
+        const float *__restrict p_n1 = &g.normal[1][center];
+        const float *__restrict p_n2 = &g.normal[2][center];
+        const float *__restrict p_a0 = &g.albedo[0][center];
+        const float *__restrict p_a1 = &g.albedo[1][center];
+        const float *__restrict p_a2 = &g.albedo[2][center];
+
+        const float *__restrict q_luminance = &g.luminance[tap];
+        const float *__restrict q_depth = &g.depth[tap];
+        const float *__restrict q_n0 = &g.normal[0][tap];
+        const float *__restrict q_n1 = &g.normal[1][tap];
+        const float *__restrict q_n2 = &g.normal[2][tap];
+        const float *__restrict q_a0 = &g.albedo[0][tap];
+        const float *__restrict q_a1 = &g.albedo[1][tap];
+        const float *__restrict q_a2 = &g.albedo[2][tap];
+        const float *__restrict q_r = &in.rgb[0][tap];
+        const float *__restrict q_g = &in.rgb[1][tap];
+        const float *__restrict q_b = &in.rgb[2][tap];
+        const float *__restrict q_variance = &in.variance[tap];
+
+        float *__restrict sum_r = sums.rgb[0] + offset;
+        float *__restrict sum_g = sums.rgb[1] + offset;
+        float *__restrict sum_b = sums.rgb[2] + offset;
+        float *__restrict sum_weight = sums.weight + offset;
+        float *__restrict sum_variance = sums.variance + offset;
+
+        for (int i = 0; i < count; i++) {
+            auto cos_n = p_n0[i] * q_n0[i] + p_n1[i] * q_n1[i] + p_n2[i] * q_n2[i];
+            auto da0 = p_a0[i] - q_a0[i];
+            auto da1 = p_a1[i] - q_a1[i];
+            auto da2 = p_a2[i] - q_a2[i];
+
+            // All exponential terms share one exp.
+            auto exponent = std::fabs(p_luminance[i] - q_luminance[i]) * p_inv_sigma[i]
+                            + std::fabs(p_depth[i] - q_depth[i]) * p_inv_depth_scale[i] * inv_distance
+                            + (da0 * da0 + da1 * da1 + da2 * da2) * inv_sigma_albedo2;
+
+            auto w_normal = keep_if(cos_n > normal_cutoff, cos_n);
+            if (Squarings >= 0) {
+                for (int k = 0; k < Squarings; k++)
+                    w_normal *= w_normal;
+            } else {
+                w_normal = std::pow(w_normal, float(normal_power));
+            }
+
+            auto w = h * w_normal * exp_negative(exponent);
+
+            sum_r[i] += w * q_r[i];
+            sum_g[i] += w * q_g[i];
+            sum_b[i] += w * q_b[i];
+            sum_weight[i] += w;
+            sum_variance[i] += w * w * q_variance[i];
+        }
+    }
+
+    static float blurred_variance(const std::vector<float> &variance, int width, int height, int i, int j) {
+        static const float kernel[2] = {1.0f / 4, 1.0f / 8};
+        float sum = 0, weight_sum = 0;
+        for (int dy = -1; dy <= 1; dy++) {
+            int y = j + dy;
+            if (y < 0 || y >= height) continue;
+            for (int dx = -1; dx <= 1; dx++) {
+                int x = i + dx;
+                if (x < 0 || x >= width) continue;
+                auto w = kernel[std::abs(dx)] * kernel[std::abs(dy)];
+                sum += w * variance[size_t(y) * width + x];
+                weight_sum += w;
+            }
+        }
+        return sum / weight_sum;
+    }
+};
+
+#endif
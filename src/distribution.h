@@ -0,0 +1,128 @@
+#ifndef DISTRIBUTION_H
+#define DISTRIBUTION_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include <algorithm>
+#include <vector>
+
+class distribution_1d {
+    // Piecewise-constant density over [0,1) given by n non-negative function values, sampled
+    // by inverting its cumulative distribution.
+
+public:
+    distribution_1d() {
+    }
+
+    distribution_1d(const float *f, int n) :
+        func(f, f + n), cdf(n + 1) {
+        cdf[0] = 0;
+        for (int i = 1; i <= n; i++)
+            cdf[i] = cdf[i - 1] + func[i - 1] / double(n);
+
+        integral = cdf[n];
+        if (integral == 0) {
+            // Fall back to a uniform distribution.
+            for (int i = 1; i <= n; i++)
+                cdf[i] = float(double(i) / n);
+        } else {
+            for (int i = 1; i <= n; i++)
+                cdf[i] = float(cdf[i] / integral);
+        }
+    }
+
+    int count() const {
+        return int(func.size());
+    }
+
+    size_t storage_bytes() const {
+        return (func.capacity() + cdf.capacity()) * sizeof(float);
+    }
+
+    double function_integral() const {
+        return integral;
+    }
+
+    double sample(double u, double &pdf, int &offset) const {
+        // Maps u in [0,1) to a continuous value in [0,1), returning its density and the index
+        // of the segment it falls in.
+
+        auto it = std::upper_bound(cdf.begin(), cdf.end(), float(u));
+        offset = int(interval(0, count() - 1).clamp(int(it - cdf.begin()) - 1));
+
+        double du = u - cdf[offset];
+        double width = cdf[offset + 1] - cdf[offset];
+        if (width > 0)
+            du /= width;
+
+        pdf = density(offset);
+        return interval(0, 0.99999994).clamp((offset + du) / count());
+    }
+
+    double density(int offset) const {
+        // Density of the distribution within segment offset.
+        if (integral == 0)
+            return 1;
+        return func[offset] / integral;
+    }
+
+private:
+    std::vector<float> func;
+    std::vector<float> cdf;
+    double integral = 0;
+};
+
+class distribution_2d {
+    // Piecewise-constant density over [0,1)^2 given by a row-major nu x nv grid of values:
+    // a marginal distribution picks the row v, then that row's conditional distribution
+    // picks u.
+
+public:
+    distribution_2d() {
+    }
+
+    distribution_2d(const float *f, int nu, int nv) {
+        conditional.reserve(nv);
+        std::vector<float> row_integrals(nv);
+        for (int v = 0; v < nv; v++) {
+            conditional.push_back(distribution_1d(f + size_t(v) * nu, nu));
+            row_integrals[v] = float(conditional[v].function_integral());
+        }
+        marginal = distribution_1d(row_integrals.data(), nv);
+    }
+
+    size_t storage_bytes() const {
+        auto bytes = marginal.storage_bytes() + conditional.capacity() * sizeof(distribution_1d);
+        for (const auto &row : conditional)
+            bytes += row.storage_bytes();
+        return bytes;
+    }
+
+    void sample(double u0, double u1, double &u, double &v, double &pdf) const {
+        double pdf_v, pdf_u;
+        int row, column;
+        v = marginal.sample(u1, pdf_v, row);
+        u = conditional[row].sample(u0, pdf_u, column);
+        pdf = pdf_u * pdf_v;
+    }
+
+    double density(double u, double v) const {
+        auto nu = conditional[0].count();
+        auto nv = marginal.count();
+        auto column = int(interval(0, nu - 1).clamp(int(u * nu)));
+        auto row = int(interval(0, nv - 1).clamp(int(v * nv)));
+        return conditional[row].density(column) * marginal.density(row);
+    }
+
+private:
+    std::vector<distribution_1d> conditional;
+    distribution_1d marginal;
+};
+
+#endif
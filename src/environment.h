@@ -0,0 +1,128 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "distribution.h"
+#include "hittable.h"
+#include "rtw_stb_image.h"
+
+#include <vector>
+
+class environment_light : public hittable, private memory_tracked<environment_light, memory_category::LIGHTS> {
+    // An infinitely distant light given by an equirectangular (latitude-longitude) HDR image.
+    // Rays that escape the scene see its radiance, and it can be importance sampled as a
+    // light: directions are drawn in proportion to pixel luminance, corrected for the
+    // stretching of the mapping towards the poles.
+    //
+    // Image column i maps to the angle phi = 2 pi (i + 0.5) / width around +Y, starting at +X
+    // and turning towards +Z; row j maps to the angle theta = pi (j + 0.5) / height from +Y.
+
+public:
+    environment_light(const char *filename, double scale = 1.0) :
+        image(filename), scale(scale) {
+        build_distribution();
+    }
+
+    environment_light(const float *pixels, const unsigned char *bytes, int width, int height, double scale) :
+        scale(scale) {
+        // Uses decoded pixels that live elsewhere, such as in a scene bundle (see rtw_image::view).
+        image.view(pixels, bytes, width, height);
+        build_distribution();
+    }
+
+    const rtw_image &image_data() const { return image; }
+    double radiance_scale() const { return scale; }
+
+    color value(const vec3 &direction) const {
+        // Radiance arriving from the given direction.
+        if (image.height() <= 0) return color(0, 0, 0);
+
+        double u, v;
+        direction_to_uv(unit_vector(direction), u, v);
+        auto pixel = image.float_pixel_data(int(u * image.width()), int(v * image.height()));
+        return scale * color(pixel[0], pixel[1], pixel[2]);
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+        return false;
+    }
+
+    aabb bounding_box() const override {
+        return aabb::universe;
+    }
+
+    double pdf_value(const point3 &origin, const vec3 &direction) const override {
+        if (image.height() <= 0)
+            return 1 / (4 * pi);
+
+        auto d = unit_vector(direction);
+        auto sin_theta = std::sqrt(std::fmax(0.0, 1 - d.y() * d.y()));
+        if (sin_theta == 0)
+            return 0;
+
+        double u, v;
+        direction_to_uv(d, u, v);
+
+        // Convert from density over the unit square to density over solid angle.
+        return distribution.density(u, v) / (2 * pi * pi * sin_theta);
+    }
+
+    vec3 random(const point3 &origin) const override {
+        if (image.height() <= 0)
+            return random_unit_vector();
+
+        double u, v, pdf;
+        distribution.sample(random_double(), random_double(), u, v, pdf);
+        return uv_to_direction(u, v);
+    }
+
+private:
+    rtw_image image;
+    double scale;
+    distribution_2d distribution;
+    memory_account storage{memory_category::LIGHTS}; // Bytes of the sampling distribution
+
+    void build_distribution() {
+        int width = image.width();
+        int height = image.height();
+        if (width <= 0 || height <= 0)
+            return;
+
+        // Sampling density per pixel: luminance weighted by the solid angle of its row.
+        std::vector<float> weights(size_t(width) * height);
+        for (int j = 0; j < height; j++) {
+            auto sin_theta = std::sin(pi * (j + 0.5) / height);
+            for (int i = 0; i < width; i++) {
+                auto pixel = image.float_pixel_data(i, j);
+                auto c = color(pixel[0], pixel[1], pixel[2]);
+                weights[size_t(j) * width + i] = float(std::fmax(0.0, luminance(c)) * sin_theta);
+            }
+        }
+
+        distribution = distribution_2d(weights.data(), width, height);
+        storage.resize(distribution.storage_bytes());
+    }
+
+    static void direction_to_uv(const vec3 &d, double &u, double &v) {
+        auto phi = std::atan2(d.z(), d.x());
+        if (phi < 0) phi += 2 * pi;
+        u = phi / (2 * pi);
+        v = std::acos(interval(-1, 1).clamp(d.y())) / pi;
+    }
+
+    static vec3 uv_to_direction(double u, double v) {
+        auto phi = 2 * pi * u;
+        auto theta = pi * v;
+        auto sin_theta = std::sin(theta);
+        return vec3(sin_theta * std::cos(phi), std::cos(theta), sin_theta * std::sin(phi));
+    }
+};
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "hittable.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+class aov_record {
+public:
+    // Surface data of a camera path at its first non-specular vertex (arbitrary output
+    // variables, for denoising and inspection). Specular bounces are followed, adding their
+    // length to the depth.
+
+    bool recorded = false;
+    color albedo;
+    vec3 normal;
+    double depth = 0;       // Path length from the camera to the vertex, 0 on a miss
+    int primitive_id = -1;  // Object id of the primitive hit, -1 on a miss
+    double distance = 0;    // Path length so far, through specular bounces
+
+    void follow_specular(const ray &r, const hit_record &rec) {
+        distance += rec.t * r.direction().length();
+    }
+
+    void record_hit(const ray &r, const hit_record &rec, const color &surface_albedo) {
+        if (recorded) return;
+        recorded = true;
+        albedo = surface_albedo;
+        normal = rec.normal;
+        depth = distance + rec.t * r.direction().length();
+        primitive_id = rec.primitive_id;
+    }
+
+    void record_emitter_hit(const ray &r, const hit_record &rec) {
+        // Emitters have no albedo. They are recorded as white, so the denoiser's division by
+        // the albedo leaves their radiance as it is.
+        record_hit(r, rec, color(1, 1, 1));
+    }
+
+    void record_miss(const color &background) {
+        if (recorded) return;
+        recorded = true;
+        albedo = background;
+    }
+};
+
+class framebuffer {
+    // A float image with a fixed set of named channels. Each channel is one contiguous plane
+    // with its components interleaved per pixel, starting on a cache line and with every row
+    // padded to a whole number of cache lines. Tiles whose width is a multiple of 16 pixels
+    // therefore never share a cache line, so threads can write disjoint tiles directly, or
+    // render into their own tile buffers and merge them with copy_tile.
+
+public:
+    enum channel {
+        RADIANCE,     // Mean radiance (RGB)
+        ALBEDO,       // Albedo at the first non-specular hit (RGB)
+        NORMAL,       // Shading normal at the first non-specular hit (XYZ)
+        DEPTH,        // Path length to the first non-specular hit
+        PRIMITIVE_ID, // Object id of the first non-specular hit, exact up to 2^24
+        SAMPLE_COUNT, // Samples taken
+        VARIANCE,     // Sample variance of luminance
+        COST,         // Mean cost per sample, in the cost render mode
+        CHANNEL_COUNT
+    };
+
+    static const int cache_line_floats = 16;
+
+    framebuffer(int width, int height, memory_category category = memory_category::FRAMEBUFFERS) :
+        image_width(width), image_height(height), storage(category) {
+        size_t bytes = 0;
+        for (int c = 0; c < CHANNEL_COUNT; c++) {
+            auto floats_per_row = size_t(width) * components(channel(c));
+            auto stride = (floats_per_row + cache_line_floats - 1) / cache_line_floats * cache_line_floats;
+            planes[c].stride = stride;
+            planes[c].storage.assign(stride * height + cache_line_floats, 0.0f);
+
+            // Skip ahead to the first cache line boundary of the allocation.
+            auto address = reinterpret_cast<uintptr_t>(planes[c].storage.data());
+            auto misalignment = (address / sizeof(float)) % cache_line_floats;
+            planes[c].offset = misalignment ? cache_line_floats - misalignment : 0;
+            bytes += planes[c].storage.size() * sizeof(float);
+        }
+        storage.resize(bytes);
+    }
+
+    // The planes address their vectors' storage, which survives moves but not copies.
+    framebuffer(const framebuffer &) = delete;
+    framebuffer &operator=(const framebuffer &) = delete;
+    framebuffer(framebuffer &&) = default;
+    framebuffer &operator=(framebuffer &&) = default;
+
+    int width() const { return image_width; }
+    int height() const { return image_height; }
+
+    static int components(channel c) {
+        return (c == RADIANCE || c == ALBEDO || c == NORMAL) ? 3 : 1;
+    }
+
+    static const char *name(channel c) {
+        static const char *names[CHANNEL_COUNT] = {
+            "radiance", "albedo", "normal", "depth", "primitive_id", "sample_count", "variance",
+            "cost"
+        };
+        return names[c];
+    }
+
+    float *row(channel c, int j) {
+        return planes[c].storage.data() + planes[c].offset + planes[c].stride * j;
+    }
+
+    const float *row(channel c, int j) const {
+        return planes[c].storage.data() + planes[c].offset + planes[c].stride * j;
+    }
+
+    float value(channel c, int i, int j) const {
+        return row(c, j)[size_t(i) * components(c)];
+    }
+
+    void set_value(channel c, int i, int j, double x) {
+        row(c, j)[size_t(i) * components(c)] = float(x);
+    }
+
+    color get_color(channel c, int i, int j) const {
+        auto p = row(c, j) + size_t(i) * 3;
+        return color(p[0], p[1], p[2]);
+    }
+
+    void set_color(channel c, int i, int j, const color &x) {
+        auto p = row(c, j) + size_t(i) * 3;
+        p[0] = float(x.x());
+        p[1] = float(x.y());
+        p[2] = float(x.z());
+    }
+
+    void copy_tile(const framebuffer &tile, int x, int y, int width, int height) {
+        // Copies the upper left width x height pixels of every channel of a tile buffer into
+        // this buffer, with their upper left corner at x, y.
+        for (int c = 0; c < CHANNEL_COUNT; c++) {
+            auto n = size_t(width) * components(channel(c));
+            auto offset = size_t(x) * components(channel(c));
+            for (int j = 0; j < height; j++) {
+                auto source = tile.row(channel(c), j);
+                std::copy(source, source + n, row(channel(c), y + j) + offset);
+            }
+        }
+    }
+
+private:
+    struct plane {
+        std::vector<float> storage;
+        size_t offset = 0; // Floats from the start of storage to the first cache line
+        size_t stride = 0; // Floats per row
+    };
+
+    int image_width, image_height;
+    plane planes[CHANNEL_COUNT];
+    memory_account storage; // Bytes of the planes
+};
+
+#endif
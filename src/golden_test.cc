@@ -0,0 +1,235 @@
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Golden-image regression tests:
+//
+//     golden_test --references DIR [--exact] [--update] [--case NAME]
+//
+// Renders small fixed-seed images, one for each render mode and for each material, and
+// checks them against the references DIR/<case>.pfm.
+//
+// Every sample value is a function of the pixel, sample index and seed, so a render does not
+// depend on how its tiles are spread over threads, and every image must match its reference
+// bit for bit. With --exact, images are rendered on one thread; without it, on at least four
+// threads, so that a change that makes the render depend on the thread schedule is caught
+// even on a machine with fewer cores.
+//
+// --update renders the references, as --exact does, after an intended change to the images.
+
+#include "rtweekend.h"
+
+#include "image_reader.h"
+#include "scenes.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+static const int image_size = 32;
+static const int samples = 32;
+static const unsigned seed = 0x5eed;
+static const int parallel_threads = 4; // Fewest threads of a parallel render
+
+struct golden_case {
+    std::string name;
+    std::function<scene()> build; // Sets the render mode too
+};
+
+static scene material_scene(shared_ptr<hittable> object) {
+    // The Cornell box with a diffuse tall box and the given object in place of the sphere.
+    scene s;
+    cornell_box_walls(s.world);
+    s.world.add(cornell_box_tall_box(make_shared<lambertian>(color(.73, .73, .73))));
+    s.world.add(object);
+    cornell_box_camera(s.cam);
+    return s;
+}
+
+static shared_ptr<hittable> test_sphere(shared_ptr<material> mat) {
+    return make_shared<sphere>(point3(190, 90, 190), 90, mat);
+}
+
+static std::vector<golden_case> golden_cases() {
+    std::vector<golden_case> cases;
+
+    // Render modes, on the Cornell box scene
+    struct mode_entry { const char *name; camera::RenderMode mode; };
+    const mode_entry modes[] = {
+        {"mode_bsdf", camera::RenderMode::BSDF_SAMPLING},
+        {"mode_mixture", camera::RenderMode::MIXTURE_SAMPLING},
+        {"mode_nee", camera::RenderMode::NEE},
+        {"mode_mis", camera::RenderMode::MIS},
+    };
+    for (const auto &m : modes) {
+        auto mode = m.mode;
+        cases.push_back({m.name, [mode] {
+            auto s = cornell_box_scene();
+            s.cam.render_mode = mode;
+            return s;
+        }});
+    }
+
+    // The cost heatmap is deterministic only for the counted metrics.
+    if (stats_enabled) {
+        cases.push_back({"mode_cost", [] {
+            auto s = cornell_box_scene();
+            s.cam.render_mode = camera::RenderMode::COST;
+            s.cam.cost_metric = camera::CostMetric::BVH_NODES;
+            return s;
+        }});
+    }
+
+    // The progressive and adaptive render loops
+    cases.push_back({"mis_progressive", [] {
+        auto s = cornell_box_scene();
+        s.cam.progressive = true;
+        return s;
+    }});
+    cases.push_back({"mis_adaptive", [] {
+        auto s = cornell_box_scene();
+        s.cam.adaptive_sampling = true;
+        s.cam.adaptive_min_samples = 8;
+        return s;
+    }});
+
+    // Materials, rendered with MIS
+    cases.push_back({"material_lambertian", [] {
+        return material_scene(test_sphere(make_shared<lambertian>(color(.2, .4, .8))));
+    }});
+    cases.push_back({"material_phong", [] {
+        return material_scene(test_sphere(make_shared<phong>(color(.2, .4, .8), 30)));
+    }});
+    cases.push_back({"material_metal", [] {
+        return material_scene(test_sphere(make_shared<metal>(color(.8, .85, .88), 0.1)));
+    }});
+    cases.push_back({"material_dielectric", [] {
+        return material_scene(test_sphere(make_shared<dielectric>(1.5)));
+    }});
+    cases.push_back({"material_isotropic", [] {
+        auto boundary = test_sphere(make_shared<lambertian>(color(.73, .73, .73)));
+        return material_scene(make_shared<constant_medium>(boundary, 0.01, color(.2, .4, .9)));
+    }});
+    cases.push_back({"material_diffuse_light", [] {
+        return material_scene(test_sphere(make_shared<diffuse_light>(color(2, 1, .5))));
+    }});
+
+    return cases;
+}
+
+static bool render(const golden_case &c, bool exact, const std::string &filename) {
+    // Renders the case quietly into a PFM file.
+    auto s = c.build();
+    s.cam.image_width = image_size;
+    s.cam.samples_per_pixel = samples;
+    s.cam.seed = seed;
+    s.cam.tile_size = 8; // Several tiles, so that the parallel render spreads over threads
+    s.cam.output_file = filename;
+
+#ifdef _OPENMP
+    omp_set_num_threads(exact ? 1 : std::max(parallel_threads, omp_get_num_procs()));
+#endif
+
+    auto log = std::clog.rdbuf(nullptr);
+    bool written = s.cam.render(s.world);
+    std::clog.rdbuf(log);
+    return written;
+}
+
+static bool identical(const float_image &test, const float_image &reference, std::string &detail) {
+    for (size_t k = 0; k < reference.pixels.size(); k++) {
+        if (std::memcmp(&test.pixels[k], &reference.pixels[k], sizeof(float)) != 0) {
+            auto pixel = k / 3;
+            char buffer[128];
+            std::snprintf(buffer, sizeof buffer, "pixel (%d, %d) is %g, reference %g",
+                          int(pixel % reference.width), int(pixel / reference.width),
+                          test.pixels[k], reference.pixels[k]);
+            detail = buffer;
+            return false;
+        }
+    }
+    return true;
+}
+
+static int usage() {
+    std::cerr << "Usage: golden_test --references DIR [--exact] [--update] [--case NAME]\n";
+    return 2;
+}
+
+int main(int argc, char *argv[]) {
+    std::string references;
+    std::string only;
+    bool exact = false;
+    bool update = false;
+
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--exact")
+            exact = true;
+        else if (arg == "--update")
+            update = exact = true;
+        else if (arg == "--references" && a + 1 < argc)
+            references = argv[++a];
+        else if (arg == "--case" && a + 1 < argc)
+            only = argv[++a];
+        else
+            return usage();
+    }
+    if (references.empty())
+        return usage();
+
+    int failures = 0, run = 0;
+    for (const auto &c : golden_cases()) {
+        if (!only.empty() && c.name != only)
+            continue;
+        run++;
+
+        auto reference_file = references + "/" + c.name + ".pfm";
+        auto output = update ? reference_file : c.name + (exact ? ".exact.pfm" : ".parallel.pfm");
+        if (!render(c, exact, output)) {
+            std::printf("FAIL    %s: could not render\n", c.name.c_str());
+            failures++;
+            continue;
+        }
+        if (update) {
+            std::printf("UPDATE  %s\n", c.name.c_str());
+            continue;
+        }
+
+        float_image test, reference;
+        std::string error, detail;
+        bool passed = false;
+        if (!image_reader::read(reference_file, reference, error) || !image_reader::read(output, test, error))
+            detail = error;
+        else if (test.width != reference.width || test.height != reference.height)
+            detail = "size differs from the reference";
+        else
+            passed = identical(test, reference, detail);
+
+        std::printf("%s %s%s%s\n", passed ? "ok     " : "FAIL   ", c.name.c_str(),
+                    detail.empty() ? "" : ": ", detail.c_str());
+        if (passed)
+            std::remove(output.c_str());
+        else
+            failures++;
+    }
+
+    if (run == 0) {
+        std::cerr << "ERROR: No case named '" << only << "'.\n";
+        return 2;
+    }
+    std::printf("%d of %d passed\n", run - failures, run);
+    return failures == 0 ? 0 : 1;
+}
@@ -12,6 +12,11 @@
 //==============================================================================================
 
 #include "aabb.h"
+#include "memory_stats.h"
+#include "stats.h"
+
+#include <atomic>
+#include <vector>
 
 class material;
 
@@ -24,6 +29,7 @@ public:
     double u;
     double v;
     bool front_face;
+    int primitive_id = -1;
 
     void set_face_normal(const ray &r, const vec3 &outward_normal) {
         // Sets the hit record normal vector.
@@ -34,6 +40,139 @@ public:
     }
 };
 
+class light_bounds {
+public:
+    // Conservative description of an emitter (or a cluster of emitters) used to estimate its
+    // contribution to a shading point: spatial bounds, total emitted power, and a cone of
+    // emission directions. The cone is given by its axis w, the spread of surface normals
+    // around it (theta_o), and how far beyond each normal light is still emitted (theta_e).
+
+    aabb bounds;
+    vec3 w = vec3(0, 0, 1);
+    double phi = 0;         // Emitted power
+    double cos_theta_o = 1; // Cosine of the normal spread angle
+    double cos_theta_e = 0; // Cosine of the emission angle beyond the normal spread
+
+    light_bounds() {
+    }
+
+    light_bounds(const aabb &bounds, const vec3 &w, double phi, double cos_theta_o,
+                 double cos_theta_e) :
+        bounds(bounds), w(unit_vector(w)), phi(phi), cos_theta_o(cos_theta_o),
+        cos_theta_e(cos_theta_e) {
+    }
+
+    light_bounds(const light_bounds &a, const light_bounds &b) {
+        // Create the light bounds enclosing both inputs.
+
+        if (a.phi == 0) {
+            *this = b;
+            return;
+        }
+        if (b.phi == 0) {
+            *this = a;
+            return;
+        }
+
+        bounds = aabb(a.bounds, b.bounds);
+        phi = a.phi + b.phi;
+        cos_theta_e = std::fmin(a.cos_theta_e, b.cos_theta_e);
+        union_cone(a.w, a.cos_theta_o, b.w, b.cos_theta_o);
+    }
+
+    point3 centroid() const {
+        return point3(0.5 * (bounds.x.min + bounds.x.max),
+                      0.5 * (bounds.y.min + bounds.y.max),
+                      0.5 * (bounds.z.min + bounds.z.max));
+    }
+
+    double importance(const point3 &p) const {
+        // Returns a conservative estimate of the light arriving at point p from these bounds.
+
+        if (phi == 0)
+            return 0;
+
+        auto pc = centroid();
+        auto diagonal = vec3(bounds.x.size(), bounds.y.size(), bounds.z.size());
+        auto radius = 0.5 * diagonal.length();
+        auto d2 = std::fmax((p - pc).length_squared(), radius);
+
+        // Angle between the cone axis and the direction from the bounds to p.
+        auto wi = unit_vector(p - pc);
+        auto cos_theta_w = dot(w, wi);
+        auto sin_theta_w = safe_sqrt(1 - cos_theta_w * cos_theta_w);
+
+        // Angle subtended by the bounds as seen from p.
+        auto cos_theta_b = -1.0;
+        if ((p - pc).length_squared() > radius * radius)
+            cos_theta_b = safe_sqrt(1 - radius * radius / (p - pc).length_squared());
+        auto sin_theta_b = safe_sqrt(1 - cos_theta_b * cos_theta_b);
+
+        // Reduce the angle to p by the normal spread and the subtended angle, clamping at 0.
+        auto sin_theta_o = safe_sqrt(1 - cos_theta_o * cos_theta_o);
+        auto cos_theta_x = cos_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+        auto sin_theta_x = sin_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+        auto cos_theta_p = cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+
+        if (cos_theta_p <= cos_theta_e)
+            return 0;
+
+        return phi * cos_theta_p / d2;
+    }
+
+private:
+    static double safe_sqrt(double x) {
+        return std::sqrt(std::fmax(0.0, x));
+    }
+
+    static double cos_sub_clamped(double sin_a, double cos_a, double sin_b, double cos_b) {
+        // cos(max(0, a - b))
+        if (cos_a > cos_b) return 1;
+        return cos_a * cos_b + sin_a * sin_b;
+    }
+
+    static double sin_sub_clamped(double sin_a, double cos_a, double sin_b, double cos_b) {
+        // sin(max(0, a - b))
+        if (cos_a > cos_b) return 0;
+        return sin_a * cos_b - cos_a * sin_b;
+    }
+
+    void union_cone(const vec3 &wa, double cos_a, const vec3 &wb, double cos_b) {
+        // Set the cone (w, cos_theta_o) to one bounding both input cones.
+
+        auto theta_a = std::acos(interval(-1, 1).clamp(cos_a));
+        auto theta_b = std::acos(interval(-1, 1).clamp(cos_b));
+        auto theta_d = angle_between(wa, wb);
+
+        if (std::fmin(theta_d + theta_b, pi) <= theta_a) {
+            w = wa;
+            cos_theta_o = cos_a;
+            return;
+        }
+        if (std::fmin(theta_d + theta_a, pi) <= theta_b) {
+            w = wb;
+            cos_theta_o = cos_b;
+            return;
+        }
+
+        auto theta_o = (theta_a + theta_d + theta_b) / 2;
+        auto axis = cross(wa, wb);
+        if (theta_o >= pi || axis.length_squared() == 0) {
+            w = wa;
+            cos_theta_o = -1;
+            return;
+        }
+
+        // Rotate wa towards wb by theta_r about their common perpendicular (Rodrigues).
+        auto theta_r = theta_o - theta_a;
+        auto k = unit_vector(axis);
+        w = wa * std::cos(theta_r) + cross(k, wa) * std::sin(theta_r)
+            + k * dot(k, wa) * (1 - std::cos(theta_r));
+        w = unit_vector(w);
+        cos_theta_o = std::cos(theta_o);
+    }
+};
+
 class hittable {
 public:
     virtual ~hittable() = default;
@@ -49,9 +188,62 @@ public:
     virtual vec3 random(const point3 &origin) const {
         return vec3(1, 0, 0);
     }
+
+    virtual vec3 random_emitter(const point3 &origin, int &emitter) const {
+        // As random, also giving the emitter_id of the one emitter the direction was drawn
+        // towards, or -1 if the direction stands for every emitter it reaches.
+        emitter = -1;
+        return random(origin);
+    }
+
+    virtual double hit_pdf_value(const point3 &origin, const vec3 &direction, const hit_record *rec) const {
+        // Density of random_emitter for a direction whose ray first hits rec, or nothing if
+        // rec is null. A sample drawn towards one emitter only counts if it reaches that
+        // emitter, so the emitter hit is the only one whose density adds up here.
+        return pdf_value(origin, direction);
+    }
+
+    virtual bool emitter_bounds(light_bounds &lb) const {
+        // Primitives with an emissive material fill in their light bounds and return true.
+        return false;
+    }
+
+    virtual void collect_emitters(std::vector<shared_ptr<hittable>> &emitters) const {
+        // Aggregates append every emissive primitive they contain (see gather_emitters).
+    }
+
+    static void gather_emitters(
+        const shared_ptr<hittable> &object, std::vector<shared_ptr<hittable>> &emitters) {
+        // Appends the object itself if it is an emitter, or else the emitters it contains.
+        light_bounds lb;
+        if (object->emitter_bounds(lb))
+            emitters.push_back(object);
+        else
+            object->collect_emitters(emitters);
+    }
+
+    int id() const {
+        // Unique number of this object, in order of construction. Primitives report it in
+        // the hit record.
+        return object_id;
+    }
+
+    virtual int emitter_id() const {
+        // The primitive_id that hits on this emitter report. Wrappers give that of the object
+        // they wrap.
+        return id();
+    }
+
+private:
+    int object_id = next_id();
+
+    static int next_id() {
+        static std::atomic<int> counter(0);
+        return counter++;
+    }
 };
 
-class translate : public hittable {
+class translate : public hittable, private memory_tracked<translate, memory_category::GEOMETRY> {
 public:
     translate(shared_ptr<hittable> object, const vec3 &offset) :
         object(object), offset(offset) {
@@ -76,61 +268,54 @@ public:
         return bbox;
     }
 
+    double pdf_value(const point3 &origin, const vec3 &direction) const override {
+        return object->pdf_value(origin - offset, direction);
+    }
+
+    vec3 random(const point3 &origin) const override {
+        return object->random(origin - offset);
+    }
+
+    bool emitter_bounds(light_bounds &lb) const override {
+        if (!object->emitter_bounds(lb))
+            return false;
+
+        lb.bounds = lb.bounds + offset;
+        return true;
+    }
+
+    int emitter_id() const override {
+        return object->emitter_id();
+    }
+
+    void collect_emitters(std::vector<shared_ptr<hittable>> &emitters) const override {
+        // Emitters inside the translated object are returned wrapped in the same translation.
+        std::vector<shared_ptr<hittable>> inner;
+        object->collect_emitters(inner);
+        for (const auto &emitter : inner)
+            emitters.push_back(make_shared<translate>(emitter, offset));
+    }
+
 private:
     shared_ptr<hittable> object;
     vec3 offset;
     aabb bbox;
 };
 
-class rotate_y : public hittable {
+class rotate_y : public hittable, private memory_tracked<rotate_y, memory_category::GEOMETRY> {
 public:
     rotate_y(shared_ptr<hittable> object, double angle) :
-        object(object) {
+        object(object), angle(angle) {
         auto radians = degrees_to_radians(angle);
         sin_theta = std::sin(radians);
         cos_theta = std::cos(radians);
-        bbox = object->bounding_box();
-
-        point3 min(infinity, infinity, infinity);
-        point3 max(-infinity, -infinity, -infinity);
-
-        for (int i = 0; i < 2; i++) {
-            for (int j = 0; j < 2; j++) {
-                for (int k = 0; k < 2; k++) {
-                    auto x = i * bbox.x.max + (1 - i) * bbox.x.min;
-                    auto y = j * bbox.y.max + (1 - j) * bbox.y.min;
-                    auto z = k * bbox.z.max + (1 - k) * bbox.z.min;
-
-                    auto newx = cos_theta * x + sin_theta * z;
-                    auto newz = -sin_theta * x + cos_theta * z;
-
-                    vec3 tester(newx, y, newz);
-
-                    for (int c = 0; c < 3; c++) {
-                        min[c] = std::fmin(min[c], tester[c]);
-                        max[c] = std::fmax(max[c], tester[c]);
-                    }
-                }
-            }
-        }
-
-        bbox = aabb(min, max);
+        bbox = rotated_bbox(object->bounding_box());
     }
 
     bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
         // Transform the ray from world space to object space.
 
-        auto origin = point3(
-            (cos_theta * r.origin().x()) - (sin_theta * r.origin().z()),
-            r.origin().y(),
-            (sin_theta * r.origin().x()) + (cos_theta * r.origin().z()));
-
-        auto direction = vec3(
-            (cos_theta * r.direction().x()) - (sin_theta * r.direction().z()),
-            r.direction().y(),
-            (sin_theta * r.direction().x()) + (cos_theta * r.direction().z()));
-
-        ray rotated_r(origin, direction, r.time());
+        ray rotated_r(to_object(r.origin()), to_object(r.direction()), r.time());
 
         // Determine whether an intersection exists in object space (and if so, where).
 
@@ -139,15 +324,8 @@ public:
 
         // Transform the intersection from object space back to world space.
 
-        rec.p = point3(
-            (cos_theta * rec.p.x()) + (sin_theta * rec.p.z()),
-            rec.p.y(),
-            (-sin_theta * rec.p.x()) + (cos_theta * rec.p.z()));
-
-        rec.normal = vec3(
-            (cos_theta * rec.normal.x()) + (sin_theta * rec.normal.z()),
-            rec.normal.y(),
-            (-sin_theta * rec.normal.x()) + (cos_theta * rec.normal.z()));
+        rec.p = to_world(rec.p);
+        rec.normal = to_world(rec.normal);
 
         return true;
     }
@@ -156,11 +334,79 @@ public:
         return bbox;
     }
 
+    double pdf_value(const point3 &origin, const vec3 &direction) const override {
+        return object->pdf_value(to_object(origin), to_object(direction));
+    }
+
+    vec3 random(const point3 &origin) const override {
+        return to_world(object->random(to_object(origin)));
+    }
+
+    bool emitter_bounds(light_bounds &lb) const override {
+        if (!object->emitter_bounds(lb))
+            return false;
+
+        lb.bounds = rotated_bbox(lb.bounds);
+        lb.w = to_world(lb.w);
+        return true;
+    }
+
+    int emitter_id() const override {
+        return object->emitter_id();
+    }
+
+    void collect_emitters(std::vector<shared_ptr<hittable>> &emitters) const override {
+        // Emitters inside the rotated object are returned wrapped in the same rotation.
+        std::vector<shared_ptr<hittable>> inner;
+        object->collect_emitters(inner);
+        for (const auto &emitter : inner)
+            emitters.push_back(make_shared<rotate_y>(emitter, angle));
+    }
+
 private:
     shared_ptr<hittable> object;
+    double angle;
     double sin_theta;
     double cos_theta;
     aabb bbox;
+
+    vec3 to_object(const vec3 &v) const {
+        return vec3((cos_theta * v.x()) - (sin_theta * v.z()),
+                    v.y(),
+                    (sin_theta * v.x()) + (cos_theta * v.z()));
+    }
+
+    vec3 to_world(const vec3 &v) const {
+        return vec3((cos_theta * v.x()) + (sin_theta * v.z()),
+                    v.y(),
+                    (-sin_theta * v.x()) + (cos_theta * v.z()));
+    }
+
+    aabb rotated_bbox(const aabb &box) const {
+        // Returns the world-space box bounding all eight rotated corners of an object box.
+
+        point3 min(infinity, infinity, infinity);
+        point3 max(-infinity, -infinity, -infinity);
+
+        for (int i = 0; i < 2; i++) {
+            for (int j = 0; j < 2; j++) {
+                for (int k = 0; k < 2; k++) {
+                    auto x = i * box.x.max + (1 - i) * box.x.min;
+                    auto y = j * box.y.max + (1 - j) * box.y.min;
+                    auto z = k * box.z.max + (1 - k) * box.z.min;
+
+                    vec3 tester = to_world(vec3(x, y, z));
+
+                    for (int c = 0; c < 3; c++) {
+                        min[c] = std::fmin(min[c], tester[c]);
+                        max[c] = std::fmax(max[c], tester[c]);
+                    }
+                }
+            }
+        }
+
+        return aabb(min, max);
+    }
 };
 
 #endif
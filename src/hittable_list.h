@@ -16,7 +16,7 @@
 
 #include <vector>
 
-class hittable_list : public hittable {
+class hittable_list : public hittable, private memory_tracked<hittable_list, memory_category::GEOMETRY> {
 public:
     std::vector<shared_ptr<hittable>> objects;
 
@@ -33,6 +33,7 @@ public:
     void add(shared_ptr<hittable> object) {
         objects.push_back(object);
         bbox = aabb(bbox, object->bounding_box());
+        storage.resize(objects.capacity() * sizeof(objects[0]));
     }
 
     bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
@@ -70,8 +71,14 @@ public:
         return objects[random_int(0, int_size - 1)]->random(origin);
     }
 
+    void collect_emitters(std::vector<shared_ptr<hittable>> &emitters) const override {
+        for (const auto &object : objects)
+            gather_emitters(object, emitters);
+    }
+
 private:
     aabb bbox;
+    memory_account storage{memory_category::GEOMETRY}; // Bytes of the object pointers
 };
 
 #endif
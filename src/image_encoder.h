@@ -0,0 +1,246 @@
+#ifndef IMAGE_ENCODER_H
+#define IMAGE_ENCODER_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Disable strict warnings for this header from the Microsoft Visual C++ compiler.
+#ifdef _MSC_VER
+#pragma warning(push, 0)
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "external/stb_image_write.h"
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#include <cctype>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class image_encoder {
+    // Writes an image that arrives one row at a time, from top to bottom.
+
+public:
+    image_encoder(int width, int height) :
+        width(width), height(height) {
+    }
+
+    virtual ~image_encoder() = default;
+
+    virtual void write_row(int j, const color *pixels) = 0;
+
+    // Completes the file and returns whether everything was written.
+    virtual bool finish() = 0;
+
+protected:
+    int width, height;
+};
+
+class ppm_text_encoder : public image_encoder {
+    // ASCII PPM (P3) with gamma-encoded bytes, one pixel per line.
+
+public:
+    ppm_text_encoder(std::ostream &out, int width, int height) :
+        image_encoder(width, height), out(out) {
+        out << "P3\n" << width << ' ' << height << "\n255\n";
+    }
+
+    void write_row(int j, const color *pixels) override {
+        for (int i = 0; i < width; i++)
+            write_color(out, pixels[i]);
+    }
+
+    bool finish() override {
+        out.flush();
+        return bool(out);
+    }
+
+private:
+    std::ostream &out;
+};
+
+class ppm_binary_encoder : public image_encoder {
+    // Binary PPM (P6) with gamma-encoded bytes, written row by row.
+
+public:
+    ppm_binary_encoder(std::FILE *file, int width, int height) :
+        image_encoder(width, height), file(file), bytes(size_t(width) * 3) {
+        ok = std::fprintf(file, "P6\n%d %d\n255\n", width, height) > 0;
+    }
+
+    ~ppm_binary_encoder() override {
+        // Closes the file if the image was never finished, as when a render is abandoned.
+        if (file)
+            std::fclose(file);
+    }
+
+    ppm_binary_encoder(const ppm_binary_encoder &) = delete;
+    ppm_binary_encoder &operator=(const ppm_binary_encoder &) = delete;
+
+    void write_row(int j, const color *pixels) override {
+        for (int i = 0; i < width; i++)
+            color_to_bytes(pixels[i], &bytes[size_t(i) * 3]);
+        ok = ok && std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    }
+
+    bool finish() override {
+        auto closed = std::fclose(file) == 0;
+        file = nullptr;
+        return closed && ok;
+    }
+
+private:
+    std::FILE *file;
+    std::vector<unsigned char> bytes;
+    bool ok;
+};
+
+class pfm_encoder : public image_encoder {
+    // Portable float map: linear radiance as little-endian float32 RGB, with no tone mapping
+    // or clamping. PFM stores rows from bottom to top, so every row is written at its own
+    // offset as soon as it arrives.
+
+public:
+    pfm_encoder(std::FILE *file, int width, int height) :
+        image_encoder(width, height), file(file), floats(size_t(width) * 3) {
+        header_size = std::fprintf(file, "PF\n%d %d\n-1.0\n", width, height);
+        ok = header_size > 0;
+    }
+
+    ~pfm_encoder() override {
+        // Closes the file if finish was never called.
+        if (file)
+            std::fclose(file);
+    }
+
+    pfm_encoder(const pfm_encoder &) = delete;
+    pfm_encoder &operator=(const pfm_encoder &) = delete;
+
+    void write_row(int j, const color *pixels) override {
+        for (int i = 0; i < width; i++) {
+            floats[size_t(i) * 3 + 0] = float(pixels[i].x());
+            floats[size_t(i) * 3 + 1] = float(pixels[i].y());
+            floats[size_t(i) * 3 + 2] = float(pixels[i].z());
+        }
+
+        auto row_bytes = long(floats.size() * sizeof(float));
+        ok = ok
+             && std::fseek(file, header_size + long(height - 1 - j) * row_bytes, SEEK_SET) == 0
+             && std::fwrite(floats.data(), sizeof(float), floats.size(), file) == floats.size();
+    }
+
+    bool finish() override {
+        auto closed = std::fclose(file) == 0;
+        file = nullptr;
+        return closed && ok;
+    }
+
+private:
+    std::FILE *file;
+    std::vector<float> floats;
+    long header_size;
+    bool ok;
+};
+
+class png_encoder : public image_encoder {
+    // 8-bit PNG with gamma-encoded bytes. The stb_image_write compressor needs the whole
+    // image, so rows are collected and the file is written on finish.
+
+public:
+    png_encoder(const std::string &filename, int width, int height) :
+        image_encoder(width, height), filename(filename), bytes(size_t(width) * height * 3) {
+    }
+
+    void write_row(int j, const color *pixels) override {
+        auto row = &bytes[size_t(j) * width * 3];
+        for (int i = 0; i < width; i++)
+            color_to_bytes(pixels[i], row + size_t(i) * 3);
+    }
+
+    bool finish() override {
+        return stbi_write_png(filename.c_str(), width, height, 3, bytes.data(), width * 3) != 0;
+    }
+
+private:
+    std::string filename;
+    std::vector<unsigned char> bytes;
+};
+
+class hdr_encoder : public image_encoder {
+    // Radiance RGBE (.hdr) with linear radiance, written on finish by stb_image_write.
+
+public:
+    hdr_encoder(const std::string &filename, int width, int height) :
+        image_encoder(width, height), filename(filename), floats(size_t(width) * height * 3) {
+    }
+
+    void write_row(int j, const color *pixels) override {
+        auto row = &floats[size_t(j) * width * 3];
+        for (int i = 0; i < width; i++) {
+            row[size_t(i) * 3 + 0] = float(pixels[i].x());
+            row[size_t(i) * 3 + 1] = float(pixels[i].y());
+            row[size_t(i) * 3 + 2] = float(pixels[i].z());
+        }
+    }
+
+    bool finish() override {
+        return stbi_write_hdr(filename.c_str(), width, height, 3, floats.data()) != 0;
+    }
+
+private:
+    std::string filename;
+    std::vector<float> floats;
+};
+
+inline shared_ptr<image_encoder> make_image_encoder(const std::string &filename, int width, int height) {
+    // Picks the encoder from the file extension: .ppm (binary), .png, .pfm or .hdr. An empty
+    // file name selects ASCII PPM on standard output. Returns nullptr on failure.
+    if (filename.empty())
+        return make_shared<ppm_text_encoder>(std::cout, width, height);
+
+    auto dot = filename.rfind('.');
+    auto extension = (dot == std::string::npos) ? std::string() : filename.substr(dot + 1);
+    for (auto &c : extension)
+        c = char(std::tolower(c));
+
+    if (extension == "png")
+        return make_shared<png_encoder>(filename, width, height);
+    if (extension == "hdr")
+        return make_shared<hdr_encoder>(filename, width, height);
+
+    if (extension != "ppm" && extension != "pfm") {
+        std::cerr << "ERROR: Unknown image format '" << filename << "'.\n";
+        return nullptr;
+    }
+
+    auto file = std::fopen(filename.c_str(), "wb");
+    if (!file) {
+        std::cerr << "ERROR: Could not write image file '" << filename << "'.\n";
+        return nullptr;
+    }
+
+    if (extension == "pfm")
+        return make_shared<pfm_encoder>(file, width, height);
+    return make_shared<ppm_binary_encoder>(file, width, height);
+}
+
+// Restore MSVC compiler warnings
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+#endif
@@ -0,0 +1,413 @@
+#ifndef IMAGE_METRICS_H
+#define IMAGE_METRICS_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "colormap.h"
+#include "image_reader.h"
+
+#include <algorithm>
+#include <vector>
+
+struct image_metrics {
+    double mse = 0;     // Mean squared error of the linear radiance
+    double rel_mse = 0; // Mean squared error relative to the squared reference (plus 0.01)
+    double psnr = 0;    // Peak signal to noise ratio of the display values, in dB
+    double ssim = 0;    // Mean structural similarity of the display luminance
+    double flip = 0;    // Mean LDR-FLIP error, in [0,1]
+};
+
+class image_comparison {
+    // Error metrics of a test image against a reference. MSE and relative MSE measure the
+    // linear radiance, as convergence studies do. PSNR, SSIM and FLIP measure the image as
+    // it is displayed: clamped to [0,1] and gamma encoded like the renderer's 8-bit output,
+    // then, for FLIP, shown on an sRGB monitor.
+    //
+    // FLIP follows the LDR-FLIP definition (Andersson et al. 2020): a contrast sensitivity
+    // filter in YCxCz, a Hunt-adjusted HyAB color difference, and an edge and point feature
+    // difference on luminance, for an observer at the given number of pixels per degree.
+    // Images are filtered row by row in parallel.
+
+public:
+    double pixels_per_degree = 67.0206; // 0.7 m from a 0.7 m wide 4K monitor
+
+    image_metrics compare(
+        const float_image &test, const float_image &reference, std::vector<float> *flip_map = nullptr
+    ) const {
+        // Both images must have the same size. If flip_map is given, it receives the
+        // per-pixel FLIP error.
+        auto result = radiance_errors(test, reference);
+        int width = reference.width;
+        int height = reference.height;
+        auto n = size_t(width) * height;
+
+        std::vector<float> test_display(n * 3), reference_display(n * 3);
+        to_display(test, test_display);
+        to_display(reference, reference_display);
+
+        double display_error = 0;
+#pragma omp parallel for schedule(static) reduction(+:display_error)
+        for (int j = 0; j < height; j++) {
+            for (size_t k = size_t(j) * width * 3; k < size_t(j + 1) * width * 3; k++) {
+                double d = double(test_display[k]) - reference_display[k];
+                display_error += d * d;
+            }
+        }
+
+        display_error /= (n * 3);
+        result.psnr = display_error > 0 ? 10 * std::log10(1 / display_error) : infinity;
+        result.ssim = ssim(test_display, reference_display, width, height);
+
+        std::vector<float> map;
+        flip(test_display, reference_display, width, height, map);
+        double flip_sum = 0;
+#pragma omp parallel for schedule(static) reduction(+:flip_sum)
+        for (int j = 0; j < height; j++)
+            for (size_t k = size_t(j) * width; k < size_t(j + 1) * width; k++)
+                flip_sum += map[k];
+        result.flip = flip_sum / n;
+
+        if (flip_map)
+            flip_map->swap(map);
+        return result;
+    }
+
+    static image_metrics radiance_errors(const float_image &test, const float_image &reference) {
+        // Only the MSE and relative MSE, which are cheap enough for convergence curves.
+        image_metrics result;
+        int width = reference.width;
+        int height = reference.height;
+
+        double squared_error = 0, relative_error = 0;
+#pragma omp parallel for schedule(static) reduction(+:squared_error, relative_error)
+        for (int j = 0; j < height; j++) {
+            for (size_t k = size_t(j) * width * 3; k < size_t(j + 1) * width * 3; k++) {
+                double t = finite_or_zero(test.pixels[k]);
+                double r = finite_or_zero(reference.pixels[k]);
+                squared_error += (t - r) * (t - r);
+                relative_error += (t - r) * (t - r) / (r * r + 0.01);
+            }
+        }
+
+        auto count = size_t(width) * height * 3;
+        result.mse = squared_error / count;
+        result.rel_mse = relative_error / count;
+        return result;
+    }
+
+private:
+    using plane = std::vector<float>;
+
+    static float finite_or_zero(float x) {
+        return std::isfinite(x) ? x : 0.0f;
+    }
+
+    static void to_display(const float_image &image, plane &display) {
+        // Clamped, gamma 2 encoded values, as color_to_bytes writes them (before quantizing).
+#pragma omp parallel for schedule(static)
+        for (int j = 0; j < image.height; j++) {
+            for (size_t k = size_t(j) * image.width * 3; k < size_t(j + 1) * image.width * 3; k++) {
+                auto x = finite_or_zero(image.pixels[k]);
+                display[k] = std::min(1.0f, std::sqrt(std::max(0.0f, x)));
+            }
+        }
+    }
+
+    static void convolve(
+        const plane &in, int width, int height, const plane &kernel_x, const plane &kernel_y,
+        plane &out
+    ) {
+        // Separable convolution with odd-sized kernels, repeating the edge pixels.
+        int rx = int(kernel_x.size() / 2);
+        int ry = int(kernel_y.size() / 2);
+        plane temp(in.size(), 0.0f);
+        out.assign(in.size(), 0.0f);
+
+#pragma omp parallel for schedule(static)
+        for (int j = 0; j < height; j++) {
+            // Pad the row with its edge pixels, so the tap loops run without bounds checks.
+            plane padded(width + 2 * rx);
+            auto row = &in[size_t(j) * width];
+            std::fill(padded.begin(), padded.begin() + rx, row[0]);
+            std::copy(row, row + width, padded.begin() + rx);
+            std::fill(padded.begin() + rx + width, padded.end(), row[width - 1]);
+
+            auto t = &temp[size_t(j) * width];
+            for (int k = 0; k <= 2 * rx; k++) {
+                auto weight = kernel_x[k];
+                auto source = &padded[k];
+                for (int i = 0; i < width; i++)
+                    t[i] += weight * source[i];
+            }
+        }
+
+#pragma omp parallel for schedule(static)
+        for (int j = 0; j < height; j++) {
+            auto o = &out[size_t(j) * width];
+            for (int k = -ry; k <= ry; k++) {
+                auto t = &temp[size_t(std::min(std::max(j + k, 0), height - 1)) * width];
+                auto weight = kernel_y[k + ry];
+                for (int i = 0; i < width; i++)
+                    o[i] += weight * t[i];
+            }
+        }
+    }
+
+    static plane gaussian(int radius, double sigma) {
+        // Normalized Gaussian, with sigma in pixels.
+        plane kernel(2 * radius + 1);
+        double sum = 0;
+        for (int x = -radius; x <= radius; x++)
+            sum += kernel[x + radius] = float(std::exp(-x * x / (2 * sigma * sigma)));
+        for (auto &w : kernel)
+            w = float(w / sum);
+        return kernel;
+    }
+
+    static double ssim(const plane &test, const plane &reference, int width, int height) {
+        // SSIM of the display luminance with the usual 11x11 Gaussian window (sigma 1.5) and
+        // constants; the window repeats the edge pixels instead of skipping the border.
+        const double c1 = 0.01 * 0.01, c2 = 0.03 * 0.03;
+        auto n = size_t(width) * height;
+
+        plane x(n), y(n), xx(n), yy(n), xy(n);
+#pragma omp parallel for schedule(static)
+        for (int j = 0; j < height; j++) {
+            for (size_t k = size_t(j) * width; k < size_t(j + 1) * width; k++) {
+                x[k] = 0.2126f * test[3 * k] + 0.7152f * test[3 * k + 1] + 0.0722f * test[3 * k + 2];
+                y[k] = 0.2126f * reference[3 * k] + 0.7152f * reference[3 * k + 1]
+                       + 0.0722f * reference[3 * k + 2];
+                xx[k] = x[k] * x[k];
+                yy[k] = y[k] * y[k];
+                xy[k] = x[k] * y[k];
+            }
+        }
+
+        auto window = gaussian(5, 1.5);
+        plane mx, my, sxx, syy, sxy;
+        convolve(x, width, height, window, window, mx);
+        convolve(y, width, height, window, window, my);
+        convolve(xx, width, height, window, window, sxx);
+        convolve(yy, width, height, window, window, syy);
+        convolve(xy, width, height, window, window, sxy);
+
+        double sum = 0;
+#pragma omp parallel for schedule(static) reduction(+:sum)
+        for (int j = 0; j < height; j++) {
+            for (size_t k = size_t(j) * width; k < size_t(j + 1) * width; k++) {
+                double mu_x = mx[k], mu_y = my[k];
+                double var_x = sxx[k] - mu_x * mu_x;
+                double var_y = syy[k] - mu_y * mu_y;
+                double cov = sxy[k] - mu_x * mu_y;
+                sum += ((2 * mu_x * mu_y + c1) * (2 * cov + c2))
+                       / ((mu_x * mu_x + mu_y * mu_y + c1) * (var_x + var_y + c2));
+            }
+        }
+        return sum / n;
+    }
+
+    // FLIP color spaces. XYZ uses the sRGB primaries and the D65 white of linear (1,1,1).
+
+    static constexpr double white_x = 0.4124564 + 0.3575761 + 0.1804375;
+    static constexpr double white_y = 0.2126729 + 0.7151522 + 0.0721750;
+    static constexpr double white_z = 0.0193339 + 0.1191920 + 0.9503041;
+
+    static double srgb_to_linear(double x) {
+        return x <= 0.04045 ? x / 12.92 : std::pow((x + 0.055) / 1.055, 2.4);
+    }
+
+    static void linear_to_xyz(const double rgb[3], double xyz[3]) {
+        xyz[0] = 0.4124564 * rgb[0] + 0.3575761 * rgb[1] + 0.1804375 * rgb[2];
+        xyz[1] = 0.2126729 * rgb[0] + 0.7151522 * rgb[1] + 0.0721750 * rgb[2];
+        xyz[2] = 0.0193339 * rgb[0] + 0.1191920 * rgb[1] + 0.9503041 * rgb[2];
+    }
+
+    static void xyz_to_linear(const double xyz[3], double rgb[3]) {
+        rgb[0] = 3.2404542 * xyz[0] - 1.5371385 * xyz[1] - 0.4985314 * xyz[2];
+        rgb[1] = -0.9692660 * xyz[0] + 1.8760108 * xyz[1] + 0.0415560 * xyz[2];
+        rgb[2] = 0.0556434 * xyz[0] - 0.2040259 * xyz[1] + 1.0572252 * xyz[2];
+    }
+
+    static void hunt_lab(const double rgb[3], double lab[3]) {
+        // CIELAB of a linear color, with a and b scaled by 0.01 L (the Hunt effect).
+        double xyz[3];
+        linear_to_xyz(rgb, xyz);
+
+        auto f = [](double t) {
+            const double delta = 6.0 / 29;
+            return t > delta * delta * delta ? std::cbrt(t) : t / (3 * delta * delta) + 4.0 / 29;
+        };
+        auto fx = f(xyz[0] / white_x), fy = f(xyz[1] / white_y), fz = f(xyz[2] / white_z);
+
+        lab[0] = 116 * fy - 16;
+        lab[1] = 0.01 * lab[0] * 500 * (fx - fy);
+        lab[2] = 0.01 * lab[0] * 200 * (fy - fz);
+    }
+
+    static double hyab(const double p[3], const double q[3]) {
+        return std::fabs(p[0] - q[0]) + std::hypot(p[1] - q[1], p[2] - q[2]);
+    }
+
+    struct flip_input {
+        plane y, cx, cz; // Contrast sensitivity filtered YCxCz
+        plane edges;     // Edge feature strength of the luminance
+        plane points;    // Point feature strength of the luminance
+    };
+
+    void flip_prepare(const plane &display, int width, int height, flip_input &in) const {
+        auto n = size_t(width) * height;
+        plane y(n), cx(n), cz(n), lum(n);
+
+#pragma omp parallel for schedule(static)
+        for (int j = 0; j < height; j++) {
+            for (size_t k = size_t(j) * width; k < size_t(j + 1) * width; k++) {
+                double rgb[3], xyz[3];
+                for (int c = 0; c < 3; c++)
+                    rgb[c] = srgb_to_linear(display[3 * k + c]);
+                linear_to_xyz(rgb, xyz);
+
+                y[k] = float(116 * xyz[1] / white_y - 16);
+                cx[k] = float(500 * (xyz[0] / white_x - xyz[1] / white_y));
+                cz[k] = float(200 * (xyz[1] / white_y - xyz[2] / white_z));
+                lum[k] = float(xyz[1] / white_y);
+            }
+        }
+
+        // Contrast sensitivity: a sum of Gaussians per channel, in degrees of visual angle.
+        // All share the radius of the widest one.
+        const double a1[3] = {1, 1, 34.1}, b1[3] = {0.0047, 0.0053, 0.04};
+        const double a2[3] = {0, 0, 13.5}, b2[3] = {1e-5, 1e-5, 0.025};
+        int radius = int(std::ceil(3 * std::sqrt(0.04 / (2 * pi * pi)) * pixels_per_degree));
+
+        plane *channels[3] = {&y, &cx, &cz};
+        plane *filtered[3] = {&in.y, &in.cx, &in.cz};
+        for (int c = 0; c < 3; c++) {
+            // Each Gaussian is separable. Their mix is set by their 2D sums.
+            plane g1 = csf_gaussian(radius, b1[c]), g2 = csf_gaussian(radius, b2[c]);
+            double s1 = 0, s2 = 0;
+            for (auto w : g1) s1 += w;
+            for (auto w : g2) s2 += w;
+            double w1 = a1[c] * std::sqrt(pi / b1[c]) * s1 * s1;
+            double w2 = a2[c] * std::sqrt(pi / b2[c]) * s2 * s2;
+
+            for (auto &w : g1) w = float(w / s1);
+            convolve(*channels[c], width, height, g1, g1, *filtered[c]);
+            if (w2 == 0) continue;
+
+            for (auto &w : g2) w = float(w / s2);
+            plane second;
+            convolve(*channels[c], width, height, g2, g2, second);
+            auto &out = *filtered[c];
+            for (size_t k = 0; k < n; k++)
+                out[k] = float((w1 * out[k] + w2 * second[k]) / (w1 + w2));
+        }
+
+        // Features: first and second derivatives of a Gaussian, with their positive and
+        // negative weights each normalized to unit sum.
+        double sigma = 0.5 * 0.082 * pixels_per_degree;
+        int feature_radius = int(std::ceil(3 * sigma));
+        auto g = gaussian(feature_radius, sigma);
+        plane d1(g.size()), d2(g.size());
+        for (int x = -feature_radius; x <= feature_radius; x++) {
+            d1[x + feature_radius] = float(-x * g[x + feature_radius]);
+            d2[x + feature_radius] = float((x * x / (sigma * sigma) - 1) * g[x + feature_radius]);
+        }
+        normalize_signed(d1);
+        normalize_signed(d2);
+
+        plane gx, gy, gxx, gyy;
+        convolve(lum, width, height, d1, g, gx);
+        convolve(lum, width, height, g, d1, gy);
+        convolve(lum, width, height, d2, g, gxx);
+        convolve(lum, width, height, g, d2, gyy);
+
+        in.edges.resize(n);
+        in.points.resize(n);
+        for (size_t k = 0; k < n; k++) {
+            in.edges[k] = std::hypot(gx[k], gy[k]);
+            in.points[k] = std::hypot(gxx[k], gyy[k]);
+        }
+    }
+
+    plane csf_gaussian(int radius, double b) const {
+        // The narrow luminance and red-green Gaussians fall below 1e-7 of their peak well
+        // within the shared radius, so their tails are cut off to save taps.
+        plane kernel;
+        for (int x = -radius; x <= radius; x++) {
+            auto degrees = x / pixels_per_degree;
+            auto w = std::exp(-pi * pi * degrees * degrees / b);
+            if (w >= 1e-7 || x == 0)
+                kernel.push_back(float(w));
+        }
+        return kernel;
+    }
+
+    static void normalize_signed(plane &kernel) {
+        double positive = 0, negative = 0;
+        for (auto w : kernel) {
+            if (w > 0) positive += w;
+            else negative -= w;
+        }
+        for (auto &w : kernel)
+            w = float(w > 0 ? w / positive : w / negative);
+    }
+
+    void flip(const plane &test, const plane &reference, int width, int height, plane &map) const {
+        flip_input t, r;
+        flip_prepare(test, width, height, t);
+        flip_prepare(reference, width, height, r);
+
+        // The largest color difference, between green and blue, sets the scale.
+        const double qc = 0.7, pc = 0.4, pt = 0.95, qf = 0.5;
+        const double green[3] = {0, 1, 0}, blue[3] = {0, 0, 1};
+        double green_lab[3], blue_lab[3];
+        hunt_lab(green, green_lab);
+        hunt_lab(blue, blue_lab);
+        auto cmax = std::pow(hyab(green_lab, blue_lab), qc);
+
+        map.resize(size_t(width) * height);
+#pragma omp parallel for schedule(static)
+        for (int j = 0; j < height; j++) {
+            for (size_t k = size_t(j) * width; k < size_t(j + 1) * width; k++) {
+                double test_lab[3], reference_lab[3];
+                filtered_lab(t, k, test_lab);
+                filtered_lab(r, k, reference_lab);
+
+                // Color difference, compressed so that large differences share the top 5%.
+                auto color_error = std::pow(hyab(test_lab, reference_lab), qc);
+                color_error = color_error < pc * cmax
+                                  ? pt / pc * color_error / cmax
+                                  : pt + (color_error - pc * cmax) / (cmax - pc * cmax) * (1 - pt);
+
+                auto feature_error = std::pow(
+                    std::max(std::fabs(t.edges[k] - r.edges[k]), std::fabs(t.points[k] - r.points[k]))
+                        / std::sqrt(2.0),
+                    qf);
+
+                map[k] = float(std::pow(color_error, 1 - feature_error));
+            }
+        }
+    }
+
+    static void filtered_lab(const flip_input &in, size_t k, double lab[3]) {
+        // Back from filtered YCxCz to a linear color clamped to the display gamut, then to
+        // Hunt-adjusted CIELAB.
+        auto fy = (in.y[k] + 16) / 116.0;
+        double xyz[3] = {
+            (in.cx[k] / 500.0 + fy) * white_x, fy * white_y, (fy - in.cz[k] / 200.0) * white_z
+        };
+        double rgb[3];
+        xyz_to_linear(xyz, rgb);
+        for (auto &c : rgb)
+            c = std::min(1.0, std::max(0.0, c));
+        hunt_lab(rgb, lab);
+    }
+};
+
+#endif
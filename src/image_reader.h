@@ -0,0 +1,255 @@
+#ifndef IMAGE_READER_H
+#define IMAGE_READER_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <fstream>
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+class mapped_file {
+    // A read-only view of a whole file. The file is memory mapped where the platform allows,
+    // so large images are paged in as they are parsed instead of copied through a stream.
+    // Files read in random order, like scene bundles, are mapped with sequential false.
+
+public:
+    explicit mapped_file(const std::string &filename, bool sequential = true) {
+#ifdef _WIN32
+        std::ifstream in(filename, std::ios::binary);
+        if (!in) return;
+        fallback.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        bytes = reinterpret_cast<const unsigned char *>(fallback.data());
+        byte_count = fallback.size();
+        ok = true;
+#else
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return;
+
+        struct stat info;
+        if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+            auto address = ::mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address != MAP_FAILED) {
+                ::madvise(address, size_t(info.st_size), sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+                bytes = static_cast<const unsigned char *>(address);
+                byte_count = size_t(info.st_size);
+                ok = true;
+            }
+        }
+        ::close(fd);
+#endif
+    }
+
+    ~mapped_file() {
+#ifndef _WIN32
+        if (bytes)
+            ::munmap(const_cast<unsigned char *>(bytes), byte_count);
+#endif
+    }
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+
+    bool is_open() const { return ok; }
+    const unsigned char *data() const { return bytes; }
+    size_t size() const { return byte_count; }
+
+private:
+    const unsigned char *bytes = nullptr;
+    size_t byte_count = 0;
+    bool ok = false;
+#ifdef _WIN32
+    std::vector<char> fallback;
+#endif
+};
+
+class float_image {
+    // Linear RGB radiance as interleaved floats, rows from top to bottom.
+
+public:
+    int width = 0, height = 0;
+    std::vector<float> pixels;
+
+    float_image() {}
+    float_image(int width, int height) :
+        width(width), height(height), pixels(size_t(width) * height * 3, 0.0f) {
+    }
+
+    const float *at(int i, int j) const { return &pixels[(size_t(j) * width + i) * 3]; }
+    float *at(int i, int j) { return &pixels[(size_t(j) * width + i) * 3]; }
+};
+
+class image_reader {
+    // Reads the images written by image_encoder.h that keep enough precision to compare:
+    // ASCII (P3) and binary (P6) PPM, and PFM. PPM bytes are decoded with the inverse of the
+    // gamma 2 transform of color_to_bytes, so every image comes back as linear radiance.
+
+public:
+    static bool read(const std::string &filename, float_image &image, std::string &error) {
+        mapped_file file(filename);
+        if (!file.is_open()) {
+            error = "could not read '" + filename + "'";
+            return false;
+        }
+
+        image_reader reader(file.data(), file.size());
+        if (!reader.parse(image)) {
+            error = "'" + filename + "': " + reader.error;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    const unsigned char *next;
+    const unsigned char *end;
+    std::string error;
+
+    image_reader(const unsigned char *data, size_t size) : next(data), end(data + size) {}
+
+    bool fail(const char *message) {
+        error = message;
+        return false;
+    }
+
+    bool parse(float_image &image) {
+        if (end - next < 2 || (next[0] != 'P'))
+            return fail("not a PPM or PFM file");
+
+        auto kind = next[1];
+        next += 2;
+        if (kind != '3' && kind != '6' && kind != 'F')
+            return fail("unsupported format (expected P3, P6 or PF)");
+
+        long width, height;
+        if (!read_integer(width) || !read_integer(height) || width <= 0 || height <= 0)
+            return fail("bad image size");
+
+        // The raster has to fit in the rest of the file before the image is allocated. A
+        // sample takes 4 bytes in a PFM and at least 1 in a PPM.
+        auto samples = size_t(end - next) / (kind == 'F' ? 4 : 1);
+        if (size_t(width) > samples / 3 / size_t(height))
+            return fail("image size exceeds the file");
+
+        image = float_image(int(width), int(height));
+
+        if (kind == 'F')
+            return parse_pfm(image);
+
+        long max_value;
+        if (!read_integer(max_value) || max_value <= 0 || max_value > 255)
+            return fail("bad maximum value (only 8-bit PPM is supported)");
+
+        // The byte to linear table inverts the gamma 2 encoding.
+        float decode[256];
+        for (int n = 0; n < 256; n++) {
+            auto gamma = float(n) / float(max_value);
+            decode[n] = gamma * gamma;
+        }
+
+        auto count = image.pixels.size();
+        if (kind == '6') {
+            // A single whitespace byte separates the header from the raster.
+            next++;
+            if (next > end || size_t(end - next) < count)
+                return fail("truncated raster");
+            for (size_t n = 0; n < count; n++)
+                image.pixels[n] = decode[next[n]];
+            return true;
+        }
+
+        for (size_t n = 0; n < count; n++) {
+            long value;
+            if (!read_integer(value) || value > max_value)
+                return fail("truncated or corrupt raster");
+            image.pixels[n] = decode[value];
+        }
+        return true;
+    }
+
+    bool parse_pfm(float_image &image) {
+        // The scale factor is negative for little-endian data. PFM rows run bottom to top.
+        auto start = next;
+        skip_space();
+        while (next < end && !is_space(*next)) next++;
+        auto scale = std::strtod(std::string(start, next).c_str(), nullptr);
+        if (scale == 0)
+            return fail("bad scale factor");
+        next++;
+
+        auto row_floats = size_t(image.width) * 3;
+        if (next > end || size_t(end - next) < row_floats * image.height * sizeof(float))
+            return fail("truncated raster");
+
+        bool swap = (scale > 0) != host_is_big_endian();
+        for (int j = 0; j < image.height; j++) {
+            auto source = next + (size_t(image.height - 1 - j) * row_floats) * sizeof(float);
+            auto destination = image.at(0, j);
+            for (size_t n = 0; n < row_floats; n++) {
+                uint32_t bits;
+                std::memcpy(&bits, source + n * 4, 4);
+                if (swap)
+                    bits = (bits >> 24) | ((bits >> 8) & 0xff00) | ((bits << 8) & 0xff0000) | (bits << 24);
+                std::memcpy(&destination[n], &bits, 4);
+            }
+        }
+        return true;
+    }
+
+    static bool host_is_big_endian() {
+        uint32_t one = 1;
+        unsigned char first;
+        std::memcpy(&first, &one, 1);
+        return first == 0;
+    }
+
+    static bool is_space(unsigned char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    void skip_space() {
+        // Skips whitespace and '#' comments.
+        while (next < end) {
+            if (*next == '#') {
+                while (next < end && *next != '\n') next++;
+            } else if (is_space(*next)) {
+                next++;
+            } else {
+                break;
+            }
+        }
+    }
+
+    bool read_integer(long &value) {
+        skip_space();
+        if (next >= end || *next < '0' || *next > '9')
+            return false;
+
+        value = 0;
+        while (next < end && *next >= '0' && *next <= '9') {
+            value = value * 10 + (*next - '0');
+            if (value > 1000000000L) return false;
+            next++;
+        }
+        return true;
+    }
+};
+
+#endif
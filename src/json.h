@@ -0,0 +1,310 @@
+#ifndef JSON_H
+#define JSON_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+class json_value {
+    // A parsed JSON value. Objects keep their members in file order.
+
+public:
+    enum class type { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT };
+
+    type kind = type::NUL;
+    bool boolean = false;
+    double number = 0;
+    std::string string;
+    std::vector<json_value> array;
+    std::vector<std::pair<std::string, json_value>> object;
+    int line = 0; // Line of the value in the source text, for error messages
+
+    bool is_null() const { return kind == type::NUL; }
+    bool is_boolean() const { return kind == type::BOOLEAN; }
+    bool is_number() const { return kind == type::NUMBER; }
+    bool is_string() const { return kind == type::STRING; }
+    bool is_array() const { return kind == type::ARRAY; }
+    bool is_object() const { return kind == type::OBJECT; }
+
+    const json_value *find(const std::string &key) const {
+        // Returns the member of an object with the given key, or null if there is none.
+        for (const auto &member : object)
+            if (member.first == key)
+                return &member.second;
+        return nullptr;
+    }
+};
+
+class json_parser {
+    // Parses JSON text (RFC 8259). Strings are kept as UTF-8; \u escapes are decoded,
+    // including surrogate pairs.
+
+public:
+    static bool parse(const std::string &text, json_value &value, std::string &error) {
+        json_parser parser(text);
+        parser.skip_space();
+        if (!parser.parse_value(value, 0) || !parser.expect_end()) {
+            error = "line " + std::to_string(parser.line) + ": " + parser.error;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static const int max_depth = 256; // Nesting limit, so that bad input cannot overflow the stack
+
+    const char *next;
+    const char *end;
+    int line = 1;
+    std::string error;
+
+    explicit json_parser(const std::string &text) : next(text.data()), end(text.data() + text.size()) {}
+
+    bool fail(const std::string &message) {
+        error = message;
+        return false;
+    }
+
+    void skip_space() {
+        while (next < end && (*next == ' ' || *next == '\t' || *next == '\n' || *next == '\r')) {
+            if (*next == '\n')
+                line++;
+            next++;
+        }
+    }
+
+    bool expect_end() {
+        skip_space();
+        return next == end || fail("unexpected text after the value");
+    }
+
+    bool literal(const char *word) {
+        auto length = std::char_traits<char>::length(word);
+        if (size_t(end - next) < length || std::string(next, length) != word)
+            return false;
+        next += length;
+        return true;
+    }
+
+    bool parse_value(json_value &value, int depth) {
+        // Parses the value at the cursor, which is past any leading whitespace.
+        if (depth > max_depth)
+            return fail("values nested too deeply");
+        if (next >= end)
+            return fail("unexpected end of text");
+
+        value.line = line;
+        switch (*next) {
+            case '{': return parse_object(value, depth);
+            case '[': return parse_array(value, depth);
+            case '"':
+                value.kind = json_value::type::STRING;
+                return parse_string(value.string);
+        }
+
+        if (literal("true")) {
+            value.kind = json_value::type::BOOLEAN;
+            value.boolean = true;
+            return true;
+        }
+        if (literal("false")) {
+            value.kind = json_value::type::BOOLEAN;
+            return true;
+        }
+        if (literal("null"))
+            return true;
+        return parse_number(value);
+    }
+
+    bool parse_object(json_value &value, int depth) {
+        value.kind = json_value::type::OBJECT;
+        next++;
+        skip_space();
+        if (next < end && *next == '}') {
+            next++;
+            return true;
+        }
+
+        while (true) {
+            std::string key;
+            if (next >= end || *next != '"')
+                return fail("expected a member name");
+            if (!parse_string(key))
+                return false;
+
+            skip_space();
+            if (next >= end || *next != ':')
+                return fail("expected ':' after member name \"" + key + "\"");
+            next++;
+            skip_space();
+
+            value.object.emplace_back(key, json_value());
+            if (!parse_value(value.object.back().second, depth + 1))
+                return false;
+
+            skip_space();
+            if (next < end && *next == ',') {
+                next++;
+                skip_space();
+                continue;
+            }
+            if (next < end && *next == '}') {
+                next++;
+                return true;
+            }
+            return fail("expected ',' or '}' in object");
+        }
+    }
+
+    bool parse_array(json_value &value, int depth) {
+        value.kind = json_value::type::ARRAY;
+        next++;
+        skip_space();
+        if (next < end && *next == ']') {
+            next++;
+            return true;
+        }
+
+        while (true) {
+            value.array.emplace_back();
+            if (!parse_value(value.array.back(), depth + 1))
+                return false;
+
+            skip_space();
+            if (next < end && *next == ',') {
+                next++;
+                skip_space();
+                continue;
+            }
+            if (next < end && *next == ']') {
+                next++;
+                return true;
+            }
+            return fail("expected ',' or ']' in array");
+        }
+    }
+
+    bool parse_number(json_value &value) {
+        // Checks the JSON number grammar, then converts with strtod.
+        auto start = next;
+        if (next < end && *next == '-') next++;
+        if (next >= end || *next < '0' || *next > '9')
+            return fail("unexpected character '" + std::string(1, *start) + "'");
+        auto digits = [this] { while (next < end && *next >= '0' && *next <= '9') next++; };
+        if (*next == '0') next++;
+        else digits();
+        if (next < end && *next == '.') {
+            next++;
+            if (next >= end || *next < '0' || *next > '9')
+                return fail("expected digits after '.'");
+            digits();
+        }
+        if (next < end && (*next == 'e' || *next == 'E')) {
+            next++;
+            if (next < end && (*next == '+' || *next == '-')) next++;
+            if (next >= end || *next < '0' || *next > '9')
+                return fail("expected digits in exponent");
+            digits();
+        }
+
+        value.kind = json_value::type::NUMBER;
+        value.number = std::strtod(std::string(start, next).c_str(), nullptr);
+        return true;
+    }
+
+    bool parse_hex4(unsigned &code) {
+        if (end - next < 4)
+            return fail("truncated \\u escape");
+        code = 0;
+        for (int n = 0; n < 4; n++) {
+            char c = *next++;
+            code <<= 4;
+            if (c >= '0' && c <= '9') code |= unsigned(c - '0');
+            else if (c >= 'a' && c <= 'f') code |= unsigned(c - 'a' + 10);
+            else if (c >= 'A' && c <= 'F') code |= unsigned(c - 'A' + 10);
+            else return fail("bad \\u escape");
+        }
+        return true;
+    }
+
+    static void append_utf8(std::string &out, unsigned code) {
+        if (code < 0x80) {
+            out += char(code);
+        } else if (code < 0x800) {
+            out += char(0xc0 | (code >> 6));
+            out += char(0x80 | (code & 0x3f));
+        } else if (code < 0x10000) {
+            out += char(0xe0 | (code >> 12));
+            out += char(0x80 | ((code >> 6) & 0x3f));
+            out += char(0x80 | (code & 0x3f));
+        } else {
+            out += char(0xf0 | (code >> 18));
+            out += char(0x80 | ((code >> 12) & 0x3f));
+            out += char(0x80 | ((code >> 6) & 0x3f));
+            out += char(0x80 | (code & 0x3f));
+        }
+    }
+
+    bool parse_string(std::string &out) {
+        next++; // Opening quote
+        while (true) {
+            if (next >= end)
+                return fail("unterminated string");
+            char c = *next++;
+            if (c == '"')
+                return true;
+            if (static_cast<unsigned char>(c) < 0x20)
+                return fail("control character in string");
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+
+            if (next >= end)
+                return fail("unterminated string");
+            switch (*next++) {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    unsigned code;
+                    if (!parse_hex4(code))
+                        return false;
+                    if (code >= 0xd800 && code < 0xdc00) {
+                        unsigned low;
+                        if (end - next < 2 || next[0] != '\\' || next[1] != 'u')
+                            return fail("unpaired surrogate in \\u escape");
+                        next += 2;
+                        if (!parse_hex4(low))
+                            return false;
+                        if (low < 0xdc00 || low >= 0xe000)
+                            return fail("unpaired surrogate in \\u escape");
+                        code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                    } else if (code >= 0xdc00 && code < 0xe000) {
+                        return fail("unpaired surrogate in \\u escape");
+                    }
+                    append_utf8(out, code);
+                    break;
+                }
+                default:
+                    return fail("bad escape in string");
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef LIGHT_LIST_H
+#define LIGHT_LIST_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "alias_table.h"
+#include "hittable.h"
+
+#include <unordered_map>
+#include <vector>
+
+class light_list : public hittable, private memory_tracked<light_list, memory_category::LIGHTS> {
+    // A flat list of emitters, each selected with probability proportional to its emitted
+    // power (area times average radiance of its diffuse_light texture) through an alias table.
+    // Cheaper to build and sample than a light_tree, and a good fit for up to a few hundred
+    // lights where spatial importance matters less than raw brightness.
+    //
+    // A sample from random_emitter counts only for the light it was drawn from, so the density
+    // of a hit is that light's alone, found through a table from emitter_id to light index.
+
+public:
+    light_list(const hittable &world) {
+        // Extracts all primitives with an emissive material from the world.
+        std::vector<shared_ptr<hittable>> emitters;
+        world.collect_emitters(emitters);
+        build(emitters);
+    }
+
+    light_list(const std::vector<shared_ptr<hittable>> &emitters) {
+        build(emitters);
+    }
+
+    size_t size() const {
+        return lights.size();
+    }
+
+    double pmf(size_t index) const {
+        return table.pmf(index);
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+        return false;
+    }
+
+    aabb bounding_box() const override {
+        return bbox;
+    }
+
+    double pdf_value(const point3 &origin, const vec3 &direction) const override {
+        // Density of random, summed over the lights. Only lights whose bounds the direction
+        // passes through can contribute, so the exact solid angle density is skipped for the
+        // rest.
+        ray r(origin, direction);
+        auto sum = 0.0;
+
+        for (size_t i = 0; i < lights.size(); i++) {
+            if (bounds[i].hit(r, interval(0.001, infinity)))
+                sum += table.pmf(i) * lights[i]->pdf_value(origin, direction);
+        }
+
+        return sum;
+    }
+
+    double hit_pdf_value(const point3 &origin, const vec3 &direction, const hit_record *rec) const override {
+        if (!rec)
+            return 0;
+        auto light = index.find(rec->primitive_id);
+        if (light == index.end())
+            return 0;
+        return table.pmf(light->second) * lights[light->second]->pdf_value(origin, direction);
+    }
+
+    vec3 random(const point3 &origin) const override {
+        int emitter;
+        return random_emitter(origin, emitter);
+    }
+
+    vec3 random_emitter(const point3 &origin, int &emitter) const override {
+        emitter = -1;
+        if (lights.empty())
+            return vec3(1, 0, 0);
+        auto light = table.sample();
+        emitter = lights[light]->emitter_id();
+        return lights[light]->random(origin);
+    }
+
+private:
+    std::vector<shared_ptr<hittable>> lights;
+    std::vector<aabb> bounds;
+    std::unordered_map<int, size_t> index; // Light index by emitter_id
+    alias_table table;
+    aabb bbox;
+    memory_account storage{memory_category::LIGHTS}; // Bytes of the vectors and the table
+
+    void build(const std::vector<shared_ptr<hittable>> &emitters) {
+        std::vector<double> power;
+        for (const auto &emitter : emitters) {
+            light_bounds lb;
+            if (!emitter->emitter_bounds(lb))
+                continue;
+
+            index[emitter->emitter_id()] = lights.size();
+            lights.push_back(emitter);
+            bounds.push_back(lb.bounds);
+            power.push_back(lb.phi);
+            bbox = aabb(bbox, lb.bounds);
+        }
+
+        table = alias_table(power);
+        storage.resize(lights.capacity() * sizeof(lights[0]) + bounds.capacity() * sizeof(aabb)
+                       + index.size() * (sizeof(std::pair<const int, size_t>) + 2 * sizeof(void *))
+                       + index.bucket_count() * sizeof(void *) + table.storage_bytes());
+    }
+};
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef LIGHT_TREE_H
+#define LIGHT_TREE_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "hittable.h"
+
+#include <algorithm>
+#include <vector>
+
+class light_tree : public hittable, private memory_tracked<light_tree, memory_category::LIGHTS> {
+    // A bounding volume hierarchy over the emitters of a scene. Every node stores the light
+    // bounds (power, spatial bounds and orientation cone) of its subtree. A light is chosen by
+    // walking down from the root, picking each child with probability proportional to its
+    // estimated importance for the shading point.
+
+public:
+    light_tree(const hittable &world) {
+        // Extracts all primitives with an emissive material from the world.
+        world.collect_emitters(lights);
+        build();
+    }
+
+    light_tree(const std::vector<shared_ptr<hittable>> &emitters) :
+        lights(emitters) {
+        build();
+    }
+
+    size_t size() const {
+        return lights.size();
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+        return false;
+    }
+
+    aabb bounding_box() const override {
+        return nodes.empty() ? aabb::empty : nodes[0].lb.bounds;
+    }
+
+    double pdf_value(const point3 &origin, const vec3 &direction) const override {
+        // Sums the selection probability times the solid angle density of every light whose
+        // bounds the direction passes through, mirroring the traversal done by random().
+        if (nodes.empty())
+            return 0;
+
+        return pdf_value(0, ray(origin, direction), 1.0);
+    }
+
+    vec3 random(const point3 &origin) const override {
+        if (nodes.empty())
+            return vec3(1, 0, 0);
+
+        int index = 0;
+        while (!nodes[index].is_leaf) {
+            int left = index + 1;
+            int right = nodes[index].offset;
+            auto left_importance = nodes[left].lb.importance(origin);
+            auto right_importance = nodes[right].lb.importance(origin);
+            if (left_importance == 0 && right_importance == 0)
+                return vec3(1, 0, 0);
+
+            auto p_left = left_importance / (left_importance + right_importance);
+            index = (random_double() < p_left) ? left : right;
+        }
+
+        if (nodes[index].lb.importance(origin) == 0)
+            return vec3(1, 0, 0);
+
+        return lights[nodes[index].offset]->random(origin);
+    }
+
+private:
+    struct node {
+        light_bounds lb;
+        int offset;   // Light index for leaves, index of the second child for interior nodes
+        bool is_leaf;
+    };
+
+    std::vector<shared_ptr<hittable>> lights;
+    std::vector<node> nodes;
+    memory_account storage{memory_category::LIGHTS}; // Bytes of the vectors
+
+    struct build_item {
+        light_bounds lb;
+        int light_index;
+    };
+
+    void build() {
+        std::vector<build_item> items;
+        for (size_t i = 0; i < lights.size(); i++) {
+            build_item item;
+            if (lights[i]->emitter_bounds(item.lb)) {
+                item.light_index = int(i);
+                items.push_back(item);
+            }
+        }
+
+        nodes.clear();
+        if (!items.empty()) {
+            nodes.reserve(2 * items.size() - 1);
+            build(items, 0, items.size());
+        }
+        storage.resize(lights.capacity() * sizeof(lights[0]) + nodes.capacity() * sizeof(node));
+    }
+
+    int build(std::vector<build_item> &items, size_t start, size_t end) {
+        // Builds the subtree over items[start, end) in depth-first order, so that the first
+        // child of every interior node directly follows it. Returns the node index.
+
+        int index = int(nodes.size());
+        nodes.push_back(node());
+
+        if (end - start == 1) {
+            nodes[index].lb = items[start].lb;
+            nodes[index].offset = items[start].light_index;
+            nodes[index].is_leaf = true;
+            return index;
+        }
+
+        // Split at the median of the light centroids along the longest centroid axis.
+        aabb centroid_bounds = aabb::empty;
+        for (size_t i = start; i < end; i++) {
+            auto c = items[i].lb.centroid();
+            centroid_bounds = aabb(centroid_bounds, aabb(c, c));
+        }
+        int axis = centroid_bounds.longest_axis();
+
+        auto mid = start + (end - start) / 2;
+        std::nth_element(items.begin() + start, items.begin() + mid, items.begin() + end,
+                         [axis](const build_item &a, const build_item &b) {
+                             return a.lb.centroid()[axis] < b.lb.centroid()[axis];
+                         });
+
+        build(items, start, mid);
+        int right = build(items, mid, end);
+
+        nodes[index].lb = light_bounds(nodes[index + 1].lb, nodes[right].lb);
+        nodes[index].offset = right;
+        nodes[index].is_leaf = false;
+        return index;
+    }
+
+    double pdf_value(int index, const ray &r, double pmf) const {
+        const node &n = nodes[index];
+        if (!n.lb.bounds.hit(r, interval(0.001, infinity)))
+            return 0;
+
+        if (n.is_leaf) {
+            if (n.lb.importance(r.origin()) == 0)
+                return 0;
+            return pmf * lights[n.offset]->pdf_value(r.origin(), r.direction());
+        }
+
+        int left = index + 1;
+        int right = n.offset;
+        auto left_importance = nodes[left].lb.importance(r.origin());
+        auto right_importance = nodes[right].lb.importance(r.origin());
+        auto total = left_importance + right_importance;
+        if (total == 0)
+            return 0;
+
+        auto sum = 0.0;
+        if (left_importance > 0)
+            sum += pdf_value(left, r, pmf * left_importance / total);
+        if (right_importance > 0)
+            sum += pdf_value(right, r, pmf * right_importance / total);
+        return sum;
+    }
+};
+
+#endif
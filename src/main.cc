@@ -9,70 +9,129 @@
 // along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==============================================================================================
 
-#include "rtweekend.h"
-
-#include "camera.h"
-#include "hittable_list.h"
-#include "material.h"
-#include "quad.h"
-#include "sphere.h"
+// Renders a scene description file (see scene_loader.h) or a built-in scene:
+//
+//     path_tracer [SCENE] [--width N] [--height N] [--spp N] [--mode MODE] [--threads N]
+//                 [--output FILE] [--bundle FILE]
+//
+// SCENE is a .json file, a .rtwb scene bundle or the name of a built-in scene, cornell by
+// default. With --bundle, a .json scene is loaded through the given bundle file, which is
+// compiled first when it is missing or out of date (see scene_bundle.h). The options override
+// the settings of the scene; --height sets the aspect ratio. Without an output file, the image
+// goes to stdout as ASCII PPM.
 
-int main() {
-    hittable_list world;
+#include "rtweekend.h"
 
-    auto red = make_shared<lambertian>(color(.65, .05, .05));
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    auto green = make_shared<lambertian>(color(.12, .45, .15));
-    auto light = make_shared<diffuse_light>(color(15, 15, 15));
+#include "scene_bundle.h"
+#include "scene_loader.h"
+#include "scenes.h"
 
-    // Cornell box sides
-    world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 0, 555), vec3(0, 555, 0), green));
-    world.add(make_shared<quad>(point3(0, 0, 555), vec3(0, 0, -555), vec3(0, 555, 0), red));
-    world.add(make_shared<quad>(point3(0, 555, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
-    world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 0, -555), white));
-    world.add(make_shared<quad>(point3(555, 0, 555), vec3(-555, 0, 0), vec3(0, 555, 0), white));
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-    // Light
-    world.add(make_shared<quad>(point3(213, 554, 227), vec3(130, 0, 0), vec3(0, 0, 105), light));
+static int usage() {
+    std::cerr << "Usage: path_tracer [SCENE] [--width N] [--height N] [--spp N] [--mode MODE]\n"
+                 "                   [--threads N] [--output FILE] [--bundle FILE]\n"
+                 "SCENE is a .json scene file, a .rtwb scene bundle or one of:";
+    for (const auto &name : scene_names())
+        std::cerr << ' ' << name;
+    std::cerr << "\nMODE is one of: bsdf mixture nee mis cost\n";
+    return 2;
+}
 
-    // Box
-    auto white_phong = make_shared<phong>(color(.73, .73, .73), 30);
-    shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white_phong);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-    world.add(box1);
+static bool parse_mode(const std::string &name, camera::RenderMode &mode) {
+    if (name == "bsdf") mode = camera::RenderMode::BSDF_SAMPLING;
+    else if (name == "mixture") mode = camera::RenderMode::MIXTURE_SAMPLING;
+    else if (name == "nee") mode = camera::RenderMode::NEE;
+    else if (name == "mis") mode = camera::RenderMode::MIS;
+    else if (name == "cost") mode = camera::RenderMode::COST;
+    else return false;
+    return true;
+}
 
-    // Glass Sphere
-    //auto glass = make_shared<dielectric>(1.5);
-    //world.add(make_shared<sphere>(point3(190, 90, 190), 90, glass));
+int main(int argc, char *argv[]) {
+    std::string scene_name = "cornell";
+    int width = 0, height = 0, spp = 0, threads = 0;
+    std::string mode_name, output, bundle;
 
-    // Blue Phong Sphere
-    auto blue_phong = make_shared<phong>(color((double)30/255, (double)144/255, 1), 30);
-    world.add(make_shared<sphere>(point3(190, 90, 190), 90, blue_phong));
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg.compare(0, 2, "--") != 0) {
+            scene_name = arg;
+            continue;
+        }
+        if (a + 1 >= argc)
+            return usage();
+        std::string value = argv[++a];
 
-    // Light Sources
-    auto empty_material = shared_ptr<material>();
-    hittable_list lights;
-    lights.add(
-        make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), empty_material));
-    //lights.add(make_shared<sphere>(point3(190, 90, 190), 90, empty_material));
+        if (arg == "--width")
+            width = std::atoi(value.c_str());
+        else if (arg == "--height")
+            height = std::atoi(value.c_str());
+        else if (arg == "--spp")
+            spp = std::atoi(value.c_str());
+        else if (arg == "--mode")
+            mode_name = value;
+        else if (arg == "--threads")
+            threads = std::atoi(value.c_str());
+        else if (arg == "--output")
+            output = value;
+        else if (arg == "--bundle")
+            bundle = value;
+        else
+            return usage();
+    }
 
-    camera cam;
-    
-    cam.render_mode = camera::RenderMode::BSDF_SAMPLING; // Set the render mode
+    if (width < 0 || height < 0 || spp < 0 || threads < 0)
+        return usage();
 
-    cam.aspect_ratio = 1.0;
-    cam.image_width = 600;
-    cam.samples_per_pixel = 150;
-    cam.max_depth = 50;
-    cam.background = color(0, 0, 0);
+#ifdef _OPENMP
+    if (threads > 0)
+        omp_set_num_threads(threads);
+#endif
 
-    cam.vfov = 40;
-    cam.lookfrom = point3(278, 278, -800);
-    cam.lookat = point3(278, 278, 0);
-    cam.vup = vec3(0, 1, 0);
+    scene s;
+    auto extension = scene_name.substr(std::min(scene_name.size(), scene_name.rfind('.')));
+    if (!bundle.empty() && extension != ".json") {
+        std::cerr << "ERROR: --bundle needs a .json scene.\n";
+        return usage();
+    }
+    if (extension == ".json" || extension == ".rtwb") {
+        std::string error;
+        bool loaded = extension == ".rtwb" ? scene_bundle::load(scene_name, s, error)
+                    : !bundle.empty()      ? scene_bundle::load_cached(scene_name, bundle, s, error)
+                                           : scene_loader::load(scene_name, s, error);
+        if (!loaded) {
+            std::cerr << "ERROR: " << error << '\n';
+            return 1;
+        }
+    } else if (make_scene(scene_name, s)) {
+        // Built-in scenes leave the image size and sampling to the caller.
+        s.cam.render_mode = camera::RenderMode::BSDF_SAMPLING;
+        s.cam.image_width = 600;
+        s.cam.samples_per_pixel = 150;
+        s.cam.scene_hash = bundle_hash(scene_name.data(), scene_name.size());
+    } else {
+        std::cerr << "ERROR: Unknown scene '" << scene_name << "'.\n";
+        return usage();
+    }
 
-    cam.defocus_angle = 0;
+    auto &cam = s.cam;
+    if (width > 0)
+        cam.image_width = width;
+    if (height > 0) {
+        // The camera rounds the height down, so the ratio must not come out a hair too large.
+        cam.aspect_ratio = double(cam.image_width) / height;
+        if (int(cam.image_width / cam.aspect_ratio) < height)
+            cam.aspect_ratio = std::nextafter(cam.aspect_ratio, 0.0);
+    }
+    if (spp > 0)
+        cam.samples_per_pixel = spp;
+    if (!mode_name.empty() && !parse_mode(mode_name, cam.render_mode))
+        return usage();
+    cam.output_file = output;
 
-    cam.render(world, lights);
+    // Light sources are extracted from the diffuse_light materials in the world.
+    return cam.render(s.world) ? 0 : 1;
 }
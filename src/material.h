@@ -33,6 +33,7 @@ public:
     }
 
     virtual bool scatter(const ray &r_in, const hit_record &rec, scatter_record &srec) const {
+        count_stat(stat_counter::SCATTER_EMITTER);
         return false;
     }
 
@@ -40,9 +41,14 @@ public:
         const {
         return 0;
     }
+
+    virtual color average_emission() const {
+        // Mean radiance leaving the front face of an emissive material.
+        return color(0, 0, 0);
+    }
 };
 
-class lambertian : public material {
+class lambertian : public material, private memory_tracked<lambertian, memory_category::MATERIALS> {
 public:
     lambertian(const color &albedo) :
         tex(make_shared<solid_color>(albedo)) {
@@ -52,6 +58,7 @@ public:
     }
 
     bool scatter(const ray &r_in, const hit_record &rec, scatter_record &srec) const override {
+        count_stat(stat_counter::SCATTER_LAMBERTIAN);
         srec.attenuation = tex->value(rec.u, rec.v, rec.p);
         srec.pdf_ptr = make_shared<cosine_pdf>(rec.normal);
         srec.skip_pdf = false;
@@ -68,17 +75,18 @@ private:
     shared_ptr<texture> tex;
 };
 
-class phong : public material {
+class phong : public material, private memory_tracked<phong, memory_category::MATERIALS> {
 public:
     phong(const color &albedo, const double alpha = 1.0) :
         alpha(alpha),
         tex(make_shared<solid_color>(albedo)) {
     }
-    phong(shared_ptr<texture> tex) :
-        tex(tex) {
+    phong(shared_ptr<texture> tex, const double alpha = 1.0) :
+        tex(tex), alpha(alpha) {
     }
 
     bool scatter(const ray &r_in, const hit_record &rec, scatter_record &srec) const override {
+        count_stat(stat_counter::SCATTER_PHONG);
         srec.attenuation = tex->value(rec.u, rec.v, rec.p);
         auto reflected = reflect(unit_vector(r_in.direction()), rec.normal);
         srec.pdf_ptr = make_shared<phong_pdf>(reflected, alpha, rec.normal);
@@ -105,13 +113,14 @@ private:
     double alpha = 1.0; // Phong exponent, can be adjusted for shininess
 };
 
-class metal : public material {
+class metal : public material, private memory_tracked<metal, memory_category::MATERIALS> {
 public:
     metal(const color &albedo, double fuzz) :
         albedo(albedo), fuzz(fuzz < 1 ? fuzz : 1) {
     }
 
     bool scatter(const ray &r_in, const hit_record &rec, scatter_record &srec) const override {
+        count_stat(stat_counter::SCATTER_METAL);
         vec3 reflected = reflect(r_in.direction(), rec.normal);
         reflected = unit_vector(reflected) + (fuzz * random_unit_vector());
 
@@ -128,13 +137,14 @@ private:
     double fuzz;
 };
 
-class dielectric : public material {
+class dielectric : public material, private memory_tracked<dielectric, memory_category::MATERIALS> {
 public:
     dielectric(double refraction_index) :
         refraction_index(refraction_index) {
     }
 
     bool scatter(const ray &r_in, const hit_record &rec, scatter_record &srec) const override {
+        count_stat(stat_counter::SCATTER_DIELECTRIC);
         srec.attenuation = color(1.0, 1.0, 1.0);
         srec.pdf_ptr = nullptr;
         srec.skip_pdf = true;
@@ -169,7 +179,7 @@ private:
     }
 };
 
-class diffuse_light : public material {
+class diffuse_light : public material, private memory_tracked<diffuse_light, memory_category::MATERIALS> {
 public:
     diffuse_light(shared_ptr<texture> tex) :
         tex(tex) {
@@ -185,11 +195,15 @@ public:
         return tex->value(u, v, p);
     }
 
+    color average_emission() const override {
+        return tex->average();
+    }
+
 private:
     shared_ptr<texture> tex;
 };
 
-class isotropic : public material {
+class isotropic : public material, private memory_tracked<isotropic, memory_category::MATERIALS> {
 public:
     isotropic(const color &albedo) :
         tex(make_shared<solid_color>(albedo)) {
@@ -199,6 +213,7 @@ public:
     }
 
     bool scatter(const ray &r_in, const hit_record &rec, scatter_record &srec) const override {
+        count_stat(stat_counter::SCATTER_ISOTROPIC);
         srec.attenuation = tex->value(rec.u, rec.v, rec.p);
         srec.pdf_ptr = make_shared<sphere_pdf>();
         srec.skip_pdf = false;
@@ -0,0 +1,175 @@
+#ifndef MEMORY_STATS_H
+#define MEMORY_STATS_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+// Byte accounting by subsystem. Objects count their own size for their lifetime by deriving
+// from memory_tracked, and buffers count theirs with a memory_account member. The totals are
+// the bytes of the objects and buffers themselves, without allocator overhead.
+
+enum class memory_category {
+    GEOMETRY,     // Primitives, instances and lists of objects
+    BVH,          // BVH nodes
+    TEXTURES,     // Texture objects and image pixels
+    MATERIALS,    // Material objects
+    LIGHTS,       // Light sampling structures
+    FRAMEBUFFERS, // Image channels and accumulation buffers
+    SCRATCH,      // Per-thread tile buffers and render and denoiser working sets
+    COUNT
+};
+
+inline const char *memory_category_name(memory_category c) {
+    static const char *names[int(memory_category::COUNT)] = {
+        "geometry", "bvh", "textures", "materials", "lights", "framebuffers", "scratch"
+    };
+    return names[int(c)];
+}
+
+class memory_tracker {
+public:
+    static memory_tracker &instance() {
+        static memory_tracker tracker;
+        return tracker;
+    }
+
+    void allocate(memory_category c, size_t bytes) {
+        if (bytes == 0)
+            return;
+        auto n = int64_t(bytes);
+        raise(peaks[int(c)], current[int(c)].fetch_add(n, std::memory_order_relaxed) + n);
+        raise(total_peak, total.fetch_add(n, std::memory_order_relaxed) + n);
+    }
+
+    void release(memory_category c, size_t bytes) {
+        current[int(c)].fetch_sub(int64_t(bytes), std::memory_order_relaxed);
+        total.fetch_sub(int64_t(bytes), std::memory_order_relaxed);
+    }
+
+    int64_t bytes(memory_category c) const { return current[int(c)].load(); }
+    int64_t peak_bytes(memory_category c) const { return peaks[int(c)].load(); }
+    int64_t total_bytes() const { return total.load(); }
+    int64_t total_peak_bytes() const { return total_peak.load(); }
+
+private:
+    std::atomic<int64_t> current[int(memory_category::COUNT)];
+    std::atomic<int64_t> peaks[int(memory_category::COUNT)];
+    std::atomic<int64_t> total;
+    std::atomic<int64_t> total_peak;
+
+    memory_tracker() : total(0), total_peak(0) {
+        for (int c = 0; c < int(memory_category::COUNT); c++) {
+            current[c].store(0);
+            peaks[c].store(0);
+        }
+    }
+
+    static void raise(std::atomic<int64_t> &peak, int64_t value) {
+        auto seen = peak.load(std::memory_order_relaxed);
+        while (value > seen && !peak.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+        }
+    }
+};
+
+class memory_account {
+    // A number of bytes counted in a category for as long as the account exists. Copies count
+    // the bytes again; moves take them over.
+
+public:
+    explicit memory_account(memory_category category, size_t bytes = 0) :
+        category(category), count(bytes) {
+        memory_tracker::instance().allocate(category, count);
+    }
+
+    memory_account(const memory_account &other) : memory_account(other.category, other.count) {}
+
+    memory_account(memory_account &&other) : category(other.category), count(other.count) {
+        other.count = 0;
+    }
+
+    memory_account &operator=(const memory_account &other) {
+        if (this != &other) {
+            memory_tracker::instance().release(category, count);
+            category = other.category;
+            count = other.count;
+            memory_tracker::instance().allocate(category, count);
+        }
+        return *this;
+    }
+
+    memory_account &operator=(memory_account &&other) {
+        if (this != &other) {
+            memory_tracker::instance().release(category, count);
+            category = other.category;
+            count = other.count;
+            other.count = 0;
+        }
+        return *this;
+    }
+
+    ~memory_account() {
+        memory_tracker::instance().release(category, count);
+    }
+
+    void resize(size_t bytes) {
+        memory_tracker::instance().release(category, count);
+        count = bytes;
+        memory_tracker::instance().allocate(category, count);
+    }
+
+    size_t size() const { return count; }
+
+private:
+    memory_category category;
+    size_t count;
+};
+
+template <typename T, memory_category Category>
+class memory_tracked {
+    // Base that counts sizeof(T) in Category for every live T. It holds no data, so it adds
+    // nothing to the size of T.
+
+protected:
+    memory_tracked() {
+        memory_tracker::instance().allocate(Category, sizeof(T));
+    }
+
+    memory_tracked(const memory_tracked &) : memory_tracked() {}
+
+    memory_tracked &operator=(const memory_tracked &) { return *this; }
+
+    ~memory_tracked() {
+        memory_tracker::instance().release(Category, sizeof(T));
+    }
+};
+
+inline int64_t peak_resident_bytes() {
+    // The peak resident set size of the process, or 0 where it is not known.
+#if defined(__unix__) || defined(__APPLE__)
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return int64_t(usage.ru_maxrss);
+#else
+    return int64_t(usage.ru_maxrss) * 1024;
+#endif
+#else
+    return 0;
+#endif
+}
+
+#endif
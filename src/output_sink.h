@@ -0,0 +1,203 @@
+#ifndef OUTPUT_SINK_H
+#define OUTPUT_SINK_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "framebuffer.h"
+#include "image_encoder.h"
+#include "trace.h"
+
+struct image_tile {
+    // A rectangle of finished pixels, row-major, with its upper left corner at x, y.
+    int x, y;
+    int width, height;
+    std::vector<color> pixels;
+};
+
+class output_sink {
+    // Writes the image as render threads finish tiles. Tiles are handed over to a dedicated
+    // I/O thread, so renderers only wait for a queue lock, never for output. Rows go to the
+    // encoder in order as soon as every tile covering them has arrived, and only the rows
+    // that are still incomplete are held.
+    //
+    // Every tile can also be sent to a preview stream (a file or named pipe) as it arrives:
+    // four little-endian int32 values x, y, width, height, followed by width * height RGB
+    // triples of linear radiance as float32.
+
+public:
+    output_sink(
+        shared_ptr<image_encoder> encoder, int image_width, int image_height,
+        const std::string &preview_path = ""
+    ) :
+        encoder(encoder), image_width(image_width), image_height(image_height),
+        rows(image_height), remaining(image_height, image_width), start(std::chrono::steady_clock::now())
+    {
+        if (!preview_path.empty()) {
+            preview.open(preview_path, std::ios::binary);
+            if (!preview)
+                std::cerr << "ERROR: Could not open preview stream '" << preview_path << "'.\n";
+        }
+
+        worker = std::thread([this] { run(); });
+    }
+
+    ~output_sink() {
+        finish();
+    }
+
+    void submit(image_tile tile) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(tile));
+        }
+        ready.notify_one();
+    }
+
+    void submit_image(const framebuffer &fb) {
+        // Submits the radiance of a finished image one row at a time.
+        for (int j = 0; j < image_height; j++) {
+            image_tile tile = {0, j, image_width, 1, std::vector<color>(image_width)};
+            for (int i = 0; i < image_width; i++)
+                tile.pixels[i] = fb.get_color(framebuffer::RADIANCE, i, j);
+            submit(std::move(tile));
+        }
+    }
+
+    void finish() {
+        // Waits until everything submitted has been written.
+        if (!worker.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done = true;
+        }
+        ready.notify_one();
+        worker.join();
+    }
+
+    bool succeeded() const {
+        // Whether the whole image was written, once finished.
+        return written;
+    }
+
+    double time_to_first_row() const {
+        // Seconds from construction until the first image row was written, or -1.
+        return first_row_seconds;
+    }
+
+private:
+    shared_ptr<image_encoder> encoder;
+    std::ofstream preview;
+    int image_width, image_height;
+
+    std::vector<std::vector<color>> rows; // Rows that have received some but not all pixels
+    std::vector<int> remaining;           // Pixels each row is still waiting for
+    int next_row = 0;                     // First row not yet written
+
+    std::chrono::steady_clock::time_point start;
+    double first_row_seconds = -1;
+    bool written = false;
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<image_tile> queue;
+    bool done = false;
+    std::thread worker;
+
+    void run() {
+        trace_recorder::name_thread("output");
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            ready.wait(lock, [this] { return done || !queue.empty(); });
+            if (queue.empty())
+                break;
+
+            auto tile = std::move(queue.front());
+            queue.pop_front();
+
+            // Encode without holding the lock, so renderers can keep submitting.
+            lock.unlock();
+            {
+                trace_span span("encode tile", tile.y);
+                write_preview(tile);
+                add_tile(tile);
+            }
+            lock.lock();
+        }
+
+        written = encoder && next_row == image_height && encoder->finish();
+    }
+
+    void add_tile(const image_tile &tile) {
+        for (int j = 0; j < tile.height; j++) {
+            auto &row = rows[tile.y + j];
+            if (row.empty())
+                row.resize(image_width);
+
+            auto first = tile.pixels.begin() + size_t(j) * tile.width;
+            std::copy(first, first + tile.width, row.begin() + tile.x);
+            remaining[tile.y + j] -= tile.width;
+        }
+
+        while (next_row < image_height && remaining[next_row] <= 0) {
+            if (encoder)
+                encoder->write_row(next_row, rows[next_row].data());
+            std::vector<color>().swap(rows[next_row]);
+
+            if (first_row_seconds < 0) {
+                first_row_seconds =
+                    std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            }
+            next_row++;
+        }
+    }
+
+    void write_preview(const image_tile &tile) {
+        if (!preview.is_open() || !preview)
+            return;
+
+        int32_t header[4] = {tile.x, tile.y, tile.width, tile.height};
+        write_le(header, 4);
+
+        std::vector<float> data;
+        data.reserve(tile.pixels.size() * 3);
+        for (const auto &pixel : tile.pixels) {
+            data.push_back(float(pixel.x()));
+            data.push_back(float(pixel.y()));
+            data.push_back(float(pixel.z()));
+        }
+        write_le(data.data(), data.size());
+        preview.flush();
+    }
+
+    template <typename T>
+    void write_le(const T *values, size_t count) {
+        // Writes 32-bit values in little-endian byte order.
+        for (size_t n = 0; n < count; n++) {
+            uint32_t bits;
+            std::memcpy(&bits, &values[n], 4);
+            char bytes[4] = {char(bits), char(bits >> 8), char(bits >> 16), char(bits >> 24)};
+            preview.write(bytes, 4);
+        }
+    }
+};
+
+#endif
@@ -21,6 +21,13 @@ public:
 
     virtual double value(const vec3 &direction) const = 0;
     virtual vec3 generate() const = 0;
+
+    virtual vec3 generate_emitter(int &emitter) const {
+        // As generate, also giving the emitter a light sample was drawn towards, if any (see
+        // hittable::random_emitter).
+        emitter = -1;
+        return generate();
+    }
 };
 
 class sphere_pdf : public pdf {
@@ -104,6 +111,10 @@ public:
         return objects.random(origin);
     }
 
+    vec3 generate_emitter(int &emitter) const override {
+        return objects.random_emitter(origin, emitter);
+    }
+
 private:
     const hittable &objects;
     point3 origin;
@@ -127,6 +138,13 @@ public:
             return p[1]->generate();
     }
 
+    vec3 generate_emitter(int &emitter) const override {
+        if (random_double() < 0.5)
+            return p[0]->generate_emitter(emitter);
+        else
+            return p[1]->generate_emitter(emitter);
+    }
+
 private:
     shared_ptr<pdf> p[2];
 };
@@ -0,0 +1,425 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware performance counters per render phase, from Linux perf_event_open. Every thread
+// counts its own user-space events. Where the kernel or the machine (a virtual machine, say)
+// offers no hardware counters, only the thread CPU time is counted, and on other systems
+// nothing is.
+
+enum class perf_event_kind {
+    TASK_CLOCK,    // Thread CPU time in nanoseconds, a software event
+    CYCLES,
+    INSTRUCTIONS,
+    L1D_MISSES,    // L1 data cache read misses
+    LLC_MISSES,    // Last level cache misses
+    BRANCH_MISSES,
+    COUNT
+};
+
+enum class perf_phase {
+    BUILD,         // Scene and light structure builds
+    RENDER,        // Each thread's share of the render loops
+    SAMPLED_PATHS, // The camera paths that are split into traversal and shading
+    TRAVERSAL,     // Ray intersection within the sampled paths
+    COUNT
+};
+
+struct perf_sample {
+    uint64_t values[int(perf_event_kind::COUNT)] = {};
+
+    uint64_t operator[](perf_event_kind e) const { return values[int(e)]; }
+
+    double ipc() const {
+        // Instructions per cycle.
+        auto cycles = values[int(perf_event_kind::CYCLES)];
+        return cycles ? double(values[int(perf_event_kind::INSTRUCTIONS)]) / cycles : 0.0;
+    }
+
+    void add_difference(const perf_sample &end, const perf_sample &start) {
+        // Scaled counts are estimates that may step back a little; such a step counts as 0.
+        for (int e = 0; e < int(perf_event_kind::COUNT); e++)
+            values[e] += end.values[e] - std::min(end.values[e], start.values[e]);
+    }
+
+    void merge(const perf_sample &other) {
+        for (int e = 0; e < int(perf_event_kind::COUNT); e++)
+            values[e] += other.values[e];
+    }
+};
+
+class perf_group {
+    // The counters of the calling thread, opened as one group so that they are read together
+    // with one system call. The task clock leads, so that the group opens wherever the
+    // hardware events do not.
+
+public:
+    perf_group() {
+        for (auto &fd : fds)
+            fd = -1;
+    }
+
+    ~perf_group() {
+#ifdef __linux__
+        for (auto fd : fds)
+            if (fd >= 0)
+                close(fd);
+#endif
+    }
+
+    perf_group(const perf_group &) = delete;
+    perf_group &operator=(const perf_group &) = delete;
+
+    bool open(std::string &error) {
+        // Opens the counters. Returns false if not even the task clock is available; hardware
+        // events that cannot be opened are left out.
+#ifdef __linux__
+        for (int e = 0; e < int(perf_event_kind::COUNT); e++) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof attr);
+            attr.size = sizeof attr;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID
+                             | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            if (!describe(perf_event_kind(e), attr))
+                continue;
+
+            auto leader = fds[0];
+            fds[e] = int(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+            if (fds[e] < 0) {
+                if (e == 0) {
+                    error = std::strerror(errno);
+                    return false;
+                }
+                if (error.empty())
+                    error = std::strerror(errno);
+                continue;
+            }
+            ioctl_id(e);
+        }
+        return true;
+#else
+        error = "perf_event_open is Linux only";
+        return false;
+#endif
+    }
+
+    bool available(perf_event_kind e) const {
+        return fds[int(e)] >= 0;
+    }
+
+    bool read(perf_sample &sample) const {
+        // Reads every open counter; the others read as zero. When the kernel multiplexes more
+        // events than the machine has counters, the group only counts part of the time, and
+        // its counts are scaled up to the whole time it was enabled.
+#ifdef __linux__
+        uint64_t buffer[3 + 2 * int(perf_event_kind::COUNT)];
+        auto bytes = ::read(fds[0], buffer, sizeof buffer);
+        if (bytes < 24)
+            return false;
+
+        // The group reads as the number of events, the times enabled and running, then a
+        // value and id pair per event.
+        auto count = std::min<uint64_t>(buffer[0], (uint64_t(bytes) / 8 - 3) / 2);
+        auto enabled = buffer[1];
+        auto running = buffer[2];
+        auto scale = running > 0 && running < enabled ? double(enabled) / running : 1.0;
+        for (uint64_t n = 0; n < count; n++) {
+            for (int e = 0; e < int(perf_event_kind::COUNT); e++) {
+                if (fds[e] >= 0 && ids[e] == buffer[4 + 2 * n]) {
+                    auto value = buffer[3 + 2 * n];
+                    sample.values[e] = scale == 1.0 ? value : uint64_t(double(value) * scale);
+                    break;
+                }
+            }
+        }
+        return true;
+#else
+        (void)sample;
+        return false;
+#endif
+    }
+
+private:
+    int fds[int(perf_event_kind::COUNT)];
+    uint64_t ids[int(perf_event_kind::COUNT)] = {};
+
+#ifdef __linux__
+    static bool describe(perf_event_kind e, perf_event_attr &attr) {
+        auto cache = [](uint64_t cache_id) {
+            return cache_id | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        };
+
+        switch (e) {
+            case perf_event_kind::TASK_CLOCK:
+                attr.type = PERF_TYPE_SOFTWARE;
+                attr.config = PERF_COUNT_SW_TASK_CLOCK;
+                return true;
+            case perf_event_kind::CYCLES:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_CPU_CYCLES;
+                return true;
+            case perf_event_kind::INSTRUCTIONS:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+                return true;
+            case perf_event_kind::L1D_MISSES:
+                attr.type = PERF_TYPE_HW_CACHE;
+                attr.config = cache(PERF_COUNT_HW_CACHE_L1D);
+                return true;
+            case perf_event_kind::LLC_MISSES:
+                attr.type = PERF_TYPE_HW_CACHE;
+                attr.config = cache(PERF_COUNT_HW_CACHE_LL);
+                return true;
+            case perf_event_kind::BRANCH_MISSES:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    void ioctl_id(int e) {
+        // The kernel's id of each event identifies its value in a group read.
+        uint64_t id = 0;
+        if (::ioctl(fds[e], PERF_EVENT_IOC_ID, &id) == 0)
+            ids[e] = id;
+    }
+#endif
+};
+
+struct perf_thread_report {
+    int thread;
+    perf_sample phases[int(perf_phase::COUNT)];
+    uint64_t sampled_rays = 0;
+};
+
+struct perf_report {
+    bool enabled = false;   // Whether profiling was on
+    bool hardware = false;  // Whether the hardware events were available
+    std::string error;      // Why counters are missing, if they are
+    perf_sample phases[int(perf_phase::COUNT)];
+    uint64_t sampled_rays = 0;
+    std::vector<perf_thread_report> threads;
+
+    perf_sample shading() const {
+        // What the sampled paths spent outside ray intersection.
+        const auto &paths = phases[int(perf_phase::SAMPLED_PATHS)];
+        const auto &traversal = phases[int(perf_phase::TRAVERSAL)];
+        perf_sample result;
+        for (int e = 0; e < int(perf_event_kind::COUNT); e++)
+            result.values[e] = paths.values[e] - std::min(paths.values[e], traversal.values[e]);
+        return result;
+    }
+};
+
+class perf_profiler {
+    // Counts the phases of every thread that runs them into its own record, like the render
+    // statistics. Build and render phases are measured whole. Reading the counters is a
+    // system call, so splitting ray intersection from shading is done on one camera path in
+    // sample_interval: the counters are read around every intersection of that path.
+
+public:
+    static const int sample_interval = 256;
+
+    struct thread_profile {
+        perf_group group;
+        bool open = false;
+        int id = 0;
+        perf_sample phases[int(perf_phase::COUNT)];
+        uint64_t sampled_rays = 0;
+        uint64_t paths = 0;
+    };
+
+    static perf_profiler &instance() {
+        // Profiling is on from the start when the RTW_PERF environment variable is set.
+        static perf_profiler profiler;
+        return profiler;
+    }
+
+    bool enabled() const {
+        return profiling.load(std::memory_order_relaxed);
+    }
+
+    void enable() {
+        profiling.store(true, std::memory_order_relaxed);
+    }
+
+    static thread_profile *local() {
+        // The calling thread's record, with its counters open, or nullptr when profiling is
+        // off or the counters could not be opened.
+        static thread_local thread_profile *profile = nullptr;
+        if (!instance().enabled())
+            return nullptr;
+        if (!profile)
+            profile = instance().add_thread();
+        return profile->open ? profile : nullptr;
+    }
+
+    static thread_profile *&sampled_path() {
+        // The calling thread's record while it traces a sampled path, else nullptr.
+        static thread_local thread_profile *profile = nullptr;
+        return profile;
+    }
+
+    perf_report collect() {
+        perf_report report;
+        std::lock_guard<std::mutex> lock(mutex);
+        report.enabled = enabled();
+        report.error = error;
+        for (const auto &t : threads) {
+            if (!t->open)
+                continue;
+            report.hardware = report.hardware || t->group.available(perf_event_kind::CYCLES);
+
+            perf_thread_report thread;
+            thread.thread = t->id;
+            thread.sampled_rays = t->sampled_rays;
+            for (int p = 0; p < int(perf_phase::COUNT); p++) {
+                thread.phases[p] = t->phases[p];
+                report.phases[p].merge(t->phases[p]);
+            }
+            report.sampled_rays += t->sampled_rays;
+            report.threads.push_back(thread);
+        }
+        return report;
+    }
+
+    void reset() {
+        // Only call while no thread is counting.
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &t : threads) {
+            for (auto &phase : t->phases)
+                phase = perf_sample();
+            t->sampled_rays = 0;
+            t->paths = 0;
+        }
+    }
+
+private:
+    std::atomic<bool> profiling;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<thread_profile>> threads;
+    std::string error;
+
+    perf_profiler() : profiling(std::getenv("RTW_PERF") != nullptr) {}
+
+    thread_profile *add_thread() {
+        std::unique_ptr<thread_profile> profile(new thread_profile);
+        std::string open_error;
+        profile->open = profile->group.open(open_error);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (error.empty() && !open_error.empty())
+            error = open_error;
+        profile->id = int(threads.size());
+        threads.push_back(std::move(profile));
+        return threads.back().get();
+    }
+};
+
+class perf_phase_scope {
+    // Adds the counts from construction to destruction to a phase of the calling thread.
+public:
+    explicit perf_phase_scope(perf_phase phase) : phase(phase), profile(perf_profiler::local()) {
+        if (profile && !profile->group.read(start))
+            profile = nullptr;
+    }
+
+    ~perf_phase_scope() {
+        perf_sample end;
+        if (profile && profile->group.read(end))
+            profile->phases[int(phase)].add_difference(end, start);
+    }
+
+    perf_phase_scope(const perf_phase_scope &) = delete;
+    perf_phase_scope &operator=(const perf_phase_scope &) = delete;
+
+private:
+    perf_phase phase;
+    perf_profiler::thread_profile *profile;
+    perf_sample start;
+};
+
+class perf_path_scope {
+    // Marks one camera path in perf_profiler::sample_interval as sampled, for its duration.
+public:
+    perf_path_scope() : profile(perf_profiler::local()) {
+        if (profile && profile->paths++ % perf_profiler::sample_interval != 0)
+            profile = nullptr;
+        if (profile && !profile->group.read(start))
+            profile = nullptr;
+        if (profile)
+            perf_profiler::sampled_path() = profile;
+    }
+
+    ~perf_path_scope() {
+        if (!profile)
+            return;
+        perf_profiler::sampled_path() = nullptr;
+        perf_sample end;
+        if (profile->group.read(end))
+            profile->phases[int(perf_phase::SAMPLED_PATHS)].add_difference(end, start);
+    }
+
+    perf_path_scope(const perf_path_scope &) = delete;
+    perf_path_scope &operator=(const perf_path_scope &) = delete;
+
+private:
+    perf_profiler::thread_profile *profile;
+    perf_sample start;
+};
+
+class perf_traversal_scope {
+    // Adds the counts from construction to destruction to the traversal phase, and counts a
+    // sampled ray, when the calling thread traces a sampled path.
+public:
+    perf_traversal_scope() : profile(perf_profiler::sampled_path()) {
+        if (profile && !profile->group.read(start))
+            profile = nullptr;
+    }
+
+    ~perf_traversal_scope() {
+        perf_sample end;
+        if (profile && profile->group.read(end)) {
+            profile->phases[int(perf_phase::TRAVERSAL)].add_difference(end, start);
+            profile->sampled_rays++;
+        }
+    }
+
+    perf_traversal_scope(const perf_traversal_scope &) = delete;
+    perf_traversal_scope &operator=(const perf_traversal_scope &) = delete;
+
+private:
+    perf_profiler::thread_profile *profile;
+    perf_sample start;
+};
+
+#endif
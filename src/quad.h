@@ -11,8 +11,9 @@
 
 #include "hittable.h"
 #include "hittable_list.h"
+#include "material.h"
 
-class quad : public hittable {
+class quad : public hittable, private memory_tracked<quad, memory_category::GEOMETRY> {
 public:
     quad(const point3 &Q, const vec3 &u, const vec3 &v, shared_ptr<material> mat) :
         Q(Q), u(u), v(v), mat(mat) {
@@ -23,9 +24,24 @@ public:
 
         area = n.length();
 
+        // Solid angle sampling applies to rectangles only, expressed in the frame (x, y, z)
+        // spanned by the unit edge directions.
+        is_rectangle = std::fabs(dot(unit_vector(u), unit_vector(v))) < 1e-6;
+        u_length = u.length();
+        v_length = v.length();
+        frame_x = u / u_length;
+        frame_y = v / v_length;
+        frame_z = cross(frame_x, frame_y);
+
         set_bounding_box();
     }
 
+    void sample_solid_angle(bool enable) {
+        // Selects spherical rectangle sampling (Urena et al. 2013) for this light instead of
+        // uniform area sampling. Ignored for non-rectangular parallelograms.
+        solid_angle_sampling = enable;
+    }
+
     virtual void set_bounding_box() {
         // Compute the bounding box of all four vertices.
         auto bbox_diagonal1 = aabb(Q, Q + u + v);
@@ -38,23 +54,13 @@ public:
     }
 
     bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
-        auto denom = dot(normal, r.direction());
-
-        // No hit if the ray is parallel to the plane.
-        if (std::fabs(denom) < 1e-8)
-            return false;
-
-        // Return false if the hit point parameter t is outside the ray interval.
-        auto t = (D - dot(normal, r.origin())) / denom;
-        if (!ray_t.contains(t))
+        count_stat(stat_counter::PRIMITIVE_TESTS);
+        double t, alpha, beta;
+        point3 intersection;
+        if (!intersect_plane(Q, u, v, normal, D, w, r, ray_t, t, intersection, alpha, beta))
             return false;
 
         // Determine if the hit point lies within the planar shape using its plane coordinates.
-        auto intersection = r.at(t);
-        vec3 planar_hitpt_vector = intersection - Q;
-        auto alpha = dot(w, cross(planar_hitpt_vector, v));
-        auto beta = dot(w, cross(u, planar_hitpt_vector));
-
         if (!is_interior(alpha, beta, rec))
             return false;
 
@@ -62,11 +68,36 @@ public:
         rec.t = t;
         rec.p = intersection;
         rec.mat = mat;
+        rec.primitive_id = id();
         rec.set_face_normal(r, normal);
 
         return true;
     }
 
+    static bool intersect_plane(
+        const point3 &Q, const vec3 &u, const vec3 &v, const vec3 &normal, double D, const vec3 &w,
+        const ray &r, interval ray_t, double &t, point3 &intersection, double &alpha, double &beta
+    ) {
+        // Intersects the ray with the plane of a quad, given its derived normal, D and w. On a
+        // hit in ray_t, returns the hit point and its plane coordinates along u and v.
+        auto denom = dot(normal, r.direction());
+
+        // No hit if the ray is parallel to the plane.
+        if (std::fabs(denom) < 1e-8)
+            return false;
+
+        // Return false if the hit point parameter t is outside the ray interval.
+        t = (D - dot(normal, r.origin())) / denom;
+        if (!ray_t.contains(t))
+            return false;
+
+        intersection = r.at(t);
+        vec3 planar_hitpt_vector = intersection - Q;
+        alpha = dot(w, cross(planar_hitpt_vector, v));
+        beta = dot(w, cross(u, planar_hitpt_vector));
+        return true;
+    }
+
     virtual bool is_interior(double a, double b, hit_record &rec) const {
         interval unit_interval = interval(0, 1);
         // Given the hit point in plane coordinates, return false if it is outside the
@@ -81,6 +112,23 @@ public:
     }
 
     double pdf_value(const point3 &origin, const vec3 &direction) const override {
+        spherical_rectangle sr;
+        if (use_spherical_rectangle(origin, sr)) {
+            // Uniform over the solid angle: only test that the direction reaches the quad.
+            auto denom = dot(normal, direction);
+            if (std::fabs(denom) < 1e-8)
+                return 0;
+            auto t = (D - dot(normal, origin)) / denom;
+            if (t < 0.001)
+                return 0;
+            vec3 planar_hitpt_vector = origin + t * direction - Q;
+            auto alpha = dot(w, cross(planar_hitpt_vector, v));
+            auto beta = dot(w, cross(u, planar_hitpt_vector));
+            if (!interval(0, 1).contains(alpha) || !interval(0, 1).contains(beta))
+                return 0;
+            return 1 / sr.solid_angle;
+        }
+
         hit_record rec;
         if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec))
             return 0;
@@ -92,10 +140,28 @@ public:
     }
 
     vec3 random(const point3 &origin) const override {
+        spherical_rectangle sr;
+        if (use_spherical_rectangle(origin, sr))
+            return sample_spherical_rectangle(sr, random_double(), random_double()) - origin;
+
         auto p = Q + (random_double() * u) + (random_double() * v);
         return p - origin;
     }
 
+    bool emitter_bounds(light_bounds &lb) const override {
+        if (!mat)
+            return false;
+
+        // Lambertian emission from the front face only: all normals are equal, and light
+        // leaves up to 90 degrees from them.
+        auto phi = luminance(mat->average_emission()) * area * pi;
+        if (phi <= 0)
+            return false;
+
+        lb = light_bounds(bbox, normal, phi, 1, 0);
+        return true;
+    }
+
 private:
     point3 Q;
     vec3 u, v;
@@ -105,12 +171,89 @@ private:
     vec3 normal;
     double D;
     double area;
-};
 
-inline shared_ptr<hittable_list> box(const point3 &a, const point3 &b, shared_ptr<material> mat) {
-    // Returns the 3D box (six sides) that contains the two opposite vertices a & b.
+    bool solid_angle_sampling = false;
+    bool is_rectangle;
+    double u_length, v_length;
+    vec3 frame_x, frame_y, frame_z;
 
-    auto sides = make_shared<hittable_list>();
+    struct spherical_rectangle {
+        point3 origin;
+        vec3 z_axis;          // Frame z axis, flipped to point away from the rectangle
+        double x0, x1, y0, y1, z0;
+        double b0, b1, k;     // Terms of the inverse CDF
+        double solid_angle;
+    };
+
+    bool use_spherical_rectangle(const point3 &origin, spherical_rectangle &sr) const {
+        // Sets up spherical rectangle sampling from the given origin. Returns false if it is
+        // disabled, or if the solid angle is too small to be computed reliably, in which case
+        // area sampling is used instead.
+
+        if (!solid_angle_sampling || !is_rectangle)
+            return false;
+
+        auto d = Q - origin;
+        sr.origin = origin;
+        sr.x0 = dot(d, frame_x);
+        sr.y0 = dot(d, frame_y);
+        sr.z0 = dot(d, frame_z);
+        sr.z_axis = frame_z;
+        if (sr.z0 > 0) {
+            sr.z0 = -sr.z0;
+            sr.z_axis = -frame_z;
+        }
+        sr.x1 = sr.x0 + u_length;
+        sr.y1 = sr.y0 + v_length;
+
+        // Normals of the four planes through the origin and each rectangle edge.
+        vec3 v00(sr.x0, sr.y0, sr.z0), v01(sr.x0, sr.y1, sr.z0);
+        vec3 v10(sr.x1, sr.y0, sr.z0), v11(sr.x1, sr.y1, sr.z0);
+        auto n0 = unit_vector(cross(v00, v10));
+        auto n1 = unit_vector(cross(v10, v11));
+        auto n2 = unit_vector(cross(v11, v01));
+        auto n3 = unit_vector(cross(v01, v00));
+
+        // Internal angles of the spherical rectangle.
+        auto g0 = angle_between(-n0, n1);
+        auto g1 = angle_between(-n1, n2);
+        auto g2 = angle_between(-n2, n3);
+        auto g3 = angle_between(-n3, n0);
+
+        sr.b0 = n0.z();
+        sr.b1 = n2.z();
+        sr.k = 2 * pi - g2 - g3;
+        sr.solid_angle = g0 + g1 - sr.k;
+
+        return sr.solid_angle > 3e-4;
+    }
+
+    point3 sample_spherical_rectangle(const spherical_rectangle &sr, double s, double t) const {
+        // Returns the point on the rectangle for the uniform sample (s, t) over its solid angle.
+
+        // Invert the solid angle CDF along x.
+        auto au = s * sr.solid_angle + sr.k;
+        auto fu = (std::cos(au) * sr.b0 - sr.b1) / std::sin(au);
+        auto cu = std::copysign(1.0, fu) / std::sqrt(fu * fu + sr.b0 * sr.b0);
+        cu = interval(-0.999999, 0.999999).clamp(cu);
+        auto xu = -(cu * sr.z0) / std::sqrt(1 - cu * cu);
+        xu = interval(sr.x0, sr.x1).clamp(xu);
+
+        // Invert the CDF along y, given x.
+        auto dd = std::sqrt(xu * xu + sr.z0 * sr.z0);
+        auto h0 = sr.y0 / std::sqrt(dd * dd + sr.y0 * sr.y0);
+        auto h1 = sr.y1 / std::sqrt(dd * dd + sr.y1 * sr.y1);
+        auto hv = h0 + t * (h1 - h0);
+        auto hv2 = hv * hv;
+        auto yv = (hv2 < 1 - 1e-6) ? (hv * dd) / std::sqrt(1 - hv2) : sr.y1;
+
+        return sr.origin + xu * frame_x + yv * frame_y + sr.z0 * sr.z_axis;
+    }
+};
+
+inline void box_sides(const point3 &a, const point3 &b, point3 Q[6], vec3 u[6], vec3 v[6]) {
+    // Sets the corners and edges of the six sides of the 3D box that contains the two opposite
+    // vertices a & b.
 
     // Construct the two opposite vertices with the minimum and maximum coordinates.
     auto min = point3(std::fmin(a.x(), b.x()), std::fmin(a.y(), b.y()), std::fmin(a.z(), b.z()));
@@ -120,12 +263,24 @@ inline shared_ptr<hittable_list> box(const point3 &a, const point3 &b, shared_pt
     auto dy = vec3(0, max.y() - min.y(), 0);
     auto dz = vec3(0, 0, max.z() - min.z());
 
-    sides->add(make_shared<quad>(point3(min.x(), min.y(), max.z()), dx, dy, mat));  // front
-    sides->add(make_shared<quad>(point3(max.x(), min.y(), max.z()), -dz, dy, mat)); // right
-    sides->add(make_shared<quad>(point3(max.x(), min.y(), min.z()), -dx, dy, mat)); // back
-    sides->add(make_shared<quad>(point3(min.x(), min.y(), min.z()), dz, dy, mat));  // left
-    sides->add(make_shared<quad>(point3(min.x(), max.y(), max.z()), dx, -dz, mat)); // top
-    sides->add(make_shared<quad>(point3(min.x(), min.y(), min.z()), dx, dz, mat));  // bottom
+    Q[0] = point3(min.x(), min.y(), max.z()); u[0] = dx;  v[0] = dy;  // front
+    Q[1] = point3(max.x(), min.y(), max.z()); u[1] = -dz; v[1] = dy;  // right
+    Q[2] = point3(max.x(), min.y(), min.z()); u[2] = -dx; v[2] = dy;  // back
+    Q[3] = point3(min.x(), min.y(), min.z()); u[3] = dz;  v[3] = dy;  // left
+    Q[4] = point3(min.x(), max.y(), max.z()); u[4] = dx;  v[4] = -dz; // top
+    Q[5] = point3(min.x(), min.y(), min.z()); u[5] = dx;  v[5] = dz;  // bottom
+}
+
+inline shared_ptr<hittable_list> box(const point3 &a, const point3 &b, shared_ptr<material> mat) {
+    // Returns the 3D box (six sides) that contains the two opposite vertices a & b.
+
+    auto sides = make_shared<hittable_list>();
+
+    point3 Q[6];
+    vec3 u[6], v[6];
+    box_sides(a, b, Q, u, v);
+    for (int side = 0; side < 6; side++)
+        sides->add(make_shared<quad>(Q[side], u[side], v[side], mat));
 
     return sides;
 }
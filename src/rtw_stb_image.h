@@ -18,6 +18,9 @@
 #define STBI_FAILURE_USERMSG
 #include "external/stb_image.h"
 
+#include "memory_stats.h"
+#include "trace.h"
+
 #include <cstdlib>
 #include <iostream>
 
@@ -33,6 +36,7 @@ public:
         // images/ subdirectory, then the _parent's_ images/ subdirectory, and then _that_
         // parent, on so on, for six levels up. If the image was not loaded successfully,
         // width() and height() will return 0.
+        trace_span span("load image");
 
         auto filename = std::string(image_filename);
         auto imagedir = getenv("RTW_IMAGES");
@@ -52,10 +56,28 @@ public:
     }
 
     ~rtw_image() {
+        if (!owned)
+            return;
         delete[] bdata;
         STBI_FREE(fdata);
     }
 
+    void view(const float *floats, const unsigned char *bytes, int width, int height) {
+        // Shows pixel data that lives elsewhere, such as in a mapped scene bundle, without
+        // copying it. The data must outlive the image and is never written.
+        owned = false;
+        fdata = const_cast<float *>(floats);
+        bdata = const_cast<unsigned char *>(bytes);
+        image_width = width;
+        image_height = height;
+        bytes_per_scanline = image_width * bytes_per_pixel;
+    }
+
+    const std::string &path() const {
+        // The file the image was loaded from, after the search described above.
+        return loaded_path;
+    }
+
     bool load(const std::string &filename) {
         // Loads the linear (gamma=1) image data from the given file name. Returns true if the
         // load succeeded. The resulting data buffer contains the three [0.0, 1.0]
@@ -69,6 +91,8 @@ public:
 
         bytes_per_scanline = image_width * bytes_per_pixel;
         convert_to_bytes();
+        loaded_path = filename;
+        pixels.resize(size_t(image_width) * image_height * bytes_per_pixel * (sizeof(float) + 1));
         return true;
     }
 
@@ -91,13 +115,28 @@ public:
         return bdata + y * bytes_per_scanline + x * bytes_per_pixel;
     }
 
+    const float *float_pixel_data(int x, int y) const {
+        // Return the address of the three linear RGB floats of the pixel at x,y, preserving
+        // the full range of HDR images. If there is no image data, returns magenta.
+        static float magenta[] = {1, 0, 1};
+        if (fdata == nullptr) return magenta;
+
+        x = clamp(x, 0, image_width);
+        y = clamp(y, 0, image_height);
+
+        return fdata + y * bytes_per_scanline + x * bytes_per_pixel;
+    }
+
 private:
     const int bytes_per_pixel = 3;
     float *fdata = nullptr;         // Linear floating point pixel data
     unsigned char *bdata = nullptr; // Linear 8-bit pixel data
+    memory_account pixels{memory_category::TEXTURES}; // Bytes of fdata and bdata
     int image_width = 0;            // Loaded image width
     int image_height = 0;           // Loaded image height
     int bytes_per_scanline = 0;
+    bool owned = true;              // False for a view of pixel data owned elsewhere
+    std::string loaded_path;
 
     static int clamp(int x, int low, int high) {
         // Return the value clamped to the range [low, high).
@@ -31,9 +31,31 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
 
+class sample_stream {
+public:
+    // A source of sample values in [0,1) that replaces the C library generator for the
+    // current thread while it is active (see sampler.h).
+    virtual ~sample_stream() = default;
+
+    virtual double next() = 0;
+};
+
+inline sample_stream *&active_sample_stream() {
+    static thread_local sample_stream *stream = nullptr;
+    return stream;
+}
+
+inline double independent_random_double() {
+    // Returns a random real in [0,1) from the C library generator. Only code outside a render,
+    // such as scene construction, reaches it: render threads draw from their sampler.
+    return std::rand() / (RAND_MAX + 1.0);
+}
+
 inline double random_double() {
     // Returns a random real in [0,1).
-    return std::rand() / (RAND_MAX + 1.0);
+    if (auto stream = active_sample_stream())
+        return stream->next();
+    return independent_random_double();
 }
 
 inline double random_double(double min, double max) {
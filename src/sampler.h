@@ -0,0 +1,389 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Bit Mixing Utilities
+
+inline uint32_t mix_bits(uint64_t v) {
+    // Hashes a 64-bit value to 32 well mixed bits.
+    v ^= v >> 31;
+    v *= 0x7fb5d329728ea185ull;
+    v ^= v >> 27;
+    v *= 0x81dadef4bc2dd44dull;
+    v ^= v >> 33;
+    return uint32_t(v);
+}
+
+inline uint32_t mix_bits(uint32_t a, uint32_t b) {
+    return mix_bits((uint64_t(a) << 32) | b);
+}
+
+inline uint32_t reverse_bits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+    // Owen scrambling of the bits of x, most significant first, as a hash of the seed
+    // (Laine-Karras permutation, Burley 2020).
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverse_bits(x);
+}
+
+inline uint32_t permutation_element(uint32_t i, uint32_t n, uint32_t p) {
+    // Returns the position of i in the pseudo-random permutation of [0,n) given by p
+    // (Kensler 2013), cycle-walking a hash that is a bijection on the next power of two.
+    uint32_t w = n - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= p;
+        i *= 0xe170893du;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3fu;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69u;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303u;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3u;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3dfu;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= n);
+    return (i + p) % n;
+}
+
+inline double bits_to_double(uint32_t v) {
+    // Maps 32 bits to [0,1).
+    return std::fmin(v * (1.0 / 4294967296.0), 0.99999999999999989);
+}
+
+inline uint32_t sobol_2(uint32_t index) {
+    // Second dimension of the Sobol sequence (the first is the bit-reversed index).
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+        if (index & 1) result ^= v;
+    return result;
+}
+
+class sampler : public sample_stream {
+    // Generates the sample values of one camera path. While bound to a thread, random_double()
+    // draws from the sampler, so every random decision along the path (pixel position, time,
+    // lens, light and BSDF sampling, ...) takes its value from the sample pattern.
+    //
+    // Dimensions are assigned in fixed blocks: the camera uses the first block, and each
+    // bounce starts at its own block regardless of how many values earlier bounces consumed.
+    // Values beyond the end of a block are uniform hashes keyed by the block and their order
+    // in it, so dimensions of different bounces never alias.
+    //
+    // Every value is a function of the seed, pixel, sample index and dimension alone, so a
+    // render does not depend on the number of threads or the order in which they run.
+
+public:
+    static const int camera_dimensions = 8; // Pixel (2), time (1), lens (2) and slack
+    static const int bounce_dimensions = 8; // Light selection and position, BSDF and slack
+
+    sampler(uint32_t seed) :
+        seed(seed) {
+    }
+
+    virtual shared_ptr<sampler> clone() const = 0;
+
+    void bind() {
+        // Makes this sampler the source of random_double() on the calling thread.
+        current_ref() = this;
+        active_sample_stream() = this;
+    }
+
+    static void unbind() {
+        current_ref() = nullptr;
+        active_sample_stream() = nullptr;
+    }
+
+    static sampler *current() {
+        return current_ref();
+    }
+
+    void start_pixel_sample(int i, int j, int index) {
+        pixel_i = i;
+        pixel_j = j;
+        sample_index = uint32_t(index);
+        stream_seed = mix_bits(mix_bits(uint32_t(i), uint32_t(j)), seed);
+        dimension = 0;
+        dimension_end = camera_dimensions;
+        overflow = 0;
+    }
+
+    void start_bounce(int bounce, int split = 0) {
+        // Moves to the dimensions of the given bounce. A non-zero split index starts an
+        // additional, decorrelated sample stream for the rest of the path, used when a vertex
+        // takes several light or BSDF samples.
+        if (split > 0)
+            stream_seed = mix_bits(stream_seed, uint32_t(split));
+        dimension = camera_dimensions + bounce * bounce_dimensions;
+        dimension_end = dimension + bounce_dimensions;
+        overflow = 0;
+    }
+
+    double get_1d() {
+        if (dimension >= dimension_end)
+            return uniform(0x80000000u | (uint32_t(dimension_end) << 12) | (uint32_t(overflow++) & 0xfff));
+        return sample(dimension++);
+    }
+
+    vec3 get_2d() {
+        // Returns a 2D sample as (x, y, 0), starting at an even dimension so that the pair
+        // comes from a single stratified 2D pattern.
+        if (dimension & 1)
+            dimension++;
+        auto x = get_1d();
+        auto y = get_1d();
+        return vec3(x, y, 0);
+    }
+
+    double next() override {
+        return get_1d();
+    }
+
+protected:
+    uint32_t seed;
+    int pixel_i = 0, pixel_j = 0;
+    uint32_t sample_index = 0;
+    uint32_t stream_seed = 0;
+
+    virtual double sample(int dim) const = 0;
+
+    double uniform(uint32_t key) const {
+        // A uniform value hashed from the stream, the sample index and the key.
+        return bits_to_double(mix_bits(mix_bits(stream_seed, sample_index), key));
+    }
+
+private:
+    int dimension = 0;
+    int dimension_end = 0;
+    int overflow = 0; // Values taken beyond the end of the current block
+
+    static sampler *&current_ref() {
+        static thread_local sampler *current = nullptr;
+        return current;
+    }
+};
+
+class independent_sampler : public sampler {
+    // Uniform random values in every dimension.
+
+public:
+    independent_sampler(uint32_t seed) :
+        sampler(seed) {
+    }
+
+    shared_ptr<sampler> clone() const override {
+        return make_shared<independent_sampler>(*this);
+    }
+
+protected:
+    double sample(int dim) const override {
+        return uniform(uint32_t(dim));
+    }
+};
+
+class stratified_sampler : public sampler {
+    // Jittered pixel positions on a sqrt(spp) x sqrt(spp) grid, with independent values in
+    // all other dimensions. Sample counts that are not a perfect square place the remaining
+    // samples uniformly over the pixel.
+
+public:
+    stratified_sampler(uint32_t seed, int samples_per_pixel) :
+        sampler(seed) {
+        sqrt_spp = int(std::sqrt(samples_per_pixel));
+        if (sqrt_spp < 1) sqrt_spp = 1;
+        recip_sqrt_spp = 1.0 / sqrt_spp;
+    }
+
+    shared_ptr<sampler> clone() const override {
+        return make_shared<stratified_sampler>(*this);
+    }
+
+protected:
+    double sample(int dim) const override {
+        if (dim > 1 || sample_index >= uint32_t(sqrt_spp * sqrt_spp))
+            return uniform(uint32_t(dim));
+
+        auto stratum = (dim == 0) ? sample_index % sqrt_spp : sample_index / sqrt_spp;
+        return (stratum + uniform(uint32_t(dim))) * recip_sqrt_spp;
+    }
+
+private:
+    int sqrt_spp;
+    double recip_sqrt_spp;
+};
+
+class sobol_sampler : public sampler {
+    // Owen-scrambled Sobol points, padded in pairs of dimensions: every pair uses the first two
+    // Sobol dimensions with its own scrambling and its own shuffling of the sample order
+    // (Burley 2020). Every power-of-two prefix of the samples of a pixel is a (0,m,2)-net in
+    // each pair, so any sample count, including a growing one, is well stratified.
+
+public:
+    sobol_sampler(uint32_t seed) :
+        sampler(seed) {
+    }
+
+    shared_ptr<sampler> clone() const override {
+        return make_shared<sobol_sampler>(*this);
+    }
+
+protected:
+    double sample(int dim) const override {
+        auto pair_seed = mix_bits(stream_seed, uint32_t(dim >> 1));
+        auto index = nested_uniform_scramble(sample_index, pair_seed);
+        auto bits = (dim & 1) ? sobol_2(index) : reverse_bits(index);
+        return bits_to_double(nested_uniform_scramble(bits, mix_bits(pair_seed, uint32_t(dim & 1) + 1)));
+    }
+};
+
+class halton_sampler : public sampler {
+    // Halton sequence with Owen-scrambled digits, using the d-th prime as the base of
+    // dimension d. Each pixel is scrambled independently.
+
+public:
+    halton_sampler(uint32_t seed) :
+        sampler(seed) {
+    }
+
+    shared_ptr<sampler> clone() const override {
+        return make_shared<halton_sampler>(*this);
+    }
+
+protected:
+    double sample(int dim) const override {
+        const auto &p = primes();
+        auto base = p[size_t(dim) % p.size()];
+        return scrambled_radical_inverse(sample_index, base, mix_bits(stream_seed, uint32_t(dim)));
+    }
+
+private:
+    static const std::vector<uint32_t> &primes() {
+        // The first primes, one per dimension; dimensions beyond repeat with other scrambles.
+        static const std::vector<uint32_t> table = [] {
+            std::vector<uint32_t> result;
+            for (uint32_t n = 2; result.size() < 1024; n++) {
+                bool is_prime = true;
+                for (auto q : result) {
+                    if (q * q > n) break;
+                    if (n % q == 0) {
+                        is_prime = false;
+                        break;
+                    }
+                }
+                if (is_prime) result.push_back(n);
+            }
+            return result;
+        }();
+        return table;
+    }
+
+    static double scrambled_radical_inverse(uint32_t a, uint32_t base, uint32_t hash) {
+        // Mirrors the base-b digits of a around the radix point, permuting each digit by a
+        // hash of the digits above it. Zero digits past the end of a are permuted too, so the
+        // result has full precision.
+        double inv_base = 1.0 / base;
+        double inv_base_m = 1;
+        uint64_t reversed_digits = 0;
+        while (1 - inv_base_m * (base - 1) < 1) {
+            auto next = a / base;
+            auto digit = a - next * base;
+            auto digit_hash = mix_bits(hash ^ uint32_t(reversed_digits));
+            digit = permutation_element(digit, base, digit_hash);
+            reversed_digits = reversed_digits * base + digit;
+            inv_base_m *= inv_base;
+            a = next;
+        }
+        return std::fmin(inv_base_m * reversed_digits, 0.99999999999999989);
+    }
+};
+
+class pmj02_sampler : public sampler {
+    // Progressive multi-jittered (0,2) sequences: every power-of-two prefix is stratified in
+    // all 2D elementary intervals. A set of precomputed tables is shared by all samplers;
+    // each pair of dimensions of each pixel reads from one table with the sample order
+    // shuffled by an XOR, which keeps the prefixes stratified.
+
+public:
+    static const int table_size = 4096;
+    static const int table_count = 32;
+
+    pmj02_sampler(uint32_t seed) :
+        sampler(seed) {
+    }
+
+    shared_ptr<sampler> clone() const override {
+        return make_shared<pmj02_sampler>(*this);
+    }
+
+protected:
+    double sample(int dim) const override {
+        auto pair_seed = mix_bits(stream_seed, uint32_t(dim >> 1));
+        auto table = (pair_seed + sample_index / table_size) % table_count;
+        auto index = (sample_index ^ (pair_seed >> 8)) % table_size;
+        const auto &point = tables()[table * table_size + index];
+        return (dim & 1) ? point.y : point.x;
+    }
+
+private:
+    struct point2 {
+        float x, y;
+    };
+
+    static const std::vector<point2> &tables() {
+        // Each table is the base-2 (0,2)-sequence with its digits flipped by an independent
+        // random binary tree, which yields a random pmj02 sequence.
+        static const std::vector<point2> data = [] {
+            std::vector<point2> result(size_t(table_count) * table_size);
+            std::mt19937 rng(0x5eed);
+            for (int t = 0; t < table_count; t++) {
+                uint32_t x_seed = rng(), y_seed = rng();
+                for (uint32_t i = 0; i < uint32_t(table_size); i++) {
+                    auto x = nested_uniform_scramble(reverse_bits(i), x_seed);
+                    auto y = nested_uniform_scramble(sobol_2(i), y_seed);
+                    result[t * table_size + i] = {
+                        float(std::fmin(bits_to_double(x), 0.99999994)),
+                        float(std::fmin(bits_to_double(y), 0.99999994))};
+                }
+            }
+            return result;
+        }();
+        return data;
+    }
+};
+
+#endif
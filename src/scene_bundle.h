@@ -0,0 +1,625 @@
+#ifndef SCENE_BUNDLE_H
+#define SCENE_BUNDLE_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "bundle_format.h"
+#include "constant_medium.h"
+#include "image_reader.h"
+#include "scene_loader.h"
+#include "sphere.h"
+
+#include <string>
+#include <vector>
+
+class bundle_emitter : public hittable, private memory_tracked<bundle_emitter, memory_category::GEOMETRY> {
+    // An emissive primitive of a scene bundle made into a standalone object for light
+    // sampling. It keeps the primitive_id that the bundle reports for hits on the primitive.
+public:
+    bundle_emitter(shared_ptr<hittable> object, int primitive_id) :
+        object(object), primitive_id(primitive_id) {
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+        if (!object->hit(r, ray_t, rec))
+            return false;
+        rec.primitive_id = primitive_id;
+        return true;
+    }
+
+    aabb bounding_box() const override {
+        return object->bounding_box();
+    }
+
+    double pdf_value(const point3 &origin, const vec3 &direction) const override {
+        return object->pdf_value(origin, direction);
+    }
+
+    vec3 random(const point3 &origin) const override {
+        return object->random(origin);
+    }
+
+    bool emitter_bounds(light_bounds &lb) const override {
+        return object->emitter_bounds(lb);
+    }
+
+    int emitter_id() const override {
+        return primitive_id;
+    }
+
+private:
+    shared_ptr<hittable> object;
+    int primitive_id;
+};
+
+class scene_bundle : public hittable, private memory_tracked<scene_bundle, memory_category::GEOMETRY> {
+    // A scene bundle (see bundle_format.h) mapped into memory. Rays traverse the stored BVH
+    // and intersect the packed spheres and quads where they lie in the mapping, so loading
+    // reads only the header and the small tables: textures and materials become objects,
+    // image textures and the environment view their pixels in place, and the emitters and
+    // media are made into sphere, quad and constant_medium objects for light sampling. One
+    // pass over the nodes, primitive references and primitive materials checks every index
+    // that traversal follows, so a damaged bundle is rejected rather than read out of bounds.
+    //
+    // Bundle primitives report their index in the hit record, spheres first, then quads.
+
+public:
+    static bool load(const std::string &filename, scene &s, std::string &error) {
+        // Replaces the scene with the one in the bundle. Returns false with a message on error.
+        trace_span span("load bundle");
+        auto bundle = shared_ptr<scene_bundle>(new scene_bundle(filename));
+        if (!bundle->open(error) || !bundle->unpack(error)) {
+            error = "'" + filename + "': " + error;
+            return false;
+        }
+
+        s = scene();
+        s.name = std::string(bundle->strings + bundle->header->name, size_t(bundle->header->name_length));
+        bundle->unpack_camera(s.cam);
+        s.cam.scene_hash = bundle->header->source_hash;
+        s.world.add(bundle);
+        return true;
+    }
+
+    static bool load_cached(const std::string &source, const std::string &filename, scene &s, std::string &error) {
+        // Loads a scene file through its bundle, compiling the bundle first if it is missing or
+        // was made from other contents of the scene file or its images.
+        if (!is_current(source, filename) && !compile(source, filename, error))
+            return false;
+        return load(filename, s, error);
+    }
+
+    static bool compile(const std::string &source, const std::string &filename, std::string &error) {
+        // Writes the bundle of a scene file.
+        trace_span span("compile bundle");
+        scene compiled;
+        bundle_builder builder;
+        if (!scene_loader::load(source, compiled, error, &builder))
+            return false;
+
+        uint64_t hash;
+        if (!source_hash(builder.source_files(), hash)) {
+            error = "could not read the sources of '" + source + "'";
+            return false;
+        }
+        return builder.write(filename, compiled.name, compiled.cam, hash, error);
+    }
+
+    static bool is_current(const std::string &source, const std::string &filename) {
+        // Whether the bundle was made from the scene file as it is now. Sources with their
+        // recorded size and modification time are taken as unchanged; otherwise the contents
+        // of all the sources are hashed.
+        scene_bundle bundle(filename);
+        std::string error;
+        if (!bundle.open(error) || bundle.source_count == 0)
+            return false;
+
+        std::vector<std::string> paths;
+        bool touched = false;
+        for (size_t n = 0; n < bundle.source_count; n++) {
+            const auto &record = bundle.sources[n];
+            paths.emplace_back(bundle.strings + record.path, size_t(record.path_length));
+            uint64_t size;
+            int64_t mtime;
+            if (!bundle_stat(paths.back(), size, mtime) || size != record.size)
+                return false;
+            touched = touched || mtime != record.mtime;
+        }
+        if (paths[0] != source)
+            return false;
+
+        uint64_t hash;
+        return !touched || (source_hash(paths, hash) && hash == bundle.header->source_hash);
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+        // Walks the BVH depth first with an explicit stack, visiting the nearer child first.
+        if (node_count == 0)
+            return false;
+
+        uint32_t stack[max_bvh_depth];
+        int top = 0;
+        uint32_t index = 0;
+        bool hit_anything = false;
+
+        while (true) {
+            count_stat(stat_counter::BVH_NODES);
+            const auto &node = nodes[index];
+            if (box_hit(node, r, ray_t)) {
+                if (node.count == 0) {
+                    bool right_first = r.direction()[int(node.axis)] < 0;
+                    stack[top++] = right_first ? index + 1 : node.offset;
+                    index = right_first ? node.offset : index + 1;
+                    continue;
+                }
+                for (uint32_t n = 0; n < node.count; n++) {
+                    if (hit_primitive(primitives[node.offset + n], r, ray_t, rec)) {
+                        hit_anything = true;
+                        ray_t.max = rec.t;
+                    }
+                }
+            }
+            if (top == 0)
+                return hit_anything;
+            index = stack[--top];
+        }
+    }
+
+    aabb bounding_box() const override {
+        return bbox;
+    }
+
+    void collect_emitters(std::vector<shared_ptr<hittable>> &out) const override {
+        for (const auto &object : emitters)
+            gather_emitters(object, out);
+    }
+
+private:
+    mapped_file file;
+    const bundle_header *header = nullptr;
+    const packed_sphere *spheres = nullptr;
+    const packed_quad *quads = nullptr;
+    const packed_node *nodes = nullptr;
+    const uint32_t *primitives = nullptr;
+    const packed_source *sources = nullptr;
+    const char *strings = nullptr;
+    size_t sphere_count = 0, quad_count = 0, node_count = 0, source_count = 0;
+    aabb bbox;
+
+    static const int max_bvh_depth = 64; // Interior nodes per path, the size of the traversal stack
+
+    std::vector<shared_ptr<texture>> textures;
+    std::vector<shared_ptr<material>> materials;
+    std::vector<shared_ptr<hittable>> media;
+    std::vector<shared_ptr<hittable>> emitters;
+    shared_ptr<environment_light> environment;
+
+    // Bytes of the mapping used in place, by what they hold.
+    memory_account geometry_bytes{memory_category::GEOMETRY};
+    memory_account bvh_bytes{memory_category::BVH};
+    memory_account texture_bytes{memory_category::TEXTURES};
+
+    explicit scene_bundle(const std::string &filename) : file(filename, false) {}
+
+    static bool source_hash(const std::vector<std::string> &paths, uint64_t &hash) {
+        // Hashes the contents of the files in order, each followed by its length.
+        hash = bundle_hash(nullptr, 0);
+        for (const auto &path : paths) {
+            uint64_t size;
+            int64_t mtime;
+            if (!bundle_stat(path, size, mtime) || !bundle_hash_file(path, hash))
+                return false;
+            hash = bundle_hash(&size, sizeof size, hash);
+        }
+        return true;
+    }
+
+    template <typename T>
+    bool section(bundle_section s, const T *&out, size_t &count, std::string &error) const {
+        // Finds a section, checking that it lies in the file and holds whole records.
+        const auto &range = header->sections[int(s)];
+        if (range.offset % 8 != 0 || range.offset > file.size() || range.bytes > file.size() - range.offset
+            || range.bytes % sizeof(T) != 0) {
+            error = "bad section " + std::to_string(int(s));
+            return false;
+        }
+        out = reinterpret_cast<const T *>(file.data() + range.offset);
+        count = size_t(range.bytes / sizeof(T));
+        return true;
+    }
+
+    bool open(std::string &error) {
+        if (!file.is_open()) {
+            error = "could not read the file";
+            return false;
+        }
+        header = reinterpret_cast<const bundle_header *>(file.data());
+        if (file.size() < sizeof(bundle_header) || std::memcmp(header->magic, bundle_magic, sizeof bundle_magic) != 0) {
+            error = "not a scene bundle";
+            return false;
+        }
+        if (header->version != bundle_version || header->byte_order != bundle_byte_order
+            || header->file_size != file.size()) {
+            error = "the bundle was written by another version or platform, or is truncated";
+            return false;
+        }
+
+        size_t string_bytes;
+        if (!section(bundle_section::SOURCES, sources, source_count, error)
+            || !section(bundle_section::STRINGS, strings, string_bytes, error))
+            return false;
+        if (header->name > string_bytes || header->name_length > string_bytes - header->name) {
+            error = "bad scene name";
+            return false;
+        }
+        for (size_t n = 0; n < source_count; n++) {
+            if (sources[n].path > string_bytes || sources[n].path_length > string_bytes - sources[n].path) {
+                error = "bad source path";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool unpack(std::string &error) {
+        // Builds the objects of the small tables and checks the indices of the geometry and
+        // the BVH, which are then used in place. The source hash only tells whether the scene
+        // files changed since the bundle was written, and is not checked for a bundle loaded
+        // directly, so the payload is validated here.
+        const packed_texture *texture_records;
+        const packed_material *material_records;
+        const packed_medium *medium_records;
+        const uint32_t *boundaries, *emitter_refs;
+        const unsigned char *pixels;
+        size_t texture_count, material_count, medium_count, primitive_count, boundary_count, emitter_count;
+        size_t pixel_bytes;
+        if (!section(bundle_section::TEXTURES, texture_records, texture_count, error)
+            || !section(bundle_section::MATERIALS, material_records, material_count, error)
+            || !section(bundle_section::SPHERES, spheres, sphere_count, error)
+            || !section(bundle_section::QUADS, quads, quad_count, error)
+            || !section(bundle_section::MEDIA, medium_records, medium_count, error)
+            || !section(bundle_section::NODES, nodes, node_count, error)
+            || !section(bundle_section::PRIMITIVES, primitives, primitive_count, error)
+            || !section(bundle_section::BOUNDARIES, boundaries, boundary_count, error)
+            || !section(bundle_section::EMITTERS, emitter_refs, emitter_count, error)
+            || !section(bundle_section::PIXELS, pixels, pixel_bytes, error))
+            return false;
+
+        auto image = [&](const packed_image &record, const float *&floats, const unsigned char *&bytes) {
+            // Finds the pixels of an image in the pixel section.
+            floats = nullptr;
+            bytes = nullptr;
+            if (record.width <= 0 || record.height <= 0)
+                return true;
+            auto count = uint64_t(record.width) * uint64_t(record.height) * 3;
+            if (record.pixels % 4 != 0 || record.pixels > pixel_bytes
+                || count * (sizeof(float) + 1) > pixel_bytes - record.pixels)
+                return false;
+            floats = reinterpret_cast<const float *>(pixels + record.pixels);
+            bytes = pixels + record.pixels + count * sizeof(float);
+            return true;
+        };
+
+        for (size_t n = 0; n < texture_count; n++) {
+            const auto &record = texture_records[n];
+            auto earlier = [&](int32_t index) { return index >= 0 && size_t(index) < n; };
+            shared_ptr<texture> tex;
+            switch (bundle_texture(record.type)) {
+                case bundle_texture::SOLID:
+                    tex = make_shared<solid_color>(color(record.color[0], record.color[1], record.color[2]));
+                    break;
+                case bundle_texture::CHECKER:
+                    if (earlier(record.even) && earlier(record.odd))
+                        tex = make_shared<checker_texture>(record.scale, textures[record.even], textures[record.odd]);
+                    break;
+                case bundle_texture::NOISE: {
+                    if (record.image.pixels % 8 != 0 || record.image.pixels > pixel_bytes
+                        || sizeof(perlin) > pixel_bytes - record.image.pixels)
+                        break;
+                    auto noise = reinterpret_cast<const perlin *>(pixels + record.image.pixels);
+                    tex = make_shared<noise_texture>(record.scale, *noise);
+                    break;
+                }
+                case bundle_texture::IMAGE: {
+                    const float *floats;
+                    const unsigned char *bytes;
+                    if (image(record.image, floats, bytes))
+                        tex = make_shared<image_texture>(floats, bytes, record.image.width, record.image.height);
+                    break;
+                }
+            }
+            if (!tex) {
+                error = "bad texture " + std::to_string(n);
+                return false;
+            }
+            textures.push_back(tex);
+        }
+
+        for (size_t n = 0; n < material_count; n++) {
+            const auto &record = material_records[n];
+            auto type = bundle_material(record.type);
+            bool textured = type != bundle_material::METAL && type != bundle_material::DIELECTRIC;
+            if (textured && (record.texture < 0 || size_t(record.texture) >= texture_count)) {
+                error = "bad material " + std::to_string(n);
+                return false;
+            }
+            auto tex = textured ? textures[record.texture] : nullptr;
+            auto albedo = color(record.albedo[0], record.albedo[1], record.albedo[2]);
+            shared_ptr<material> mat;
+            switch (type) {
+                case bundle_material::LAMBERTIAN: mat = make_shared<lambertian>(tex); break;
+                case bundle_material::PHONG: mat = make_shared<phong>(tex, record.parameter); break;
+                case bundle_material::METAL: mat = make_shared<metal>(albedo, record.parameter); break;
+                case bundle_material::DIELECTRIC: mat = make_shared<dielectric>(record.parameter); break;
+                case bundle_material::DIFFUSE_LIGHT: mat = make_shared<diffuse_light>(tex); break;
+                case bundle_material::ISOTROPIC: mat = make_shared<isotropic>(tex); break;
+            }
+            if (!mat) {
+                error = "bad material " + std::to_string(n);
+                return false;
+            }
+            materials.push_back(mat);
+        }
+
+        for (size_t n = 0; n < medium_count; n++) {
+            const auto &record = medium_records[n];
+            auto boundary = make_shared<hittable_list>();
+            bool ok = record.first <= boundary_count && record.count <= boundary_count - record.first
+                      && record.texture >= 0 && size_t(record.texture) < texture_count;
+            for (uint32_t b = 0; ok && b < record.count; b++) {
+                shared_ptr<hittable> object;
+                ok = make_object(boundaries[record.first + b], object) && object;
+                if (ok)
+                    boundary->add(object);
+            }
+            if (!ok) {
+                error = "bad medium " + std::to_string(n);
+                return false;
+            }
+            media.push_back(make_shared<constant_medium>(boundary, record.density, textures[record.texture]));
+        }
+
+        for (size_t n = 0; n < emitter_count; n++) {
+            shared_ptr<hittable> object;
+            if (bundle_reference_kind(emitter_refs[n]) == bundle_primitive::MEDIUM
+                || !make_object(emitter_refs[n], object)) {
+                error = "bad emitter " + std::to_string(n);
+                return false;
+            }
+            auto index = bundle_reference_index(emitter_refs[n]);
+            bool is_sphere = bundle_reference_kind(emitter_refs[n]) == bundle_primitive::SPHERE;
+            auto id = is_sphere ? index : sphere_count + index;
+            emitters.push_back(make_shared<bundle_emitter>(object, int(id)));
+        }
+
+        const auto &cam = header->camera;
+        if (cam.has_environment) {
+            const float *floats;
+            const unsigned char *bytes;
+            if (!image(cam.environment, floats, bytes)) {
+                error = "bad environment image";
+                return false;
+            }
+            environment = make_shared<environment_light>(
+                floats, bytes, cam.environment.width, cam.environment.height, cam.environment_scale);
+        }
+
+        if (!check_geometry(primitive_count, error))
+            return false;
+
+        bbox = aabb::empty;
+        if (node_count > 0) {
+            const auto &b = nodes[0].bounds;
+            bbox = aabb(point3(b[0], b[2], b[4]), point3(b[1], b[3], b[5]));
+        }
+
+        auto bytes = [&](bundle_section s) { return size_t(header->sections[int(s)].bytes); };
+        geometry_bytes.resize(bytes(bundle_section::SPHERES) + bytes(bundle_section::QUADS));
+        bvh_bytes.resize(bytes(bundle_section::NODES) + bytes(bundle_section::PRIMITIVES));
+        texture_bytes.resize(pixel_bytes);
+        return true;
+    }
+
+    bool check_geometry(size_t primitive_count, std::string &error) const {
+        // Checks the materials of the primitives, the references of the BVH leaves and the
+        // nodes. Children lie after their parent, so traversal ends, and no node is deeper
+        // than the traversal stack.
+        for (size_t n = 0; n < sphere_count; n++) {
+            if (!valid_material(spheres[n].material)) {
+                error = "bad sphere " + std::to_string(n);
+                return false;
+            }
+        }
+        for (size_t n = 0; n < quad_count; n++) {
+            if (!valid_material(quads[n].material)) {
+                error = "bad quad " + std::to_string(n);
+                return false;
+            }
+        }
+        for (size_t n = 0; n < primitive_count; n++) {
+            auto index = bundle_reference_index(primitives[n]);
+            bool ok = false;
+            switch (bundle_reference_kind(primitives[n])) {
+                case bundle_primitive::SPHERE: ok = index < sphere_count; break;
+                case bundle_primitive::QUAD: ok = index < quad_count; break;
+                case bundle_primitive::MEDIUM: ok = index < media.size(); break;
+            }
+            if (!ok) {
+                error = "bad primitive reference " + std::to_string(n);
+                return false;
+            }
+        }
+
+        std::vector<unsigned char> depth(node_count, 0);
+        for (size_t n = 0; n < node_count; n++) {
+            const auto &node = nodes[n];
+            bool ok;
+            if (node.count > 0) {
+                ok = uint64_t(node.offset) + node.count <= primitive_count;
+            } else {
+                ok = node.axis < 3 && depth[n] < max_bvh_depth && node.offset > n + 1 && node.offset < node_count;
+                if (ok) {
+                    depth[n + 1] = std::max(depth[n + 1], (unsigned char)(depth[n] + 1));
+                    depth[node.offset] = std::max(depth[node.offset], (unsigned char)(depth[n] + 1));
+                }
+            }
+            if (!ok) {
+                error = "bad BVH node " + std::to_string(n);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool make_object(uint32_t ref, shared_ptr<hittable> &out) const {
+        // Makes a standalone object of a packed primitive, for light sampling and media.
+        auto index = bundle_reference_index(ref);
+        switch (bundle_reference_kind(ref)) {
+            case bundle_primitive::SPHERE: {
+                if (index >= sphere_count || !valid_material(spheres[index].material))
+                    return false;
+                const auto &s = spheres[index];
+                auto center = point3(s.center[0], s.center[1], s.center[2]);
+                auto motion = vec3(s.motion[0], s.motion[1], s.motion[2]);
+                auto mat = materials[s.material];
+                if (motion.near_zero())
+                    out = make_shared<sphere>(center, s.radius, mat);
+                else
+                    out = make_shared<sphere>(center, center + motion, s.radius, mat);
+                return true;
+            }
+            case bundle_primitive::QUAD: {
+                if (index >= quad_count || !valid_material(quads[index].material))
+                    return false;
+                const auto &q = quads[index];
+                auto object = make_shared<quad>(point3(q.Q[0], q.Q[1], q.Q[2]), vec3(q.u[0], q.u[1], q.u[2]),
+                                                vec3(q.v[0], q.v[1], q.v[2]), materials[q.material]);
+                object->sample_solid_angle(q.solid_angle != 0);
+                out = object;
+                return true;
+            }
+            case bundle_primitive::MEDIUM:
+                if (index >= media.size())
+                    return false;
+                out = media[index];
+                return true;
+        }
+        return false;
+    }
+
+    bool valid_material(int32_t index) const {
+        return index >= 0 && size_t(index) < materials.size();
+    }
+
+    void unpack_camera(camera &cam) const {
+        const auto &c = header->camera;
+        cam.aspect_ratio = c.aspect_ratio;
+        cam.vfov = c.vfov;
+        cam.defocus_angle = c.defocus_angle;
+        cam.focus_dist = c.focus_dist;
+        cam.background = color(c.background[0], c.background[1], c.background[2]);
+        cam.lookfrom = point3(c.lookfrom[0], c.lookfrom[1], c.lookfrom[2]);
+        cam.lookat = point3(c.lookat[0], c.lookat[1], c.lookat[2]);
+        cam.vup = vec3(c.vup[0], c.vup[1], c.vup[2]);
+        cam.image_width = c.image_width;
+        cam.samples_per_pixel = c.samples_per_pixel;
+        cam.max_depth = c.max_depth;
+        cam.light_samples = c.light_samples;
+        cam.bsdf_samples = c.bsdf_samples;
+        cam.render_mode = camera::RenderMode(c.render_mode);
+        cam.light_sampling = camera::LightSampling(c.light_sampling);
+        cam.sampler_type = camera::SamplerType(c.sampler_type);
+        cam.seed = c.seed;
+        cam.environment = environment;
+    }
+
+    static bool box_hit(const packed_node &node, const ray &r, interval ray_t) {
+        // The slab test of aabb::hit, on the stored bounds.
+        const point3 &ray_orig = r.origin();
+        const vec3 &ray_dir = r.direction();
+
+        for (int axis = 0; axis < 3; axis++) {
+            const double adinv = 1.0 / ray_dir[axis];
+            auto t0 = (node.bounds[2 * axis] - ray_orig[axis]) * adinv;
+            auto t1 = (node.bounds[2 * axis + 1] - ray_orig[axis]) * adinv;
+
+            if (t0 < t1) {
+                if (t0 > ray_t.min) ray_t.min = t0;
+                if (t1 < ray_t.max) ray_t.max = t1;
+            } else {
+                if (t1 > ray_t.min) ray_t.min = t1;
+                if (t0 < ray_t.max) ray_t.max = t0;
+            }
+
+            if (ray_t.max <= ray_t.min)
+                return false;
+        }
+        return true;
+    }
+
+    bool hit_primitive(uint32_t ref, const ray &r, interval ray_t, hit_record &rec) const {
+        auto index = bundle_reference_index(ref);
+        switch (bundle_reference_kind(ref)) {
+            case bundle_primitive::SPHERE: return hit_sphere(index, r, ray_t, rec);
+            case bundle_primitive::QUAD: return hit_quad(index, r, ray_t, rec);
+            default: return media[index]->hit(r, ray_t, rec);
+        }
+    }
+
+    bool hit_sphere(uint32_t index, const ray &r, interval ray_t, hit_record &rec) const {
+        // As sphere::hit, with the texture coordinates taken in the unrotated frame.
+        count_stat(stat_counter::PRIMITIVE_TESTS);
+        const auto &s = spheres[index];
+        auto current_center = point3(s.center[0], s.center[1], s.center[2])
+                              + r.time() * vec3(s.motion[0], s.motion[1], s.motion[2]);
+        double root;
+        if (!sphere::intersect(current_center, s.radius, r, ray_t, root))
+            return false;
+
+        rec.t = root;
+        rec.p = r.at(rec.t);
+        vec3 outward_normal = (rec.p - current_center) / s.radius;
+        rec.set_face_normal(r, outward_normal);
+        auto object_normal = vec3(s.cos_theta * outward_normal.x() - s.sin_theta * outward_normal.z(),
+                                  outward_normal.y(),
+                                  s.sin_theta * outward_normal.x() + s.cos_theta * outward_normal.z());
+        sphere::get_sphere_uv(object_normal, rec.u, rec.v);
+        rec.mat = materials[s.material];
+        rec.primitive_id = int(index);
+        return true;
+    }
+
+    bool hit_quad(uint32_t index, const ray &r, interval ray_t, hit_record &rec) const {
+        // As quad::hit.
+        count_stat(stat_counter::PRIMITIVE_TESTS);
+        const auto &q = quads[index];
+        auto normal = vec3(q.normal[0], q.normal[1], q.normal[2]);
+        double t, alpha, beta;
+        point3 intersection;
+        if (!quad::intersect_plane(point3(q.Q[0], q.Q[1], q.Q[2]), vec3(q.u[0], q.u[1], q.u[2]),
+                                   vec3(q.v[0], q.v[1], q.v[2]), normal, q.D, vec3(q.w[0], q.w[1], q.w[2]),
+                                   r, ray_t, t, intersection, alpha, beta))
+            return false;
+
+        interval unit_interval = interval(0, 1);
+        if (!unit_interval.contains(alpha) || !unit_interval.contains(beta))
+            return false;
+
+        rec.u = alpha;
+        rec.v = beta;
+        rec.t = t;
+        rec.p = intersection;
+        rec.mat = materials[q.material];
+        rec.primitive_id = int(sphere_count + index);
+        rec.set_face_normal(r, normal);
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,152 @@
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Procedural stress scenes:
+//
+//     scene_gen [--kind spheres] [--count 1000] [--seed 1] [--image FILE]
+//               [--lights tree|power] [--width 0] [--spp 16] [--output image.ppm]
+//
+// Generates a scene of the given kind and size (see scene_generator.h), builds its BVH and
+// light structure, and prints the time each takes and the memory the scene uses. With a
+// width, it also renders the scene and prints the render time and rays per second; the image
+// is written only when an output file is given. Running it over growing counts shows how BVH
+// build, traversal and light sampling scale with the scene.
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "light_list.h"
+#include "light_tree.h"
+#include "scene_generator.h"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static int usage() {
+    std::cerr << "Usage: scene_gen [--kind KIND] [--count N] [--seed N] [--image FILE]\n"
+                 "                 [--lights tree|power] [--width N] [--spp N] [--output FILE]\n"
+                 "Kinds:";
+    for (const auto &kind : scene_generator::kinds())
+        std::cerr << ' ' << kind;
+    std::cerr << '\n';
+    return 2;
+}
+
+int main(int argc, char *argv[]) {
+    generator_params params;
+    std::string light_sampling = "tree";
+    int width = 0;
+    int spp = 16;
+    std::string output;
+
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (a + 1 >= argc)
+            return usage();
+        std::string value = argv[++a];
+
+        if (arg == "--kind")
+            params.kind = value;
+        else if (arg == "--count")
+            params.count = size_t(std::atoll(value.c_str()));
+        else if (arg == "--seed")
+            params.seed = unsigned(std::atol(value.c_str()));
+        else if (arg == "--image")
+            params.image = value;
+        else if (arg == "--lights")
+            light_sampling = value;
+        else if (arg == "--width")
+            width = std::atoi(value.c_str());
+        else if (arg == "--spp")
+            spp = std::atoi(value.c_str());
+        else if (arg == "--output")
+            output = value;
+        else
+            return usage();
+    }
+
+    if (params.count == 0 || width < 0 || spp <= 0 || (light_sampling != "tree" && light_sampling != "power"))
+        return usage();
+
+    scene s;
+    auto start = std::chrono::steady_clock::now();
+    if (!scene_generator().generate(params, s)) {
+        std::cerr << "ERROR: Unknown kind '" << params.kind << "'.\n";
+        return usage();
+    }
+    auto generate_seconds = seconds_since(start);
+    auto objects = s.world.objects.size();
+
+    start = std::chrono::steady_clock::now();
+    auto world = make_shared<bvh_node>(s.world);
+    auto bvh_seconds = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    shared_ptr<hittable> lights;
+    size_t light_count;
+    if (light_sampling == "power") {
+        auto list = make_shared<light_list>(*world);
+        light_count = list->size();
+        lights = list;
+    } else {
+        auto tree = make_shared<light_tree>(*world);
+        light_count = tree->size();
+        lights = tree;
+    }
+    auto light_seconds = seconds_since(start);
+
+    std::printf("scene        %s (seed %u)\n", s.name.c_str(), params.seed);
+    std::printf("objects      %zu\n", objects);
+    std::printf("lights       %zu (%s)\n", light_count, light_sampling.c_str());
+    std::printf("generate     %.3f s\n", generate_seconds);
+    std::printf("bvh build    %.3f s\n", bvh_seconds);
+    std::printf("light build  %.3f s\n", light_seconds);
+
+    auto &memory = memory_tracker::instance();
+    std::printf("memory       %.1f MB\n", memory.total_bytes() / (1024.0 * 1024.0));
+    for (int c = 0; c < int(memory_category::COUNT); c++) {
+        auto bytes = memory.bytes(memory_category(c));
+        if (bytes > 0)
+            std::printf("  %-10s %.1f MB\n", memory_category_name(memory_category(c)), bytes / (1024.0 * 1024.0));
+    }
+    std::fflush(stdout);
+
+    if (width == 0)
+        return 0;
+
+    // The camera keeps its scene setup; only the image and sampling are set here. Without an
+    // output file the image is discarded.
+    s.cam.image_width = width;
+    s.cam.samples_per_pixel = spp;
+    s.cam.seed = params.seed;
+    s.cam.output_file = output.empty() ? "scene_gen.pfm" : output;
+    if (light_sampling == "power")
+        s.cam.light_sampling = camera::LightSampling::POWER;
+
+    auto log = std::clog.rdbuf(nullptr);
+    start = std::chrono::steady_clock::now();
+    bool written = light_count == 0 ? s.cam.render(*world) : s.cam.render(*world, *lights);
+    auto render_seconds = seconds_since(start);
+    std::clog.rdbuf(log);
+
+    if (output.empty())
+        std::remove("scene_gen.pfm");
+
+    auto rays = double(stats_registry::instance().collect()[stat_counter::RAYS]);
+    std::printf("render       %.3f s (%dx%d, %d spp)\n", render_seconds, width,
+                int(width / s.cam.aspect_ratio), spp);
+    if (stats_enabled)
+        std::printf("rays         %.3f M/s\n", rays / render_seconds * 1e-6);
+    return written ? 0 : 1;
+}
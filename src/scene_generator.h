@@ -0,0 +1,218 @@
+#ifndef SCENE_GENERATOR_H
+#define SCENE_GENERATOR_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "scenes.h"
+#include "texture.h"
+
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+struct generator_params {
+    std::string kind = "spheres"; // One of scene_generator::kinds()
+    size_t count = 1000;          // Spheres, quads, box instances, lights, volumes or textured spheres
+    unsigned seed = 1;
+    std::string image;            // Optional image file for the textured spheres
+};
+
+class scene_generator {
+    // Builds stress scenes that grow with a count, for measuring BVH build, traversal and
+    // light sampling at scale. The scenes keep the same extent, the unit cube above a ground
+    // plane, so more objects mean smaller ones and deeper hierarchies rather than a wider
+    // view. The same parameters always give the same scene.
+
+public:
+    static std::vector<std::string> kinds() {
+        return {"spheres", "quads", "boxes", "lights", "volumes", "textured"};
+    }
+
+    bool generate(const generator_params &params, scene &s) {
+        // Builds the scene into s. Returns false for an unknown kind.
+        rng.seed(params.seed);
+        std::srand(params.seed); // Perlin noise tables are drawn from the C library generator
+        auto count = params.count > 0 ? params.count : 1;
+
+        s = scene();
+        s.name = params.kind + "_" + std::to_string(count);
+        if (params.kind == "spheres") spheres(s.world, count);
+        else if (params.kind == "quads") quads(s.world, count);
+        else if (params.kind == "boxes") boxes(s.world, count);
+        else if (params.kind == "lights") lights(s.world, count);
+        else if (params.kind == "volumes") volumes(s.world, count);
+        else if (params.kind == "textured") textured(s.world, count, params.image);
+        else return false;
+
+        if (params.kind != "lights")
+            add_lamp(s.world);
+        add_ground(s.world);
+        set_camera(s.cam);
+        return true;
+    }
+
+private:
+    std::mt19937_64 rng;
+
+    double uniform(double min = 0, double max = 1) {
+        return std::uniform_real_distribution<double>(min, max)(rng);
+    }
+
+    color random_color(double min = 0, double max = 1) {
+        return color(uniform(min, max), uniform(min, max), uniform(min, max));
+    }
+
+    std::vector<shared_ptr<material>> material_palette(size_t size) {
+        // Mostly diffuse and glossy materials, with some metal and glass.
+        std::vector<shared_ptr<material>> palette;
+        for (size_t m = 0; m < size; m++) {
+            auto choice = uniform();
+            if (choice < 0.5)
+                palette.push_back(make_shared<lambertian>(random_color(0.1, 0.9)));
+            else if (choice < 0.75)
+                palette.push_back(make_shared<phong>(random_color(0.1, 0.9), uniform(5, 100)));
+            else if (choice < 0.9)
+                palette.push_back(make_shared<metal>(random_color(0.5, 1), uniform(0, 0.3)));
+            else
+                palette.push_back(make_shared<dielectric>(1.5));
+        }
+        return palette;
+    }
+
+    size_t pick(size_t size) {
+        return std::uniform_int_distribution<size_t>(0, size - 1)(rng);
+    }
+
+    void spheres(hittable_list &world, size_t count) {
+        // Spheres at random in the unit cube, together filling about a tenth of it.
+        auto palette = material_palette(16);
+        auto radius = 0.3 / std::cbrt(double(count));
+        for (size_t n = 0; n < count; n++) {
+            auto center = point3(uniform(-1, 1), uniform(0, 2), uniform(-1, 1));
+            world.add(make_shared<sphere>(center, radius * uniform(0.5, 1.5), palette[pick(palette.size())]));
+        }
+    }
+
+    void quads(hittable_list &world, size_t count) {
+        // A rough terrain: a square grid of tiles at random heights and tilts.
+        auto palette = material_palette(8);
+        auto side = size_t(std::ceil(std::sqrt(double(count))));
+        auto cell = 2.0 / side;
+        for (size_t n = 0; n < count; n++) {
+            auto x = -1 + cell * (n % side);
+            auto z = -1 + cell * (n / side);
+            auto corner = point3(x, uniform(0, 0.2), z);
+            auto u = vec3(cell, uniform(-0.5, 0.5) * cell, 0);
+            auto v = vec3(0, uniform(-0.5, 0.5) * cell, cell);
+            world.add(make_shared<quad>(corner, u, v, palette[pick(palette.size())]));
+        }
+    }
+
+    void boxes(hittable_list &world, size_t count) {
+        // Instances of one box on a grid, each rotated and translated; they share the six
+        // quads of the box, so only the instances grow with the count.
+        auto palette = material_palette(8);
+        auto side = size_t(std::ceil(std::sqrt(double(count))));
+        auto cell = 2.0 / side;
+        auto size = 0.6 * cell;
+        std::vector<shared_ptr<hittable>> prototypes;
+        for (const auto &mat : palette)
+            prototypes.push_back(box(point3(-size / 2, 0, -size / 2), point3(size / 2, size, size / 2), mat));
+
+        for (size_t n = 0; n < count; n++) {
+            auto offset = vec3(-1 + cell * (n % side + 0.5), 0, -1 + cell * (n / side + 0.5));
+            shared_ptr<hittable> instance = make_shared<rotate_y>(prototypes[pick(prototypes.size())], uniform(0, 90));
+            world.add(make_shared<translate>(instance, offset));
+        }
+    }
+
+    void lights(hittable_list &world, size_t count) {
+        // Small lights of random color and power spread over the ceiling, over a few
+        // spheres. The total power does not depend on the count.
+        auto side = size_t(std::ceil(std::sqrt(double(count))));
+        auto cell = 2.0 / side;
+        auto size = 0.5 * cell;
+        auto power = 4.0 / (count * size * size);
+        for (size_t n = 0; n < count; n++) {
+            auto corner = point3(-1 + cell * (n % side) + uniform(0, cell - size), 2.5,
+                                 -1 + cell * (n / side) + uniform(0, cell - size));
+            auto light = make_shared<diffuse_light>(power * uniform(0.1, 2) * random_color(0.3, 1));
+            auto lamp = make_shared<quad>(corner, vec3(size, 0, 0), vec3(0, 0, size), light);
+            lamp->sample_solid_angle(true);
+            world.add(lamp);
+        }
+
+        auto palette = material_palette(4);
+        for (int n = 0; n < 16; n++) {
+            auto center = point3(uniform(-1, 1), 0.25, uniform(-1, 1));
+            world.add(make_shared<sphere>(center, 0.25, palette[pick(palette.size())]));
+        }
+    }
+
+    void volumes(hittable_list &world, size_t count) {
+        // Concentric spheres of thin smoke, each nested inside the last, with a solid core.
+        auto palette = material_palette(1);
+        auto center = point3(0, 1, 0);
+        for (size_t n = 0; n < count; n++) {
+            auto radius = 1.0 - 0.8 * n / count;
+            auto boundary = make_shared<sphere>(center, radius, palette[0]);
+            world.add(make_shared<constant_medium>(boundary, uniform(0.1, 1), random_color(0.5, 1)));
+        }
+        world.add(make_shared<sphere>(center, 0.15, palette[0]));
+    }
+
+    void textured(hittable_list &world, size_t count, const std::string &image) {
+        // Spheres with checker, Perlin noise and, if given, image textures.
+        std::vector<shared_ptr<texture>> textures;
+        for (int t = 0; t < 4; t++)
+            textures.push_back(make_shared<checker_texture>(uniform(0.02, 0.2), random_color(), random_color()));
+        for (int t = 0; t < 4; t++)
+            textures.push_back(make_shared<noise_texture>(uniform(1, 20)));
+        if (!image.empty())
+            textures.push_back(make_shared<image_texture>(image.c_str()));
+
+        std::vector<shared_ptr<material>> palette;
+        for (const auto &tex : textures)
+            palette.push_back(make_shared<lambertian>(tex));
+
+        auto radius = 0.3 / std::cbrt(double(count));
+        for (size_t n = 0; n < count; n++) {
+            auto center = point3(uniform(-1, 1), uniform(0, 2), uniform(-1, 1));
+            world.add(make_shared<sphere>(center, radius * uniform(0.5, 1.5), palette[pick(palette.size())]));
+        }
+    }
+
+    static void add_lamp(hittable_list &world) {
+        auto light = make_shared<diffuse_light>(color(8, 8, 8));
+        auto lamp = make_shared<quad>(point3(-0.5, 3, -0.5), vec3(1, 0, 0), vec3(0, 0, 1), light);
+        lamp->sample_solid_angle(true);
+        world.add(lamp);
+    }
+
+    static void add_ground(hittable_list &world) {
+        auto ground = make_shared<lambertian>(color(.5, .5, .5));
+        world.add(make_shared<quad>(point3(-10, 0, -10), vec3(20, 0, 0), vec3(0, 0, 20), ground));
+    }
+
+    static void set_camera(camera &cam) {
+        cam.aspect_ratio = 16.0 / 9.0;
+        cam.max_depth = 16;
+        cam.background = color(0.05, 0.05, 0.07);
+
+        cam.vfov = 40;
+        cam.lookfrom = point3(0, 2.5, 4.5);
+        cam.lookat = point3(0, 0.8, 0);
+        cam.vup = vec3(0, 1, 0);
+
+        cam.defocus_angle = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,587 @@
+#ifndef SCENE_LOADER_H
+#define SCENE_LOADER_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "bundle_format.h"
+#include "bvh.h"
+#include "json.h"
+#include "scenes.h"
+#include "texture.h"
+
+#include <fstream>
+#include <initializer_list>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Scene description files are JSON objects with these members, all optional:
+//
+//   "name"        Scene name; the file name without its extension by default
+//   "camera"      Camera settings: aspect_ratio, image_width, samples_per_pixel, max_depth,
+//                 background, vfov, lookfrom, lookat, vup, defocus_angle, focus_dist,
+//                 light_samples, bsdf_samples, seed, render_mode (bsdf, mixture, nee, mis,
+//                 cost), light_sampling (tree, power) and sampler (independent, stratified,
+//                 sobol, halton, pmj02)
+//   "environment" {"file": HDR image, "scale": 1}
+//   "textures"    Named textures, {"name": texture, ...}
+//   "materials"   Named materials, {"name": material, ...}
+//   "objects"     Array of objects
+//   "bvh"         Whether to build a BVH over the objects; true by default
+//
+// Colors and points are arrays of three numbers. A texture is a color, the name of an
+// earlier texture, or one of:
+//
+//   {"type": "solid", "color": C}
+//   {"type": "checker", "scale": S, "even": T, "odd": T}
+//   {"type": "noise", "scale": S}
+//   {"type": "image", "file": F}
+//
+// A material is the name of a material or one of (T is a texture):
+//
+//   {"type": "lambertian", "albedo": T}
+//   {"type": "phong", "albedo": T, "exponent": 1}
+//   {"type": "metal", "albedo": C, "fuzz": 0}
+//   {"type": "dielectric", "refraction_index": 1.5}
+//   {"type": "diffuse_light", "emit": T}
+//   {"type": "isotropic", "albedo": T}
+//
+// An object is one of the following. Objects with a diffuse_light material are the lights.
+//
+//   {"type": "sphere", "center": P, "radius": R, "material": M}, with "center2": P to move
+//   {"type": "quad", "q": P, "u": V, "v": V, "material": M, "sample_solid_angle": false}
+//   {"type": "box", "min": P, "max": P, "material": M}
+//   {"type": "medium", "boundary": object, "density": D, "albedo": T}
+//   {"type": "group", "objects": [objects], "bvh": false}
+//
+// Any object can also have "rotate_y" (degrees) and "translate" (a vector), applied in that
+// order. Image files are decoded in parallel before the scene is built, and one that cannot be
+// loaded is an error.
+//
+// Given a bundle_builder, the loader also records the scene into it as it goes, for writing a
+// scene bundle (see scene_bundle.h); the scene it builds then has no BVH.
+
+class scene_loader {
+public:
+    static bool load(const std::string &filename, scene &s, std::string &error, bundle_builder *bundle = nullptr) {
+        // Builds the scene described by the file. Returns false with a message on error.
+        std::ifstream in(filename, std::ios::binary);
+        if (!in) {
+            error = "could not read '" + filename + "'";
+            return false;
+        }
+        std::stringstream text;
+        text << in.rdbuf();
+
+        if (bundle)
+            bundle->add_source(filename);
+        if (!parse(text.str(), s, error, bundle)) {
+            error = "'" + filename + "': " + error;
+            return false;
+        }
+        if (s.name.empty()) {
+            auto slash = filename.find_last_of("/\\");
+            auto base = slash == std::string::npos ? filename : filename.substr(slash + 1);
+            s.name = base.substr(0, base.rfind('.'));
+        }
+        return true;
+    }
+
+    static bool parse(const std::string &text, scene &s, std::string &error, bundle_builder *bundle = nullptr) {
+        // Builds the scene described by JSON text.
+        json_value root;
+        if (!json_parser::parse(text, root, error))
+            return false;
+
+        trace_span span("load scene");
+        scene_loader loader;
+        loader.bundle = bundle;
+        if (!loader.build(root, s)) {
+            error = loader.error;
+            return false;
+        }
+        s.cam.scene_hash = bundle_hash(text.data(), text.size());
+        return true;
+    }
+
+private:
+    std::map<std::string, shared_ptr<texture>> textures;
+    std::map<std::string, shared_ptr<material>> materials;
+    std::map<std::string, shared_ptr<image_texture>> images; // Decoded image textures by file name
+    bundle_builder *bundle = nullptr;
+    std::string error;
+
+    bool fail(const json_value &at, const std::string &message) {
+        error = "line " + std::to_string(at.line) + ": " + message;
+        return false;
+    }
+
+    bool check_members(const json_value &v, const char *what, std::initializer_list<const char *> allowed) {
+        // Rejects members not in the allowed list, which are most likely misspelled.
+        if (!v.is_object())
+            return fail(v, std::string(what) + " must be an object");
+        for (const auto &member : v.object) {
+            bool known = false;
+            for (auto name : allowed)
+                known = known || member.first == name;
+            if (!known)
+                return fail(member.second, "unknown " + std::string(what) + " member \"" + member.first + "\"");
+        }
+        return true;
+    }
+
+    // Readers of optional members: each leaves the output unchanged if the member is absent
+    // and fails if it has the wrong type.
+
+    bool read(const json_value &v, const char *key, double &out) {
+        auto m = v.find(key);
+        if (!m) return true;
+        if (!m->is_number()) return fail(*m, std::string("\"") + key + "\" must be a number");
+        out = m->number;
+        return true;
+    }
+
+    bool read(const json_value &v, const char *key, int &out) {
+        double number = out;
+        if (!read(v, key, number)) return false;
+        if (number != std::floor(number)) return fail(*v.find(key), std::string("\"") + key + "\" must be an integer");
+        out = int(number);
+        return true;
+    }
+
+    bool read(const json_value &v, const char *key, unsigned &out) {
+        int number = int(out);
+        if (!read(v, key, number)) return false;
+        if (number < 0) return fail(*v.find(key), std::string("\"") + key + "\" must not be negative");
+        out = unsigned(number);
+        return true;
+    }
+
+    bool read(const json_value &v, const char *key, bool &out) {
+        auto m = v.find(key);
+        if (!m) return true;
+        if (!m->is_boolean()) return fail(*m, std::string("\"") + key + "\" must be true or false");
+        out = m->boolean;
+        return true;
+    }
+
+    bool read(const json_value &v, const char *key, std::string &out) {
+        auto m = v.find(key);
+        if (!m) return true;
+        if (!m->is_string()) return fail(*m, std::string("\"") + key + "\" must be a string");
+        out = m->string;
+        return true;
+    }
+
+    bool read(const json_value &v, const char *key, vec3 &out) {
+        auto m = v.find(key);
+        return !m || to_vec3(*m, key, out);
+    }
+
+    bool to_vec3(const json_value &v, const std::string &what, vec3 &out) {
+        if (!v.is_array() || v.array.size() != 3 || !v.array[0].is_number()
+            || !v.array[1].is_number() || !v.array[2].is_number())
+            return fail(v, "\"" + what + "\" must be an array of three numbers");
+        out = vec3(v.array[0].number, v.array[1].number, v.array[2].number);
+        return true;
+    }
+
+    template <typename T>
+    bool read_choice(
+        const json_value &v, const char *key,
+        std::initializer_list<std::pair<const char *, T>> choices, T &out
+    ) {
+        std::string name;
+        if (!read(v, key, name)) return false;
+        if (name.empty()) return true;
+        for (const auto &choice : choices) {
+            if (name == choice.first) {
+                out = choice.second;
+                return true;
+            }
+        }
+        return fail(*v.find(key), "unknown " + std::string(key) + " \"" + name + "\"");
+    }
+
+    template <typename T>
+    bool require(const json_value &v, const char *key, T &out) {
+        if (!v.find(key))
+            return fail(v, std::string("missing \"") + key + "\"");
+        return read(v, key, out);
+    }
+
+    bool load_images(const json_value &root, shared_ptr<environment_light> &environment) {
+        // Decodes every image file named in the scene, the environment included, in parallel.
+        // An image that cannot be loaded is an error at the value that names it.
+        std::vector<std::string> files;
+        std::vector<const json_value *> named_at;
+        collect_images(root, files, named_at);
+
+        std::string environment_file;
+        double environment_scale = 1;
+        auto e = root.find("environment");
+        if (e) {
+            if (!check_members(*e, "environment", {"file", "scale"})
+                || !require(*e, "file", environment_file) || !read(*e, "scale", environment_scale))
+                return false;
+        }
+
+        std::vector<shared_ptr<image_texture>> decoded(files.size());
+        int jobs = int(files.size()) + (environment_file.empty() ? 0 : 1);
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (int n = 0; n < jobs; n++) {
+            if (n < int(files.size()))
+                decoded[n] = make_shared<image_texture>(files[n].c_str());
+            else
+                environment = make_shared<environment_light>(environment_file.c_str(), environment_scale);
+        }
+
+        for (size_t n = 0; n < files.size(); n++) {
+            if (decoded[n]->image_data().width() == 0)
+                return fail(*named_at[n], "could not load image \"" + files[n] + "\"");
+            images[files[n]] = decoded[n];
+        }
+        if (environment && environment->image_data().width() == 0)
+            return fail(*e->find("file"), "could not load image \"" + environment_file + "\"");
+        return true;
+    }
+
+    void collect_images(
+        const json_value &v, std::vector<std::string> &files, std::vector<const json_value *> &named_at
+    ) {
+        // Appends the file of every image texture in v, once each, with the value that names it.
+        if (v.is_object()) {
+            auto type = v.find("type");
+            auto file = v.find("file");
+            if (type && type->is_string() && type->string == "image" && file && file->is_string()) {
+                bool seen = false;
+                for (const auto &f : files)
+                    seen = seen || f == file->string;
+                if (!seen) {
+                    files.push_back(file->string);
+                    named_at.push_back(file);
+                }
+            }
+            for (const auto &member : v.object)
+                collect_images(member.second, files, named_at);
+        } else if (v.is_array()) {
+            for (const auto &element : v.array)
+                collect_images(element, files, named_at);
+        }
+    }
+
+    bool build(const json_value &root, scene &s) {
+        if (!check_members(root, "scene",
+                           {"name", "camera", "environment", "textures", "materials", "objects", "bvh"}))
+            return false;
+
+        s = scene();
+        if (!read(root, "name", s.name) || !load_images(root, s.cam.environment))
+            return false;
+
+        if (auto t = root.find("textures")) {
+            if (!t->is_object())
+                return fail(*t, "\"textures\" must be an object");
+            for (const auto &member : t->object) {
+                if (!make_texture(member.second, textures[member.first]))
+                    return false;
+            }
+        }
+
+        if (auto m = root.find("materials")) {
+            if (!m->is_object())
+                return fail(*m, "\"materials\" must be an object");
+            for (const auto &member : m->object) {
+                if (!make_material(member.second, materials[member.first]))
+                    return false;
+            }
+        }
+
+        if (auto c = root.find("camera")) {
+            if (!read_camera(*c, s.cam))
+                return false;
+        }
+
+        hittable_list objects;
+        if (auto o = root.find("objects")) {
+            if (!read_objects(*o, objects))
+                return false;
+        }
+
+        bool use_bvh = true;
+        if (!read(root, "bvh", use_bvh))
+            return false;
+        if (use_bvh && !objects.objects.empty() && !bundle)
+            s.world.add(make_shared<bvh_node>(objects));
+        else
+            s.world = objects;
+        return true;
+    }
+
+    bool read_camera(const json_value &v, camera &cam) {
+        if (!check_members(v, "camera",
+                           {"aspect_ratio", "image_width", "samples_per_pixel", "max_depth", "background",
+                            "vfov", "lookfrom", "lookat", "vup", "defocus_angle", "focus_dist",
+                            "light_samples", "bsdf_samples", "seed", "render_mode", "light_sampling",
+                            "sampler"}))
+            return false;
+
+        using mode = camera::RenderMode;
+        using lights = camera::LightSampling;
+        using pattern = camera::SamplerType;
+        return read(v, "aspect_ratio", cam.aspect_ratio)
+            && read(v, "image_width", cam.image_width)
+            && read(v, "samples_per_pixel", cam.samples_per_pixel)
+            && read(v, "max_depth", cam.max_depth)
+            && read(v, "background", cam.background)
+            && read(v, "vfov", cam.vfov)
+            && read(v, "lookfrom", cam.lookfrom)
+            && read(v, "lookat", cam.lookat)
+            && read(v, "vup", cam.vup)
+            && read(v, "defocus_angle", cam.defocus_angle)
+            && read(v, "focus_dist", cam.focus_dist)
+            && read(v, "light_samples", cam.light_samples)
+            && read(v, "bsdf_samples", cam.bsdf_samples)
+            && read(v, "seed", cam.seed)
+            && read_choice<mode>(v, "render_mode",
+                                 {{"bsdf", mode::BSDF_SAMPLING}, {"mixture", mode::MIXTURE_SAMPLING},
+                                  {"nee", mode::NEE}, {"mis", mode::MIS}, {"cost", mode::COST}},
+                                 cam.render_mode)
+            && read_choice<lights>(v, "light_sampling",
+                                   {{"tree", lights::TREE}, {"power", lights::POWER}}, cam.light_sampling)
+            && read_choice<pattern>(v, "sampler",
+                                    {{"independent", pattern::INDEPENDENT}, {"stratified", pattern::STRATIFIED},
+                                     {"sobol", pattern::SOBOL}, {"halton", pattern::HALTON},
+                                     {"pmj02", pattern::PMJ02}},
+                                    cam.sampler_type);
+    }
+
+    bool make_texture(const json_value &v, shared_ptr<texture> &out) {
+        if (v.is_string()) {
+            auto found = textures.find(v.string);
+            if (found == textures.end() || !found->second)
+                return fail(v, "unknown texture \"" + v.string + "\"");
+            out = found->second;
+            return true;
+        }
+        if (v.is_array()) {
+            color c;
+            if (!to_vec3(v, "color", c)) return false;
+            out = make_shared<solid_color>(c);
+            if (bundle) bundle->add_solid(out, c);
+            return true;
+        }
+
+        std::string type;
+        if (!v.is_object() || !require(v, "type", type))
+            return fail(v, "a texture is a color, a texture name or an object with a type");
+
+        if (type == "solid") {
+            color c;
+            if (!check_members(v, "texture", {"type", "color"}) || !require(v, "color", c)) return false;
+            out = make_shared<solid_color>(c);
+            if (bundle) bundle->add_solid(out, c);
+        } else if (type == "checker") {
+            double scale = 1;
+            shared_ptr<texture> even, odd;
+            if (!check_members(v, "texture", {"type", "scale", "even", "odd"}) || !read(v, "scale", scale)
+                || !texture_member(v, "even", even) || !texture_member(v, "odd", odd))
+                return false;
+            out = make_shared<checker_texture>(scale, even, odd);
+            if (bundle) bundle->add_checker(out, scale, even, odd);
+        } else if (type == "noise") {
+            double scale = 1;
+            if (!check_members(v, "texture", {"type", "scale"}) || !read(v, "scale", scale)) return false;
+            auto noise = make_shared<noise_texture>(scale);
+            out = noise;
+            if (bundle) bundle->add_noise(noise, scale);
+        } else if (type == "image") {
+            std::string file;
+            if (!check_members(v, "texture", {"type", "file"}) || !require(v, "file", file)) return false;
+            out = images[file];
+            if (bundle) bundle->add_image(images[file]);
+        } else {
+            return fail(v, "unknown texture type \"" + type + "\"");
+        }
+        return true;
+    }
+
+    bool texture_member(const json_value &v, const char *key, shared_ptr<texture> &out) {
+        auto m = v.find(key);
+        if (!m)
+            return fail(v, std::string("missing \"") + key + "\"");
+        return make_texture(*m, out);
+    }
+
+    bool make_material(const json_value &v, shared_ptr<material> &out) {
+        if (v.is_string()) {
+            auto found = materials.find(v.string);
+            if (found == materials.end() || !found->second)
+                return fail(v, "unknown material \"" + v.string + "\"");
+            out = found->second;
+            return true;
+        }
+
+        std::string type;
+        if (!v.is_object() || !require(v, "type", type))
+            return fail(v, "a material is a material name or an object with a type");
+
+        shared_ptr<texture> tex;
+        if (type == "lambertian") {
+            if (!check_members(v, "material", {"type", "albedo"}) || !texture_member(v, "albedo", tex))
+                return false;
+            out = make_shared<lambertian>(tex);
+            if (bundle) bundle->add_material(out, bundle_material::LAMBERTIAN, tex);
+        } else if (type == "phong") {
+            double exponent = 1;
+            if (!check_members(v, "material", {"type", "albedo", "exponent"}) || !texture_member(v, "albedo", tex)
+                || !read(v, "exponent", exponent))
+                return false;
+            out = make_shared<phong>(tex, exponent);
+            if (bundle) bundle->add_material(out, bundle_material::PHONG, tex, color(), exponent);
+        } else if (type == "metal") {
+            color albedo;
+            double fuzz = 0;
+            if (!check_members(v, "material", {"type", "albedo", "fuzz"}) || !require(v, "albedo", albedo)
+                || !read(v, "fuzz", fuzz))
+                return false;
+            out = make_shared<metal>(albedo, fuzz);
+            if (bundle) bundle->add_material(out, bundle_material::METAL, nullptr, albedo, fuzz);
+        } else if (type == "dielectric") {
+            double refraction_index = 1.5;
+            if (!check_members(v, "material", {"type", "refraction_index"})
+                || !read(v, "refraction_index", refraction_index))
+                return false;
+            out = make_shared<dielectric>(refraction_index);
+            if (bundle) bundle->add_material(out, bundle_material::DIELECTRIC, nullptr, color(), refraction_index);
+        } else if (type == "diffuse_light") {
+            if (!check_members(v, "material", {"type", "emit"}) || !texture_member(v, "emit", tex))
+                return false;
+            out = make_shared<diffuse_light>(tex);
+            if (bundle) bundle->add_material(out, bundle_material::DIFFUSE_LIGHT, tex);
+        } else if (type == "isotropic") {
+            if (!check_members(v, "material", {"type", "albedo"}) || !texture_member(v, "albedo", tex))
+                return false;
+            out = make_shared<isotropic>(tex);
+            if (bundle) bundle->add_material(out, bundle_material::ISOTROPIC, tex);
+        } else {
+            return fail(v, "unknown material type \"" + type + "\"");
+        }
+        return true;
+    }
+
+    bool material_member(const json_value &v, shared_ptr<material> &out) {
+        auto m = v.find("material");
+        if (!m)
+            return fail(v, "missing \"material\"");
+        return make_material(*m, out);
+    }
+
+    bool read_objects(const json_value &v, hittable_list &list) {
+        if (!v.is_array())
+            return fail(v, "\"objects\" must be an array");
+        for (const auto &element : v.array) {
+            shared_ptr<hittable> object;
+            if (!make_object(element, object))
+                return false;
+            list.add(object);
+        }
+        return true;
+    }
+
+    bool make_object(const json_value &v, shared_ptr<hittable> &out) {
+        std::string type;
+        if (!v.is_object() || !require(v, "type", type))
+            return fail(v, "an object is an object with a type");
+
+        shared_ptr<material> mat;
+        auto since = bundle ? bundle->current() : bundle_builder::mark();
+        if (type == "sphere") {
+            point3 center, center2;
+            double radius = 1;
+            if (!check_members(v, "sphere", {"type", "center", "center2", "radius", "material", "rotate_y", "translate"})
+                || !require(v, "center", center) || !require(v, "radius", radius) || !material_member(v, mat))
+                return false;
+            center2 = center;
+            if (!read(v, "center2", center2))
+                return false;
+            if (v.find("center2"))
+                out = make_shared<sphere>(center, center2, radius, mat);
+            else
+                out = make_shared<sphere>(center, radius, mat);
+            if (bundle) bundle->add_sphere(center, center2, radius, mat);
+        } else if (type == "quad") {
+            point3 q;
+            vec3 u, w;
+            bool solid_angle = false;
+            if (!check_members(v, "quad", {"type", "q", "u", "v", "material", "sample_solid_angle", "rotate_y", "translate"})
+                || !require(v, "q", q) || !require(v, "u", u) || !require(v, "v", w) || !material_member(v, mat)
+                || !read(v, "sample_solid_angle", solid_angle))
+                return false;
+            auto object = make_shared<quad>(q, u, w, mat);
+            object->sample_solid_angle(solid_angle);
+            out = object;
+            if (bundle) bundle->add_quad(q, u, w, mat, solid_angle);
+        } else if (type == "box") {
+            point3 a, b;
+            if (!check_members(v, "box", {"type", "min", "max", "material", "rotate_y", "translate"})
+                || !require(v, "min", a) || !require(v, "max", b) || !material_member(v, mat))
+                return false;
+            out = box(a, b, mat);
+            if (bundle) bundle->add_box(a, b, mat);
+        } else if (type == "medium") {
+            double density = 1;
+            shared_ptr<hittable> boundary;
+            shared_ptr<texture> albedo;
+            if (!check_members(v, "medium", {"type", "boundary", "density", "albedo", "rotate_y", "translate"})
+                || !require(v, "density", density) || !texture_member(v, "albedo", albedo))
+                return false;
+            auto b = v.find("boundary");
+            if (!b)
+                return fail(v, "missing \"boundary\"");
+            if (!make_object(*b, boundary))
+                return false;
+            out = make_shared<constant_medium>(boundary, density, albedo);
+            if (bundle) bundle->add_medium(since, density, albedo);
+        } else if (type == "group") {
+            bool use_bvh = false;
+            hittable_list list;
+            auto o = v.find("objects");
+            if (!check_members(v, "group", {"type", "objects", "bvh", "rotate_y", "translate"}) || !read(v, "bvh", use_bvh))
+                return false;
+            if (!o)
+                return fail(v, "missing \"objects\"");
+            if (!read_objects(*o, list))
+                return false;
+            if (use_bvh && !list.objects.empty() && !bundle)
+                out = make_shared<bvh_node>(list);
+            else
+                out = make_shared<hittable_list>(list);
+        } else {
+            return fail(v, "unknown object type \"" + type + "\"");
+        }
+
+        double angle = 0;
+        vec3 offset;
+        if (!read(v, "rotate_y", angle) || !read(v, "translate", offset))
+            return false;
+        if (v.find("rotate_y")) {
+            out = make_shared<rotate_y>(out, angle);
+            if (bundle) bundle->rotate(since, angle);
+        }
+        if (v.find("translate")) {
+            out = make_shared<translate>(out, offset);
+            if (bundle) bundle->translate(since, offset);
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef SCENES_H
+#define SCENES_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "camera.h"
+#include "constant_medium.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "quad.h"
+#include "sphere.h"
+
+#include <string>
+#include <vector>
+
+struct scene {
+    // A world and a camera set up to view it. Image size, sample counts and render mode are
+    // left to the caller.
+    std::string name;
+    hittable_list world;
+    camera cam;
+};
+
+inline void cornell_box_walls(hittable_list &world, bool with_lamp = true) {
+    auto red = make_shared<lambertian>(color(.65, .05, .05));
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    auto green = make_shared<lambertian>(color(.12, .45, .15));
+    auto light = make_shared<diffuse_light>(color(15, 15, 15));
+
+    // Cornell box sides
+    world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 0, 555), vec3(0, 555, 0), green));
+    world.add(make_shared<quad>(point3(0, 0, 555), vec3(0, 0, -555), vec3(0, 555, 0), red));
+    world.add(make_shared<quad>(point3(0, 555, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
+    world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 0, -555), white));
+    world.add(make_shared<quad>(point3(555, 0, 555), vec3(-555, 0, 0), vec3(0, 555, 0), white));
+
+    // Light
+    if (with_lamp) {
+        auto lamp = make_shared<quad>(point3(213, 554, 227), vec3(130, 0, 0), vec3(0, 0, 105), light);
+        lamp->sample_solid_angle(true);
+        world.add(lamp);
+    }
+}
+
+inline void cornell_box_camera(camera &cam) {
+    cam.aspect_ratio = 1.0;
+    cam.max_depth = 50;
+    cam.background = color(0, 0, 0);
+
+    cam.vfov = 40;
+    cam.lookfrom = point3(278, 278, -800);
+    cam.lookat = point3(278, 278, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+}
+
+inline shared_ptr<hittable> cornell_box_tall_box(shared_ptr<material> mat) {
+    shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), mat);
+    box1 = make_shared<rotate_y>(box1, 15);
+    return make_shared<translate>(box1, vec3(265, 0, 295));
+}
+
+inline scene cornell_box_scene() {
+    // The Cornell box with a Phong box and a blue Phong sphere.
+    scene s;
+    s.name = "cornell";
+    cornell_box_walls(s.world);
+
+    // Box
+    auto white_phong = make_shared<phong>(color(.73, .73, .73), 30);
+    s.world.add(cornell_box_tall_box(white_phong));
+
+    // Blue Phong Sphere
+    auto blue_phong = make_shared<phong>(color((double)30/255, (double)144/255, 1), 30);
+    s.world.add(make_shared<sphere>(point3(190, 90, 190), 90, blue_phong));
+
+    cornell_box_camera(s.cam);
+    return s;
+}
+
+inline scene cornell_glass_scene() {
+    // Caustics and specular chains: the sphere is glass.
+    scene s;
+    s.name = "glass";
+    cornell_box_walls(s.world);
+
+    auto white_phong = make_shared<phong>(color(.73, .73, .73), 30);
+    s.world.add(cornell_box_tall_box(white_phong));
+
+    auto glass = make_shared<dielectric>(1.5);
+    s.world.add(make_shared<sphere>(point3(190, 90, 190), 90, glass));
+
+    cornell_box_camera(s.cam);
+    return s;
+}
+
+inline scene cornell_many_lights_scene() {
+    // The lamp is replaced by an 8 x 8 grid of small lights of varied color, with the same
+    // total power, so light selection matters.
+    scene s;
+    s.name = "many_lights";
+    cornell_box_walls(s.world, false);
+
+    const int n = 8;
+    const double cell = 400.0 / n, size = 12;
+    auto area_scale = (130.0 * 105.0) / (n * n * size * size);
+    for (int a = 0; a < n; a++) {
+        for (int b = 0; b < n; b++) {
+            auto tint = color(0.5 + 0.5 * a / (n - 1), 0.75, 0.5 + 0.5 * b / (n - 1));
+            auto light = make_shared<diffuse_light>(15 * area_scale * tint);
+            auto corner = point3(77.5 + a * cell + (cell - size) / 2, 554, 77.5 + b * cell + (cell - size) / 2);
+            auto lamp = make_shared<quad>(corner, vec3(size, 0, 0), vec3(0, 0, size), light);
+            lamp->sample_solid_angle(true);
+            s.world.add(lamp);
+        }
+    }
+
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    s.world.add(cornell_box_tall_box(white));
+    s.world.add(make_shared<sphere>(point3(190, 90, 190), 90, white));
+
+    cornell_box_camera(s.cam);
+    return s;
+}
+
+inline scene cornell_volume_scene() {
+    // Participating media: the box is filled with white smoke and the sphere with a thin
+    // blue fog.
+    scene s;
+    s.name = "volume";
+    cornell_box_walls(s.world);
+
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    s.world.add(make_shared<constant_medium>(cornell_box_tall_box(white), 0.01, color(1, 1, 1)));
+
+    auto fog = make_shared<sphere>(point3(190, 90, 190), 90, white);
+    s.world.add(make_shared<constant_medium>(fog, 0.005, color(0.2, 0.4, 0.9)));
+
+    cornell_box_camera(s.cam);
+    return s;
+}
+
+inline std::vector<std::string> scene_names() {
+    return {"cornell", "glass", "many_lights", "volume"};
+}
+
+inline bool make_scene(const std::string &name, scene &s) {
+    // Builds the canonical scene of the given name. Returns false for an unknown name.
+    if (name == "cornell") s = cornell_box_scene();
+    else if (name == "glass") s = cornell_glass_scene();
+    else if (name == "many_lights") s = cornell_many_lights_scene();
+    else if (name == "volume") s = cornell_volume_scene();
+    else return false;
+    return true;
+}
+
+#endif
@@ -12,9 +12,10 @@
 //==============================================================================================
 
 #include "hittable.h"
+#include "material.h"
 #include "onb.h"
 
-class sphere : public hittable {
+class sphere : public hittable, private memory_tracked<sphere, memory_category::GEOMETRY> {
 public:
     // Stationary Sphere
     sphere(const point3 &static_center, double radius, shared_ptr<material> mat) :
@@ -34,32 +35,19 @@ public:
     }
 
     bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+        count_stat(stat_counter::PRIMITIVE_TESTS);
         point3 current_center = center.at(r.time());
-        vec3 oc = current_center - r.origin();
-        auto a = r.direction().length_squared();
-        auto h = dot(r.direction(), oc);
-        auto c = oc.length_squared() - radius * radius;
-
-        auto discriminant = h * h - a * c;
-        if (discriminant < 0)
+        double root;
+        if (!intersect(current_center, radius, r, ray_t, root))
             return false;
 
-        auto sqrtd = std::sqrt(discriminant);
-
-        // Find the nearest root that lies in the acceptable range.
-        auto root = (h - sqrtd) / a;
-        if (!ray_t.surrounds(root)) {
-            root = (h + sqrtd) / a;
-            if (!ray_t.surrounds(root))
-                return false;
-        }
-
         rec.t = root;
         rec.p = r.at(rec.t);
         vec3 outward_normal = (rec.p - current_center) / radius;
         rec.set_face_normal(r, outward_normal);
         get_sphere_uv(outward_normal, rec.u, rec.v);
         rec.mat = mat;
+        rec.primitive_id = id();
 
         return true;
     }
@@ -89,11 +77,41 @@ public:
         return uvw.transform(random_to_sphere(radius, distance_squared));
     }
 
-private:
-    ray center;
-    double radius;
-    shared_ptr<material> mat;
-    aabb bbox;
+    bool emitter_bounds(light_bounds &lb) const override {
+        if (!mat)
+            return false;
+
+        // Normals cover the whole sphere of directions.
+        auto phi = luminance(mat->average_emission()) * 4 * pi * radius * radius * pi;
+        if (phi <= 0)
+            return false;
+
+        lb = light_bounds(bbox, vec3(0, 0, 1), phi, -1, 0);
+        return true;
+    }
+
+    static bool intersect(const point3 &center, double radius, const ray &r, interval ray_t, double &root) {
+        // Finds the nearest root of the ray-sphere equation that lies in ray_t.
+        vec3 oc = center - r.origin();
+        auto a = r.direction().length_squared();
+        auto h = dot(r.direction(), oc);
+        auto c = oc.length_squared() - radius * radius;
+
+        auto discriminant = h * h - a * c;
+        if (discriminant < 0)
+            return false;
+
+        auto sqrtd = std::sqrt(discriminant);
+
+        // Find the nearest root that lies in the acceptable range.
+        root = (h - sqrtd) / a;
+        if (!ray_t.surrounds(root)) {
+            root = (h + sqrtd) / a;
+            if (!ray_t.surrounds(root))
+                return false;
+        }
+        return true;
+    }
 
     static void get_sphere_uv(const point3 &p, double &u, double &v) {
         // p: a given point on the sphere of radius one, centered at the origin.
@@ -110,6 +128,12 @@ private:
         v = theta / pi;
     }
 
+private:
+    ray center;
+    double radius;
+    shared_ptr<material> mat;
+    aabb bbox;
+
     static vec3 random_to_sphere(double radius, double distance_squared) {
         auto r1 = random_double();
         auto r2 = random_double();
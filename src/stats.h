@@ -0,0 +1,290 @@
+#ifndef STATS_H
+#define STATS_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "memory_stats.h"
+#include "perf_counters.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Render statistics are counted when RTW_STATS is defined (the CMake option of the same
+// name). Without it, the counting functions are empty and compile away.
+
+enum class stat_counter {
+    CAMERA_RAYS,         // Rays generated by the camera
+    RAYS,                // Rays traced against the world, of any kind
+    SHADOW_RAYS,         // Light sample rays of next event estimation
+    BVH_NODES,           // BVH nodes visited
+    PRIMITIVE_TESTS,     // Ray-primitive intersection tests
+    NEE_SAMPLES,         // Light samples taken
+    NEE_UNOCCLUDED,      // Light samples that reached an emitter
+    PATH_VERTICES,       // Path vertices reached, the sum of the bounce histogram
+    SCATTER_LAMBERTIAN,  // Scatter calls per material type
+    SCATTER_PHONG,
+    SCATTER_METAL,
+    SCATTER_DIELECTRIC,
+    SCATTER_ISOTROPIC,
+    SCATTER_EMITTER,     // Materials that do not scatter, such as lights
+    COUNT
+};
+
+class render_stats {
+public:
+    static const int max_bounce = 63; // Deeper bounces share the last histogram bucket
+
+    uint64_t counters[int(stat_counter::COUNT)] = {};
+    uint64_t bounces[max_bounce + 1] = {}; // Path vertices reached, by bounce
+
+    uint64_t operator[](stat_counter s) const { return counters[int(s)]; }
+
+    void merge(const render_stats &other) {
+        for (int c = 0; c < int(stat_counter::COUNT); c++)
+            counters[c] += other.counters[c];
+        for (int b = 0; b <= max_bounce; b++)
+            bounces[b] += other.bounces[b];
+    }
+
+    void clear() {
+        *this = render_stats();
+    }
+};
+
+class stats_registry {
+    // Every thread counts into its own block, so counting never contends. The blocks are
+    // registered here and summed on demand; a thread that exits leaves its counts behind.
+
+public:
+    static stats_registry &instance() {
+        static stats_registry registry;
+        return registry;
+    }
+
+    static render_stats &local() {
+        // The plain pointer keeps the hot path to one thread-local load; the holder, which
+        // has a destructor, is only touched on a thread's first count.
+        static thread_local render_stats *block = nullptr;
+        if (!block) {
+            static thread_local holder h;
+            block = &h.stats;
+        }
+        return *block;
+    }
+
+    render_stats collect() {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto total = retired;
+        for (auto block : live)
+            total.merge(*block);
+        return total;
+    }
+
+    void reset() {
+        // Only call while no thread is counting.
+        std::lock_guard<std::mutex> lock(mutex);
+        retired.clear();
+        for (auto block : live)
+            block->clear();
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<render_stats *> live;
+    render_stats retired;
+
+    struct holder {
+        render_stats stats;
+
+        holder() {
+            auto &registry = instance();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            registry.live.push_back(&stats);
+        }
+
+        ~holder() {
+            auto &registry = instance();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            registry.retired.merge(stats);
+            for (auto &block : registry.live) {
+                if (block == &stats) {
+                    block = registry.live.back();
+                    registry.live.pop_back();
+                    break;
+                }
+            }
+        }
+    };
+};
+
+inline void write_perf_json(std::ostream &out, const perf_report &report, uint64_t rays) {
+    // Writes the hardware counters of each phase, with their IPC, and the misses per ray of
+    // the render (when the rays were counted) and of the sampled traversal and shading.
+    char buffer[64];
+    auto number = [&](double x) {
+        std::snprintf(buffer, sizeof buffer, "%.6g", x);
+        return std::string(buffer);
+    };
+    auto per = [&](uint64_t count, uint64_t n) {
+        return number(n ? double(count) / double(n) : 0.0);
+    };
+    auto phase = [&](const perf_sample &s, uint64_t per_rays) {
+        std::string text = "{\"cpu_seconds\": " + number(s[perf_event_kind::TASK_CLOCK] * 1e-9);
+        if (report.hardware) {
+            text += ", \"cycles\": " + std::to_string(s[perf_event_kind::CYCLES])
+                  + ", \"instructions\": " + std::to_string(s[perf_event_kind::INSTRUCTIONS])
+                  + ", \"ipc\": " + number(s.ipc())
+                  + ", \"l1d_misses\": " + std::to_string(s[perf_event_kind::L1D_MISSES])
+                  + ", \"llc_misses\": " + std::to_string(s[perf_event_kind::LLC_MISSES])
+                  + ", \"branch_misses\": " + std::to_string(s[perf_event_kind::BRANCH_MISSES]);
+            if (per_rays) {
+                text += ", \"per_ray\": {\"l1d_misses\": " + per(s[perf_event_kind::L1D_MISSES], per_rays)
+                      + ", \"llc_misses\": " + per(s[perf_event_kind::LLC_MISSES], per_rays)
+                      + ", \"branch_misses\": " + per(s[perf_event_kind::BRANCH_MISSES], per_rays)
+                      + ", \"cycles\": " + per(s[perf_event_kind::CYCLES], per_rays) + "}";
+            }
+        }
+        return text + "}";
+    };
+
+    out << "{\n    \"hardware_counters\": " << (report.hardware ? "true" : "false");
+    if (!report.error.empty()) {
+        std::string error;
+        for (auto c : report.error)
+            if (c != '"' && c != '\\') error += c;
+        out << ",\n    \"error\": \"" << error << '"';
+    }
+    out << ",\n    \"sample_interval\": " << perf_profiler::sample_interval
+        << ",\n    \"sampled_rays\": " << report.sampled_rays
+        << ",\n    \"build\": " << phase(report.phases[int(perf_phase::BUILD)], 0)
+        << ",\n    \"render\": " << phase(report.phases[int(perf_phase::RENDER)], rays)
+        << ",\n    \"traversal\": " << phase(report.phases[int(perf_phase::TRAVERSAL)], report.sampled_rays)
+        << ",\n    \"shading\": " << phase(report.shading(), report.sampled_rays)
+        << ",\n    \"threads\": [";
+    for (size_t t = 0; t < report.threads.size(); t++) {
+        const auto &thread = report.threads[t];
+        out << (t ? "," : "") << "\n      {\"thread\": " << thread.thread
+            << ", \"build\": " << phase(thread.phases[int(perf_phase::BUILD)], 0)
+            << ", \"render\": " << phase(thread.phases[int(perf_phase::RENDER)], 0) << "}";
+    }
+    out << "\n    ]\n  }";
+}
+
+struct stage_times {
+    // Wall-clock seconds spent in each stage of a render.
+    double build = 0;  // Light structures, camera setup and output setup
+    double render = 0; // Sampling, and denoising if enabled
+    double output = 0; // Writing what the render stage has not already streamed out
+};
+
+inline void write_stats_json(
+    std::ostream &out, const render_stats &stats, const stage_times &times,
+    const perf_report *hardware = nullptr
+) {
+    // Writes the statistics as a JSON object. Without RTW_STATS only the times are known. The
+    // hardware counters, if given, follow as their own object.
+    char buffer[64];
+    auto number = [&](double x) {
+        std::snprintf(buffer, sizeof buffer, "%.6g", x);
+        return std::string(buffer);
+    };
+    auto ratio = [&](stat_counter a, stat_counter b) {
+        return number(stats[b] ? double(stats[a]) / double(stats[b]) : 0.0);
+    };
+
+#ifdef RTW_STATS
+    out << "{\n  \"enabled\": true,\n";
+#else
+    out << "{\n  \"enabled\": false,\n";
+#endif
+
+    out << "  \"time\": {\"build\": " << number(times.build)
+        << ", \"render\": " << number(times.render)
+        << ", \"output\": " << number(times.output)
+        << ", \"total\": " << number(times.build + times.render + times.output) << "},\n";
+
+    out << "  \"camera_rays\": " << stats[stat_counter::CAMERA_RAYS] << ",\n"
+        << "  \"rays\": " << stats[stat_counter::RAYS] << ",\n"
+        << "  \"shadow_rays\": " << stats[stat_counter::SHADOW_RAYS] << ",\n"
+        << "  \"bvh_nodes_visited\": " << stats[stat_counter::BVH_NODES] << ",\n"
+        << "  \"primitive_tests\": " << stats[stat_counter::PRIMITIVE_TESTS] << ",\n"
+        << "  \"path_vertices\": " << stats[stat_counter::PATH_VERTICES] << ",\n"
+        << "  \"bvh_nodes_per_ray\": " << ratio(stat_counter::BVH_NODES, stat_counter::RAYS) << ",\n"
+        << "  \"primitive_tests_per_ray\": " << ratio(stat_counter::PRIMITIVE_TESTS, stat_counter::RAYS) << ",\n"
+        << "  \"rays_per_second\": "
+        << number(times.render > 0 ? stats[stat_counter::RAYS] / times.render : 0.0) << ",\n";
+
+    out << "  \"nee\": {\"samples\": " << stats[stat_counter::NEE_SAMPLES]
+        << ", \"unoccluded\": " << stats[stat_counter::NEE_UNOCCLUDED]
+        << ", \"success_rate\": " << ratio(stat_counter::NEE_UNOCCLUDED, stat_counter::NEE_SAMPLES) << "},\n";
+
+    out << "  \"scatter_calls\": {"
+        << "\"lambertian\": " << stats[stat_counter::SCATTER_LAMBERTIAN]
+        << ", \"phong\": " << stats[stat_counter::SCATTER_PHONG]
+        << ", \"metal\": " << stats[stat_counter::SCATTER_METAL]
+        << ", \"dielectric\": " << stats[stat_counter::SCATTER_DIELECTRIC]
+        << ", \"isotropic\": " << stats[stat_counter::SCATTER_ISOTROPIC]
+        << ", \"emitter\": " << stats[stat_counter::SCATTER_EMITTER] << "},\n";
+
+    // The histogram ends at the deepest bounce reached.
+    int deepest = render_stats::max_bounce;
+    while (deepest >= 0 && stats.bounces[deepest] == 0)
+        deepest--;
+    out << "  \"bounce_histogram\": [";
+    for (int b = 0; b <= deepest; b++)
+        out << (b ? ", " : "") << stats.bounces[b];
+    out << "],\n";
+
+    // Memory is the state when the statistics are written, with peaks since the start.
+    auto &memory = memory_tracker::instance();
+    out << "  \"memory\": {\"bytes\": " << memory.total_bytes()
+        << ", \"peak\": " << memory.total_peak_bytes()
+        << ", \"peak_resident\": " << peak_resident_bytes() << ", \"categories\": {";
+    for (int c = 0; c < int(memory_category::COUNT); c++) {
+        auto category = memory_category(c);
+        out << (c ? ", " : "") << '"' << memory_category_name(category) << "\": {\"bytes\": "
+            << memory.bytes(category) << ", \"peak\": " << memory.peak_bytes(category) << "}";
+    }
+    out << "}}";
+
+    if (hardware && hardware->enabled) {
+        out << ",\n  \"hardware\": ";
+        write_perf_json(out, *hardware, stats[stat_counter::RAYS]);
+    }
+    out << "\n}\n";
+}
+
+#ifdef RTW_STATS
+
+static const bool stats_enabled = true;
+
+inline void count_stat(stat_counter s, uint64_t n = 1) {
+    stats_registry::local().counters[int(s)] += n;
+}
+
+inline void count_bounce(int bounce) {
+    auto &stats = stats_registry::local();
+    stats.bounces[bounce < render_stats::max_bounce ? bounce : render_stats::max_bounce]++;
+    stats.counters[int(stat_counter::PATH_VERTICES)]++;
+}
+
+#else
+
+static const bool stats_enabled = false;
+
+inline void count_stat(stat_counter, uint64_t = 1) {}
+inline void count_bounce(int) {}
+
+#endif
+
+#endif
@@ -19,9 +19,14 @@ public:
     virtual ~texture() = default;
 
     virtual color value(double u, double v, const point3 &p) const = 0;
+
+    virtual color average() const {
+        // Returns the mean value of the texture, used to estimate the power of emitters.
+        return value(0.5, 0.5, point3(0, 0, 0));
+    }
 };
 
-class solid_color : public texture {
+class solid_color : public texture, private memory_tracked<solid_color, memory_category::TEXTURES> {
 public:
     solid_color(const color &albedo) :
         albedo(albedo) {
@@ -35,11 +40,15 @@ public:
         return albedo;
     }
 
+    color average() const override {
+        return albedo;
+    }
+
 private:
     color albedo;
 };
 
-class checker_texture : public texture {
+class checker_texture : public texture, private memory_tracked<checker_texture, memory_category::TEXTURES> {
 public:
     checker_texture(double scale, shared_ptr<texture> even, shared_ptr<texture> odd) :
         inv_scale(1.0 / scale), even(even), odd(odd) {
@@ -59,18 +68,29 @@ public:
         return isEven ? even->value(u, v, p) : odd->value(u, v, p);
     }
 
+    color average() const override {
+        return 0.5 * (even->average() + odd->average());
+    }
+
 private:
     double inv_scale;
     shared_ptr<texture> even;
     shared_ptr<texture> odd;
 };
 
-class image_texture : public texture {
+class image_texture : public texture, private memory_tracked<image_texture, memory_category::TEXTURES> {
 public:
     image_texture(const char *filename) :
         image(filename) {
     }
 
+    image_texture(const float *pixels, const unsigned char *bytes, int width, int height) {
+        // Uses decoded pixels that live elsewhere, such as in a scene bundle (see rtw_image::view).
+        image.view(pixels, bytes, width, height);
+    }
+
+    const rtw_image &image_data() const { return image; }
+
     color value(double u, double v, const point3 &p) const override {
         // If we have no texture data, then return solid cyan as a debugging aid.
         if (image.height() <= 0) return color(0, 1, 1);
@@ -87,20 +107,47 @@ public:
         return color(color_scale * pixel[0], color_scale * pixel[1], color_scale * pixel[2]);
     }
 
+    color average() const override {
+        if (image.height() <= 0) return color(0, 1, 1);
+
+        double r = 0, g = 0, b = 0;
+        for (int j = 0; j < image.height(); j++) {
+            for (int i = 0; i < image.width(); i++) {
+                auto pixel = image.pixel_data(i, j);
+                r += pixel[0];
+                g += pixel[1];
+                b += pixel[2];
+            }
+        }
+
+        auto color_scale = 1.0 / (255.0 * image.width() * image.height());
+        return color(color_scale * r, color_scale * g, color_scale * b);
+    }
+
 private:
     rtw_image image;
 };
 
-class noise_texture : public texture {
+class noise_texture : public texture, private memory_tracked<noise_texture, memory_category::TEXTURES> {
 public:
     noise_texture(double scale) :
         scale(scale) {
     }
 
+    noise_texture(double scale, const perlin &noise) :
+        noise(noise), scale(scale) {
+    }
+
+    const perlin &generator() const { return noise; }
+
     color value(double u, double v, const point3 &p) const override {
         return color(.5, .5, .5) * (1 + std::sin(scale * p.z() + 10 * noise.turb(p, 7)));
     }
 
+    color average() const override {
+        return color(.5, .5, .5);
+    }
+
 private:
     perlin noise;
     double scale;
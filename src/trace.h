@@ -0,0 +1,189 @@
+#ifndef TRACE_H
+#define TRACE_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Timeline tracing records spans of work per thread and writes them at exit as Chrome trace
+// event JSON, which Perfetto (ui.perfetto.dev) and chrome://tracing display as a timeline.
+// It is off until enabled, with trace_recorder::enable or by naming the output file in the
+// RTW_TRACE environment variable; a span costs one atomic load while it is off.
+
+class trace_recorder {
+public:
+    static const size_t ring_size = 1 << 16; // Spans kept per thread; older ones are overwritten
+
+    static trace_recorder &instance() {
+        // The environment is read once the recorder is constructed, so that the exit hook is
+        // registered after it and runs before its destructor.
+        static trace_recorder recorder;
+        static bool from_environment = recorder.enable_from_environment();
+        (void)from_environment;
+        return recorder;
+    }
+
+    bool enabled() const {
+        return recording.load(std::memory_order_relaxed);
+    }
+
+    void enable(const std::string &filename) {
+        // Starts recording, to be written to filename at exit.
+        std::lock_guard<std::mutex> lock(mutex);
+        output_file = filename;
+        if (!exit_hook) {
+            exit_hook = true;
+            std::atexit([] { instance().write_output(); });
+        }
+        recording.store(true, std::memory_order_relaxed);
+    }
+
+    int64_t now() const {
+        // Nanoseconds since the recorder was created.
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - origin).count();
+    }
+
+    static void record(const char *name, int64_t start, int64_t end, int64_t arg = -1) {
+        // Adds a span to the calling thread's ring. The name must outlive the recorder, as
+        // string literals do. Only the owning thread writes a ring, so no locking is needed.
+        auto &ring = local();
+        ring.events[ring.count % ring_size] = {name, start, end - start, arg};
+        ring.count++;
+    }
+
+    static void name_thread(const char *name) {
+        // Names the calling thread in the timeline, if recording.
+        if (instance().enabled())
+            local().name = name;
+    }
+
+    bool write(const std::string &filename) {
+        // Writes every recorded span. Only call while no thread is recording.
+        std::ofstream out(filename);
+        std::lock_guard<std::mutex> lock(mutex);
+        char buffer[256];
+
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        bool first = true;
+        for (const auto &ring : rings) {
+            std::snprintf(buffer, sizeof buffer,
+                          "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, \"tid\": %d, "
+                          "\"args\": {\"name\": \"%s %d\"}}",
+                          ring->id, ring->name, ring->id);
+            out << (first ? "" : ",\n") << buffer;
+            first = false;
+
+            auto count = ring->count < ring_size ? ring->count : uint64_t(ring_size);
+            for (auto n = ring->count - count; n < ring->count; n++) {
+                const auto &e = ring->events[n % ring_size];
+                std::snprintf(buffer, sizeof buffer,
+                              "{\"ph\": \"X\", \"name\": \"%s\", \"pid\": 1, \"tid\": %d, "
+                              "\"ts\": %.3f, \"dur\": %.3f",
+                              e.name, ring->id, e.start * 1e-3, e.duration * 1e-3);
+                out << ",\n" << buffer;
+                if (e.arg >= 0)
+                    out << ", \"args\": {\"n\": " << e.arg << "}";
+                out << "}";
+            }
+        }
+        out << "\n]}\n";
+        return bool(out);
+    }
+
+private:
+    struct span_event {
+        const char *name;
+        int64_t start;    // Nanoseconds since the recorder was created
+        int64_t duration; // Nanoseconds
+        int64_t arg;      // Optional index of the work item, -1 for none
+    };
+
+    struct ring_buffer {
+        std::vector<span_event> events;
+        uint64_t count = 0; // Spans recorded, including overwritten ones
+        int id;
+        const char *name = "thread";
+    };
+
+    std::atomic<bool> recording;
+    std::chrono::steady_clock::time_point origin;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ring_buffer>> rings; // Outlive their threads until exit
+    std::string output_file;
+    bool exit_hook = false;
+
+    trace_recorder() : recording(false), origin(std::chrono::steady_clock::now()) {
+    }
+
+    bool enable_from_environment() {
+        auto filename = std::getenv("RTW_TRACE");
+        if (filename)
+            enable(filename);
+        return filename != nullptr;
+    }
+
+    static ring_buffer &local() {
+        static thread_local ring_buffer *ring = nullptr;
+        if (!ring)
+            ring = instance().add_ring();
+        return *ring;
+    }
+
+    ring_buffer *add_ring() {
+        std::unique_ptr<ring_buffer> ring(new ring_buffer);
+        ring->events.resize(ring_size);
+        std::lock_guard<std::mutex> lock(mutex);
+        ring->id = int(rings.size());
+        rings.push_back(std::move(ring));
+        return rings.back().get();
+    }
+
+    void write_output() {
+        recording.store(false, std::memory_order_relaxed);
+        if (!write(output_file))
+            std::cerr << "ERROR: Could not write trace '" << output_file << "'.\n";
+    }
+};
+
+class trace_span {
+    // Records the time from construction to destruction as a span of the calling thread.
+public:
+    explicit trace_span(const char *name, int64_t arg = -1) :
+        name(trace_recorder::instance().enabled() ? name : nullptr), arg(arg)
+    {
+        if (this->name)
+            start = trace_recorder::instance().now();
+    }
+
+    ~trace_span() {
+        if (name)
+            trace_recorder::record(name, start, trace_recorder::instance().now(), arg);
+    }
+
+    trace_span(const trace_span &) = delete;
+    trace_span &operator=(const trace_span &) = delete;
+
+private:
+    const char *name;
+    int64_t arg;
+    int64_t start = 0;
+};
+
+#endif
@@ -164,6 +164,13 @@ inline vec3 refract(const vec3 &uv, const vec3 &n, double etai_over_etat) {
     return r_out_perp + r_out_parallel;
 }
 
+inline double angle_between(const vec3 &a, const vec3 &b) {
+    // Numerically robust angle between two unit vectors.
+    if (dot(a, b) < 0)
+        return pi - 2 * std::asin(std::fmin(1.0, (a + b).length() / 2));
+    return 2 * std::asin(std::fmin(1.0, (b - a).length() / 2));
+}
+
 inline vec3 random_cosine_direction() {
     auto r1 = random_double();
     auto r2 = random_double();